@@ -0,0 +1,98 @@
+/* Per-fault latency as seen by a client.  Touches NPAGES pages (the
+ * whole client address space) in order, first reading and then
+ * writing each one, for a few passes.  With fewer MMU frames than
+ * pages every read faults the page in and every write faults again
+ * to get write permission.  A second set of passes only writes, so
+ * every write faults on a page that is not resident; with `mmu -w`
+ * that takes one fault instead of two.  Reports latency percentiles
+ * in microseconds for each kind of access.  Run against a live MMU,
+ * once per client mode:
+ *
+ *   ./bin/mmu 64 1024 > /dev/null &
+ *   ./bin/bench-fault
+ *   UVM_FAULT_HANDOFF=1 ./bin/bench-fault
+ *   UVM_USERFAULTFD=1 ./bin/bench-fault */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uvm.h"
+
+#define NPAGES 256
+#define NPASSES 16
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp(const void *va, const void *vb)
+{
+	double a = *(const double *)va;
+	double b = *(const double *)vb;
+	return (a > b) - (a < b);
+}
+
+static void report(const char *name, double *lat, int n)
+{
+	double sum = 0;
+	for(int i = 0; i < n; ++i) sum += lat[i];
+	qsort(lat, n, sizeof(*lat), cmp);
+	printf("%-6s %8d %10.1f %10.1f %10.1f %10.1f\n", name, n, sum / n,
+			lat[n/2], lat[n*99/100], lat[n-1]);
+}
+
+int main(void)
+{
+	uvm_create();
+	char *pages[NPAGES];
+	for(int i = 0; i < NPAGES; ++i) {
+		pages[i] = uvm_extend();
+		if(!pages[i]) {
+			fprintf(stderr, "uvm_extend failed at page %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	int n = NPAGES * NPASSES;
+	double *rd = malloc(n * sizeof(*rd));
+	double *wr = malloc(n * sizeof(*wr));
+	double *wf = malloc(n * sizeof(*wf));
+	volatile char sink;
+	for(int p = 0; p < NPASSES; ++p) {
+		for(int i = 0; i < NPAGES; ++i) {
+			double t0 = now();
+			sink = pages[i][0];
+			double t1 = now();
+			pages[i][0] = sink + 1;
+			double t2 = now();
+			rd[p*NPAGES + i] = t1 - t0;
+			wr[p*NPAGES + i] = t2 - t1;
+		}
+	}
+	for(int p = 0; p < NPASSES; ++p) {
+		for(int i = 0; i < NPAGES; ++i) {
+			double t0 = now();
+			pages[i][1] = (char)p;
+			wf[p*NPAGES + i] = now() - t0;
+		}
+	}
+
+	const char *handoff = getenv("UVM_FAULT_HANDOFF");
+	const char *uffd = getenv("UVM_USERFAULTFD");
+	printf("mode: %s\n", uffd && atoi(uffd) ? "userfaultfd"
+			: handoff && atoi(handoff) ? "handoff" : "direct");
+	printf("%-6s %8s %10s %10s %10s %10s\n", "fault", "count", "mean",
+			"p50", "p99", "max");
+	report("read", rd, n);
+	report("write", wr, n);
+	report("wfirst", wf, n);
+	free(rd);
+	free(wr);
+	free(wf);
+	exit(EXIT_SUCCESS);
+}
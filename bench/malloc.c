@@ -0,0 +1,118 @@
+/* Allocation throughput of `uvm_malloc` versus the C library `malloc`
+ * on the same workload.  Each thread keeps NLIVE objects alive and
+ * replaces a random one per operation: free it, then allocate a new
+ * object with a random size (mostly small, some up to a few pages) and
+ * write its first and last bytes.  The sequence of sizes is the same
+ * for both allocators.  Runs with one thread and with NTHREADS
+ * threads, and reports millions of free+malloc pairs per second.  The
+ * live set fits in the client address space; run against a live MMU
+ * with enough frames to hold every page, so the numbers measure the
+ * allocators rather than paging:
+ *
+ *   ./bin/mmu 256 1024 > /dev/null &
+ *   ./bin/bench-malloc */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uvm.h"
+
+#define NLIVE 256	/* per thread */
+#define NOPS 200000	/* per thread */
+#define NTHREADS 4
+
+struct allocator {
+	const char *name;
+	void * (*malloc)(size_t);
+	void (*free)(void *);
+};
+
+struct worker {
+	const struct allocator *a;
+	uint64_t seed;
+	int nthreads;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t next(uint64_t *state)
+{
+	/* xorshift64 */
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static size_t pick_size(uint64_t *state, int nthreads)
+{
+	uint64_t r = next(state);
+	switch(r % 100) {
+	case 0: return nthreads == 1 ? 4096 + r % 8192 : 2049 + r % 2048;
+	case 1 ... 9: return 257 + r % 1792;
+	default: return 8 + r % 249;
+	}
+}
+
+static void * run(void *arg)
+{
+	struct worker *w = arg;
+	const struct allocator *a = w->a;
+	uint64_t state = w->seed;
+	char *live[NLIVE] = { NULL };
+	for(int i = 0; i < NOPS; ++i) {
+		int k = next(&state) % NLIVE;
+		a->free(live[k]);
+		size_t size = pick_size(&state, w->nthreads);
+		live[k] = a->malloc(size);
+		if(!live[k]) {
+			fprintf(stderr, "%s failed for %zu bytes\n", a->name, size);
+			exit(EXIT_FAILURE);
+		}
+		live[k][0] = live[k][size - 1] = (char)i;
+	}
+	for(int k = 0; k < NLIVE; ++k) a->free(live[k]);
+	return NULL;
+}
+
+static double bench(const struct allocator *a, int nthreads)
+{
+	pthread_t threads[NTHREADS];
+	struct worker workers[NTHREADS];
+	double t0 = now();
+	for(int i = 0; i < nthreads; ++i) {
+		workers[i].a = a;
+		workers[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+		workers[i].nthreads = nthreads;
+		pthread_create(&threads[i], NULL, run, &workers[i]);
+	}
+	for(int i = 0; i < nthreads; ++i) pthread_join(threads[i], NULL);
+	return (double)nthreads * NOPS / (now() - t0);
+}
+
+int main(void)
+{
+	uvm_create();
+	struct allocator allocators[] = {
+		{ "glibc", malloc, free },
+		{ "uvm", uvm_malloc, uvm_free },
+	};
+	printf("%-8s %10s %10s\n", "alloc", "1 thread", "4 threads");
+	for(int i = 0; i < 2; ++i) {
+		/* warm up: first touch of managed pages faults */
+		bench(&allocators[i], 1);
+		double one = bench(&allocators[i], 1);
+		double many = bench(&allocators[i], NTHREADS);
+		printf("%-8s %10.2f %10.2f\n", allocators[i].name, one, many);
+	}
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,84 @@
+/* Progress of two processes with different miss-ratio curves sharing
+ * memory.  The first loops over SMALL pages, so it stops faulting once
+ * it holds them all; the second streams over LARGE pages, more than
+ * memory holds, so extra frames barely help it.  Splitting frames
+ * evenly leaves the first one short of its loop.  Both run for
+ * SECONDS seconds and report how many passes over their pages they
+ * made.  Compare an MMU with and without automatic partitioning, and
+ * look at the curves with `mmuctl -c PID` while it runs:
+ *
+ *   ./bin/mmu 32 512 > /dev/null &
+ *   ./bin/bench-partition
+ *   ./bin/mmu -p 32 512 > /dev/null &
+ *   ./bin/bench-partition */
+
+#include <sys/wait.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uvm.h"
+
+#define SMALL 24	/* pages */
+#define LARGE 256	/* pages */
+#define SECONDS 5
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int npages, int out)
+{
+	uvm_create();
+	printf("pid %d: %d pages\n", (int)getpid(), npages);
+	fflush(stdout);
+	char **pages = malloc(npages * sizeof(*pages));
+	for(int i = 0; i < npages; ++i) {
+		pages[i] = uvm_extend();
+		if(!pages[i]) {
+			perror("uvm_extend");
+			exit(EXIT_FAILURE);
+		}
+	}
+	double end = now() + SECONDS;
+	long passes;
+	for(passes = 0; now() < end; ++passes) {
+		for(int i = 0; i < npages; ++i) pages[i][passes % 4096] = (char)i;
+	}
+	if(write(out, &passes, sizeof(passes)) != sizeof(passes)) {
+		exit(EXIT_FAILURE);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+int main(void)
+{
+	int sizes[2] = { SMALL, LARGE };
+	int fds[2][2];
+	for(int i = 0; i < 2; ++i) {
+		if(pipe(fds[i])) {
+			perror("pipe");
+			exit(EXIT_FAILURE);
+		}
+		if(fork() == 0) run(sizes[i], fds[i][1]);
+		close(fds[i][1]);
+	}
+	long each[2];
+	for(int i = 0; i < 2; ++i) {
+		if(read(fds[i][0], &each[i], sizeof(each[i])) != sizeof(each[i])) {
+			fprintf(stderr, "client %d failed\n", i);
+			exit(EXIT_FAILURE);
+		}
+		close(fds[i][0]);
+	}
+	while(wait(NULL) > 0);
+	printf("loop over %d pages: %ld passes in %d s\n", SMALL, each[0], SECONDS);
+	printf("stream over %d pages: %ld passes in %d s\n", LARGE, each[1],
+			SECONDS);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,112 @@
+/* Microbenchmark for the page kernels in src/pgmem.c.  For every
+ * variant the CPU supports, reports the throughput in GB/s of page
+ * fill, copy, fill detection, equality, and hex encoding over a working set that
+ * fits in cache (the default MMU physical memory size) and one that
+ * does not.  Run with `make bench && ./bin/bench-pgmem`. */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pgmem.h"
+
+#define MIN_BYTES (256UL << 20)
+
+static size_t PAGESIZE = 0;
+static volatile int sink = 0;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char * alloc(size_t sz)
+{
+	void *p;
+	if(posix_memalign(&p, PAGESIZE, sz)) abort();
+	memset(p, '0', sz);
+	return p;
+}
+
+/* returns GB/s moved by `op` over `npages` pages of `a` and `b`,
+ * repeating until at least MIN_BYTES were processed. */
+static double run(const struct pgmem_impl *impl, int op, char *a, char *b,
+		size_t npages)
+{
+	size_t rounds = MIN_BYTES / (npages * PAGESIZE);
+	if(rounds == 0) rounds = 1;
+	double start = now();
+	for(size_t r = 0; r < rounds; ++r) {
+		for(size_t i = 0; i < npages; ++i) {
+			char *pa = a + i*PAGESIZE;
+			char *pb = b + i*PAGESIZE;
+			switch(op) {
+			case 0: impl->fill(pa, '0', PAGESIZE); break;
+			case 1: impl->copy(pa, pb, PAGESIZE); break;
+			case 2: sink += impl->is_filled(pa, '0', PAGESIZE); break;
+			case 3: sink += impl->equal(pa, pb, PAGESIZE); break;
+			case 4: /* text pages take two digits per byte */
+				sink += impl->hex(b + (i % (npages/2)) * 2*PAGESIZE,
+						pa, PAGESIZE);
+				break;
+			}
+		}
+	}
+	double elapsed = now() - start;
+	return (double)rounds * npages * PAGESIZE / elapsed / 1e9;
+}
+
+static void check(const struct pgmem_impl *impl, char *a, char *b)
+{
+	impl->fill(a, 'x', PAGESIZE);
+	assert(impl->is_filled(a, 'x', PAGESIZE));
+	a[PAGESIZE-1] = 'y';
+	assert(!impl->is_filled(a, 'x', PAGESIZE));
+	impl->copy(b, a, PAGESIZE);
+	assert(impl->equal(a, b, PAGESIZE));
+	b[0] = 'z';
+	assert(!impl->equal(a, b, PAGESIZE));
+
+	/* odd offset and length, some bytes sign extended */
+	char hex[8*100], want[8*100 + 1];
+	for(int i = 0; i < 100; ++i) a[i] = (i % 7) ? 'a' + i % 26 : 0x80 + i;
+	size_t n = impl->hex(hex, a + 1, 99);
+	size_t m = 0;
+	for(int i = 1; i < 100; ++i) m += sprintf(want + m, "%02x", (unsigned)a[i]);
+	assert(n == m && memcmp(hex, want, m) == 0);
+}
+
+int main(void)
+{
+	PAGESIZE = sysconf(_SC_PAGESIZE);
+	size_t sets[] = { 256, 16384 };	/* 1 MiB and 64 MiB of pages */
+	const char *ops[] = { "fill", "copy", "is_filled", "equal", "hex" };
+
+	printf("%-8s %8s %10s %10s %10s %10s %10s\n", "variant", "set", ops[0],
+			ops[1], ops[2], ops[3], ops[4]);
+	for(int s = 0; s < 2; ++s) {
+		size_t npages = sets[s];
+		char *a = alloc(npages * PAGESIZE);
+		char *b = alloc(npages * PAGESIZE);
+		for(int i = 0; i < pgmem_nimpls; ++i) {
+			const struct pgmem_impl *impl = &pgmem_impls[i];
+			if(!impl->supported()) continue;
+			check(impl, a, b);
+			memset(a, '0', PAGESIZE);
+			memset(b, '0', PAGESIZE);
+			printf("%-8s %6zuKiB", impl->name, npages * PAGESIZE >> 10);
+			for(int op = 0; op < 5; ++op) {
+				printf(" %10.2f", run(impl, op, a, b, npages));
+			}
+			printf("\n");
+		}
+		free(a);
+		free(b);
+	}
+	return 0;
+}
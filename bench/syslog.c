@@ -0,0 +1,96 @@
+/* Per-line cost of logging with `uvm_syslog` versus `uvm_syslogv`.
+ * Writes NLINES short lines spread over NPAGES pages, once with one
+ * `uvm_syslog` call per line and once with `uvm_syslogv` in batches
+ * of BATCH lines, and reports the mean time per line in microseconds.
+ * Then logs payloads from 1 B to 64 KiB (crossing pages for the large
+ * ones) with `uvm_syslog` and reports the time per call and the
+ * throughput in MB of payload per second.  Run against a live MMU with
+ * enough frames to hold every page:
+ *
+ *   ./bin/mmu 64 1024 > /dev/null &
+ *   ./bin/bench-syslog */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uvm.h"
+
+#define NPAGES 32
+#define NLINES 4096
+#define BATCH 32
+#define PAYLOAD_BYTES (16 << 20)	/* per payload size, within limits */
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(void)
+{
+	uvm_create();
+	char *pages[NPAGES];
+	for(int i = 0; i < NPAGES; ++i) {
+		pages[i] = uvm_extend();
+		if(!pages[i]) {
+			fprintf(stderr, "uvm_extend failed at page %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+		sprintf(pages[i], "page %02d", i);
+	}
+	size_t len = strlen(pages[0]);
+
+	double t0 = now();
+	for(int i = 0; i < NLINES; ++i) {
+		if(uvm_syslog(pages[i % NPAGES], len)) {
+			perror("uvm_syslog");
+			exit(EXIT_FAILURE);
+		}
+	}
+	double single = (now() - t0) / NLINES;
+
+	struct iovec iov[BATCH];
+	t0 = now();
+	for(int i = 0; i < NLINES; i += BATCH) {
+		for(int j = 0; j < BATCH; ++j) {
+			iov[j].iov_base = pages[(i + j) % NPAGES];
+			iov[j].iov_len = len;
+		}
+		if(uvm_syslogv(iov, BATCH) != BATCH) {
+			perror("uvm_syslogv");
+			exit(EXIT_FAILURE);
+		}
+	}
+	double vectored = (now() - t0) / NLINES;
+
+	printf("%-8s %8s %10s\n", "call", "lines", "us/line");
+	printf("%-8s %8d %10.2f\n", "syslog", NLINES, single);
+	printf("%-8s %8d %10.2f\n", "syslogv", NLINES, vectored);
+
+	/* pages are contiguous, so payloads can span several of them */
+	for(int i = 0; i < NPAGES; ++i) {
+		memset(pages[i], 'a' + i % 26, sysconf(_SC_PAGESIZE));
+	}
+	printf("\n%-8s %8s %10s %10s\n", "payload", "calls", "us/call", "MB/s");
+	for(size_t size = 1; size <= (64 << 10); size *= 4) {
+		int calls = PAYLOAD_BYTES / size;
+		if(calls < 256) calls = 256;
+		if(calls > 4096) calls = 4096;
+		t0 = now();
+		for(int i = 0; i < calls; ++i) {
+			if(uvm_syslog(pages[0], size)) {
+				perror("uvm_syslog");
+				exit(EXIT_FAILURE);
+			}
+		}
+		double elapsed = now() - t0;
+		printf("%-8zu %8d %10.2f %10.2f\n", size, calls, elapsed / calls,
+				size * calls / elapsed);
+	}
+	exit(EXIT_SUCCESS);
+}
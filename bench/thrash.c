@@ -0,0 +1,83 @@
+/* Total run time of processes whose working sets do not fit in memory
+ * together.  Forks NPROCS clients; each allocates WSET pages and
+ * writes every page of them NPASSES times, so with fewer than
+ * NPROCS * WSET frames the clients keep paging out each other's pages.
+ * Reports the wall time until every client finishes and how long
+ * each one took.  Compare an MMU with and without load control:
+ *
+ *   ./bin/mmu 32 256 > /dev/null &
+ *   ./bin/bench-thrash
+ *   ./bin/mmu -t 32 256 > /dev/null &
+ *   ./bin/bench-thrash */
+
+#include <sys/wait.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uvm.h"
+
+#define NPROCS 4
+#define WSET 24	/* pages per process */
+#define NPASSES 200
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int id, int out)
+{
+	uvm_create();
+	long pagesz = sysconf(_SC_PAGESIZE);
+	char *pages[WSET];
+	for(int i = 0; i < WSET; ++i) {
+		pages[i] = uvm_extend();
+		if(!pages[i]) {
+			perror("uvm_extend");
+			exit(EXIT_FAILURE);
+		}
+	}
+	double t0 = now();
+	for(int pass = 0; pass < NPASSES; ++pass) {
+		for(int i = 0; i < WSET; ++i) {
+			pages[i][(pass * 64) % pagesz] = (char)(id + pass);
+		}
+	}
+	double elapsed = now() - t0;
+	if(write(out, &elapsed, sizeof(elapsed)) != sizeof(elapsed)) {
+		exit(EXIT_FAILURE);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+int main(void)
+{
+	int fds[NPROCS][2];
+	double t0 = now();
+	for(int i = 0; i < NPROCS; ++i) {
+		if(pipe(fds[i])) {
+			perror("pipe");
+			exit(EXIT_FAILURE);
+		}
+		if(fork() == 0) run(i, fds[i][1]);
+		close(fds[i][1]);
+	}
+	double each[NPROCS];
+	for(int i = 0; i < NPROCS; ++i) {
+		if(read(fds[i][0], &each[i], sizeof(each[i])) != sizeof(each[i])) {
+			fprintf(stderr, "client %d failed\n", i);
+			exit(EXIT_FAILURE);
+		}
+		close(fds[i][0]);
+	}
+	while(wait(NULL) > 0);
+	printf("%d processes x %d pages x %d passes: %.2f s\n",
+			NPROCS, WSET, NPASSES, now() - t0);
+	for(int i = 0; i < NPROCS; ++i) printf("  client %d: %.2f s\n", i, each[i]);
+	exit(EXIT_SUCCESS);
+}
@@ -10,11 +10,10 @@ cat mempager-tests/tests.spec | while read num frames blocks nodiff ; do
     ./bin/test$num &> test$num.out
     kill -SIGINT %1
     wait
-    rm -rf mmu.sock mmu.pmem.img.*
-    if [ $nodiff -eq 1 ] ; then
-        continue
-    fi
-    if ! diff mempager-tests/test$num.mmu.out test$num.mmu.out > /dev/null ; then
+    rm -rf mmu.sock
+    # the MMU output of nodiff tests depends on thread scheduling
+    if [ $nodiff -eq 0 ] && \
+            ! diff mempager-tests/test$num.mmu.out test$num.mmu.out > /dev/null ; then
         echo "test$num.mmu.out differs"
     fi
     if ! diff mempager-tests/test$num.out test$num.out > /dev/null ; then
@@ -0,0 +1,54 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+int num_threads = 8;
+int num_pages = 8;
+int num_loops = 16; /* run with ./mmu 16 128 */
+
+/* Each thread allocates its own pages and faults on them concurrently
+ * with the others; every thread must get its own replies. */
+void * worker(void *arg) {
+	int tid = (int)(intptr_t)arg;
+	int checked = 0;
+	char **pages = malloc(num_pages * sizeof(pages[0]));
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		assert(pages[i]);
+	}
+	for(int i = 0; i < num_loops; ++i) {
+		for(int j = 0; j < num_pages; ++j) {
+			sprintf(pages[j], "t%02d-p%02d-l%02d", tid, j, i);
+		}
+		for(int j = 0; j < num_pages; ++j) {
+			char expected[32];
+			sprintf(expected, "t%02d-p%02d-l%02d", tid, j, i);
+			assert(strcmp(pages[j], expected) == 0);
+			assert(uvm_syslog(pages[j], strlen(expected)) == 0);
+			checked++;
+		}
+	}
+	free(pages);
+	return (void *)(intptr_t)checked;
+}
+
+int main(void) {
+	uvm_create();
+	pthread_t threads[num_threads];
+	for(int i = 0; i < num_threads; ++i) {
+		pthread_create(&threads[i], NULL, worker, (void *)(intptr_t)i);
+	}
+	for(int i = 0; i < num_threads; ++i) {
+		void *checked;
+		pthread_join(threads[i], &checked);
+		printf("t%02d %d\n", i, (int)(intptr_t)checked);
+	}
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,63 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+int num_threads = 8;
+int num_pages = 32;
+int num_loops = 8; /* run with ./mmu 8 64 */
+
+char **pages;
+
+/* All threads touch the same pages, each in its own slot, so they
+ * keep faulting on the same page at the same time. */
+void * worker(void *arg) {
+	int tid = (int)(intptr_t)arg;
+	for(int i = 0; i < num_loops; ++i) {
+		for(int j = 0; j < num_pages; ++j) {
+			sprintf(pages[j] + 32*tid, "t%02d-p%02d-l%02d", tid, j, i);
+		}
+		for(int j = 0; j < num_pages; ++j) {
+			char expected[32];
+			sprintf(expected, "t%02d-p%02d-l%02d", tid, j, i);
+			assert(strcmp(pages[j] + 32*tid, expected) == 0);
+		}
+	}
+	return NULL;
+}
+
+int main(void) {
+	uvm_create();
+	pages = malloc(num_pages * sizeof(pages[0]));
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		assert(pages[i]);
+	}
+	pthread_t threads[num_threads];
+	for(int i = 0; i < num_threads; ++i) {
+		pthread_create(&threads[i], NULL, worker, (void *)(intptr_t)i);
+	}
+	for(int i = 0; i < num_threads; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	for(int i = 0; i < num_pages; ++i) {
+		assert(uvm_syslog(pages[i], 32*num_threads) == 0);
+	}
+	/* every thread's last write must have survived the others' */
+	int intact = 0;
+	for(int i = 0; i < num_pages; ++i) {
+		for(int tid = 0; tid < num_threads; ++tid) {
+			char expected[40];
+			sprintf(expected, "t%02d-p%02d-l%02d", tid, i, num_loops - 1);
+			intact += strcmp(pages[i] + 32*tid, expected) == 0;
+		}
+	}
+	printf("%d of %d slots intact\n", intact, num_pages * num_threads);
+	exit(EXIT_SUCCESS);
+}
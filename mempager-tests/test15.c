@@ -0,0 +1,39 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+int main(void) {
+	uvm_create();
+	char *page0 = uvm_extend();
+	char *page1 = uvm_extend();
+	strcpy(page0, "hello");
+	strcpy(page1, "world");
+	strcpy(page0 + 100, "again");
+
+	struct iovec iov[70];
+	iov[0].iov_base = page0; iov[0].iov_len = strlen(page0);
+	iov[1].iov_base = page1; iov[1].iov_len = strlen(page1);
+	iov[2].iov_base = page0 + 100; iov[2].iov_len = strlen(page0 + 100);
+	printf("%d\n", uvm_syslogv(iov, 3));
+
+	/* the second buffer is past the allocated pages */
+	iov[1].iov_base = (char *)UVM_BASEADDR + 2*4096; iov[1].iov_len = 4;
+	errno = 0;
+	int logged = uvm_syslogv(iov, 3);
+	printf("%d %d\n", logged, errno == EINVAL);
+
+	/* more buffers than fit in one request */
+	for(int i = 0; i < 70; ++i) {
+		iov[i].iov_base = page1 + i;
+		iov[i].iov_len = 1;
+	}
+	printf("%d\n", uvm_syslogv(iov, 70));
+	exit(EXIT_SUCCESS);
+}
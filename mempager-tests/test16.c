@@ -0,0 +1,31 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+/* run with ./mmu 2 8 so that syslog finds pages swapped out */
+int main(void) {
+	uvm_create();
+	long pagesz = sysconf(_SC_PAGESIZE);
+	char *pages[4];
+	for(int i = 0; i < 4; ++i) {
+		pages[i] = uvm_extend();
+		assert(pages[i]);
+	}
+	for(int i = 0; i < 4; ++i) {
+		memset(pages[i], 'a' + i, pagesz);
+	}
+	/* crosses from page 0 into page 1, both on disk */
+	assert(uvm_syslog(pages[0] + pagesz - 3, 6) == 0);
+	/* the previous call evicted pages 2 and 3 */
+	assert(uvm_syslog(pages[2] + pagesz - 2, 4) == 0);
+	/* past the last page */
+	assert(uvm_syslog(pages[3] + pagesz - 1, 2) == -1);
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
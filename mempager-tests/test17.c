@@ -0,0 +1,42 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+/* run with ./mmu 2 8 */
+int main(void) {
+	uvm_create();
+	long pagesz = sysconf(_SC_PAGESIZE);
+	char *pages[4];
+	for(int i = 0; i < 4; ++i) {
+		pages[i] = uvm_extend();
+		assert(pages[i]);
+		memset(pages[i], 'a' + i, pagesz);
+	}
+
+	/* punch a hole; page 1 is on disk */
+	printf("%d\n", uvm_release(pages[1], 1));
+	errno = 0;
+	int r = uvm_release(pages[1], 1);
+	printf("%d %d\n", r, errno == EINVAL);
+	assert(uvm_syslog(pages[1], 4) == -1);
+
+	/* shrink from the top; pages 2 and 3 are resident.  The hole at
+	 * page 1 is now at the top too, so it is handed out first */
+	printf("%d\n", uvm_release(pages[2], 2));
+	char *again = uvm_extend();
+	printf("%d %c\n", again == pages[1], again[0]);
+	assert(uvm_syslog(pages[0], 4) == 0);
+
+	/* the blocks of released pages can be allocated again */
+	int n = 0;
+	while(uvm_extend()) n++;
+	printf("%d\n", n);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,50 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+/* run with ./mmu 4 16 */
+int main(void) {
+	uvm_create();
+	char *pages[12];
+	for(int i = 0; i < 12; ++i) {
+		pages[i] = uvm_extend();
+		assert(pages[i]);
+	}
+	for(int i = 0; i < 12; ++i) {
+		sprintf(pages[i], "page %02d", i);
+	}
+
+	/* a scan reads ahead and drops the pages it moved past */
+	printf("%d\n", uvm_advise(pages[0], 12, UVM_ADV_SEQUENTIAL));
+	for(int i = 0; i < 12; ++i) {
+		assert(pages[i][5] == '0' + i / 10);
+	}
+	printf("%d\n", uvm_advise(pages[0], 12, UVM_ADV_RANDOM));
+
+	/* brought in without faults, then paged out keeping the contents */
+	printf("%d\n", uvm_advise(pages[0], 2, UVM_ADV_WILLNEED));
+	assert(strcmp(pages[1], "page 01") == 0);
+	printf("%d\n", uvm_advise(pages[0], 1, UVM_ADV_DONTNEED));
+	assert(strcmp(pages[0], "page 00") == 0);
+
+	/* page 1 is evicted first although it was used most recently */
+	printf("%d\n", uvm_advise(pages[1], 1, UVM_ADV_COLD));
+	assert(strcmp(pages[2], "page 02") == 0);
+	assert(strcmp(pages[3], "page 03") == 0);
+	assert(strcmp(pages[4], "page 04") == 0);
+
+	errno = 0;
+	int r = uvm_advise(pages[0], 1, 99);
+	printf("%d %d\n", r, errno == EINVAL);
+	errno = 0;
+	r = uvm_advise(pages[11], 2, UVM_ADV_NORMAL);
+	printf("%d %d\n", r, errno == EINVAL);
+	exit(EXIT_SUCCESS);
+}
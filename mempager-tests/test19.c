@@ -0,0 +1,48 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+/* run with ./mmu 8 32; a process may pin 2 frames */
+int main(void) {
+	uvm_create();
+	char *pages[12];
+	for(int i = 0; i < 12; ++i) {
+		pages[i] = uvm_extend();
+		assert(pages[i]);
+		sprintf(pages[i], "page %02d", i);
+	}
+
+	printf("%d\n", uvm_pin(pages[0], 2));
+	errno = 0;
+	int r = uvm_pin(pages[2], 1);
+	printf("%d %d\n", r, errno == ENOMEM);
+	printf("%d\n", uvm_pin(pages[0], 1));
+
+	/* pages 0 and 1 stay resident while the others cycle */
+	for(int pass = 0; pass < 2; ++pass) {
+		for(int i = 2; i < 12; ++i) pages[i][0] = 'P';
+	}
+	assert(strcmp(pages[0], "page 00") == 0);
+	assert(strcmp(pages[1], "page 01") == 0);
+
+	printf("%d\n", uvm_unpin(pages[0], 1));
+	printf("%d\n", uvm_pin(pages[2], 1));
+	errno = 0;
+	r = uvm_pin(pages[10], 1);
+	printf("%d %d\n", r, errno == ENOMEM);
+
+	/* releasing a pinned page gives its share back */
+	printf("%d\n", uvm_release(pages[1], 1));
+	errno = 0;
+	r = uvm_pin(pages[1], 1);
+	printf("%d %d\n", r, errno == EINVAL);
+	printf("%d\n", uvm_pin(pages[10], 1));
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,82 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+#define NSMALL 100
+
+/* run with ./mmu 4 64 */
+int main(void) {
+	uvm_create();
+	long pagesz = sysconf(_SC_PAGESIZE);
+
+	/* small objects share a slab page and are reused after free */
+	char *small[NSMALL];
+	for(int i = 0; i < NSMALL; ++i) {
+		small[i] = uvm_malloc(24);
+		assert(small[i]);
+		sprintf(small[i], "obj%03d", i);
+	}
+	int samepage = 1;
+	for(int i = 0; i < NSMALL; ++i) {
+		char expected[8];
+		sprintf(expected, "obj%03d", i);
+		assert(strcmp(small[i], expected) == 0);
+		samepage &= (intptr_t)small[i] / pagesz == (intptr_t)small[0] / pagesz;
+	}
+	printf("%d %d\n", samepage, (int)((small[1] - small[0]) % 16));
+	assert(uvm_syslog(small[42], 6) == 0);
+	intptr_t slab = (intptr_t)small[0] / pagesz;
+	for(int i = 0; i < NSMALL; ++i) uvm_free(small[i]);
+	for(int i = 0; i < NSMALL; ++i) {
+		small[i] = uvm_malloc(20);
+		samepage &= (intptr_t)small[i] / pagesz == slab;
+	}
+	printf("%d\n", samepage);
+	for(int i = 1; i < NSMALL; ++i) uvm_free(small[i]);
+
+	/* large requests get page-aligned runs */
+	char *big = uvm_malloc(3 * pagesz);
+	assert(big);
+	memset(big, 'b', 3 * pagesz);
+	printf("%d\n", (int)((intptr_t)big % pagesz));
+
+	/* realloc keeps the contents, calloc zeroes fresh memory */
+	strcpy(small[0], "moved");
+	char *grown = uvm_realloc(small[0], 2 * pagesz);
+	printf("%s %d\n", grown, (int)((intptr_t)grown % pagesz));
+	char *zeros = uvm_calloc(8, 64);
+	int allzero = 1;
+	for(int i = 0; i < 8 * 64; ++i) allzero &= zeros[i] == 0;
+	printf("%d\n", allzero);
+
+	/* empty pages are released once there are too many of them; the
+	 * hole left below the calloc slab is handed out again */
+	uvm_free(big);
+	uvm_free(grown);
+	char *again = uvm_malloc(34 * pagesz);
+	assert(again);
+	again[33 * pagesz] = 'c';
+	assert(uvm_syslog(again + 33 * pagesz, 1) == 0);
+	uvm_free(again);
+	char *run = uvm_malloc(5 * pagesz);
+	memset(run, 'd', 5 * pagesz);
+	printf("%d\n", (int)(((intptr_t)run - UVM_BASEADDR) / pagesz));
+	uvm_free(run);
+	uvm_free(zeros);
+
+	errno = 0;
+	char *huge = uvm_malloc(UVM_MAXADDR - UVM_BASEADDR + 2);
+	printf("%d %d\n", huge == NULL, errno == ENOMEM);
+	/* rounding SIZE_MAX up to pages must not wrap around */
+	errno = 0;
+	huge = uvm_malloc(SIZE_MAX);
+	printf("%d %d\n", huge == NULL, errno == ENOMEM);
+	exit(EXIT_SUCCESS);
+}
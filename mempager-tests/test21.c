@@ -0,0 +1,77 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+#define NPAGES 3
+
+/* run with ./mmu 2 16 */
+static void child(int in, int out) {
+	char c;
+	assert(read(in, &c, 1) == 1);
+	uvm_create();
+	size_t npages = 0;
+	char *board = uvm_attach("board", &npages);
+	assert(board && npages == NPAGES);
+	long pagesz = sysconf(_SC_PAGESIZE);
+	/* sees the parent's writes, then writes back */
+	assert(strcmp(board, "parent") == 0);
+	assert(uvm_syslog(board, 6) == 0);
+	strcpy(board + pagesz, "child");
+	strcpy(board + 2 * pagesz, "child");
+	assert(uvm_release(board, NPAGES) == 0);
+	assert(write(out, &c, 1) == 1);
+	assert(read(in, &c, 1) == 0);
+	exit(EXIT_SUCCESS);
+}
+
+int main(void) {
+	int down[2], up[2];
+	assert(pipe(down) == 0 && pipe(up) == 0);
+	pid_t pid = fork();
+	if(pid == 0) {
+		close(down[1]);
+		close(up[0]);
+		child(down[0], up[1]);
+	}
+	close(down[0]);
+	close(up[1]);
+
+	uvm_create();
+	long pagesz = sysconf(_SC_PAGESIZE);
+	char *own = uvm_extend();
+	strcpy(own, "own");
+	char *board = uvm_share("board", NPAGES);
+	assert(board == own + pagesz);
+	strcpy(board, "parent");
+	errno = 0;
+	void *dup = uvm_share("board", 1);
+	int eexist = errno;
+	errno = 0;
+	void *none = uvm_attach("nothing", &(size_t){0});
+	int enoent = errno;
+	printf("%d %d %d %d\n", dup == NULL, eexist == EEXIST, none == NULL,
+			enoent == ENOENT);
+	errno = 0;
+	int pinned = uvm_pin(board, 1);
+	printf("%d %d\n", pinned, errno == EINVAL);
+
+	/* the child attaches at its own address and writes; with two
+	 * frames its pages push ours out, and ours push its out */
+	char c = 'x';
+	assert(write(down[1], &c, 1) == 1);
+	assert(read(up[0], &c, 1) == 1);
+	printf("%s %s %s\n", board + pagesz, board + 2 * pagesz, own);
+	assert(uvm_syslog(board + pagesz, 5) == 0);
+	close(down[1]);
+	waitpid(pid, NULL, 0);
+	exit(EXIT_SUCCESS);
+}
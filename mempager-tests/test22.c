@@ -0,0 +1,64 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+#define DATAFILE "test22.dat"
+
+/* run with ./mmu 2 4 */
+int main(void) {
+	uvm_create();
+	long pagesz = sysconf(_SC_PAGESIZE);
+
+	/* two and a half pages of 'a', 'b', 'c' */
+	size_t size = 2 * pagesz + pagesz / 2;
+	char *data = malloc(size);
+	for(size_t i = 0; i < size; ++i) data[i] = 'a' + i / pagesz;
+	int fd = open(DATAFILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	assert(fd != -1);
+	assert(write(fd, data, size) == (ssize_t)size);
+
+	/* pages come from the file; clean ones are dropped, not swapped */
+	char *priv = uvm_map_file(DATAFILE, 0, 3, UVM_MAP_PRIVATE);
+	assert(priv);
+	printf("%c %c %c %c\n", priv[0], priv[pagesz], priv[2 * pagesz],
+			priv[3 * pagesz - 1]);
+	assert(uvm_syslog(priv + pagesz - 2, 4) == 0);
+	/* private writes go to swap and never reach the file */
+	strcpy(priv, "private");
+	printf("%c %c %s\n", priv[2 * pagesz], priv[pagesz], priv);
+	char c;
+	assert(pread(fd, &c, 1, 0) == 1);
+	printf("%c\n", c);
+
+	/* writeback pages go back to the file when paged out and released */
+	char *wb = uvm_map_file(DATAFILE, pagesz, 2, UVM_MAP_WRITEBACK);
+	assert(wb);
+	strcpy(wb, "paged");
+	strcpy(wb + pagesz, "released");
+	printf("%c %c\n", priv[0], priv[1]);
+	assert(uvm_release(wb, 2) == 0);
+	char buf[16];
+	assert(pread(fd, buf, 6, pagesz) == 6);
+	assert(pread(fd, buf + 6, 9, 2 * pagesz) == 9);
+	printf("%s %s\n", buf, buf + 6);
+	printf("%d\n", (int)lseek(fd, 0, SEEK_END) == (int)size);
+
+	errno = 0;
+	void *bad = uvm_map_file(DATAFILE, 1, 1, UVM_MAP_PRIVATE);
+	int einval = errno;
+	errno = 0;
+	void *none = uvm_map_file("test22.none", 0, 1, UVM_MAP_PRIVATE);
+	int enoent = errno;
+	printf("%d %d %d %d\n", bad == NULL, einval == EINVAL, none == NULL,
+			enoent == ENOENT);
+	close(fd);
+	unlink(DATAFILE);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,39 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+#define NPAGES 4
+
+/* run with ./mmu 4 8 */
+int main(void) {
+	uvm_create();
+	errno = 0;
+	int r = uvm_rss_limit(2, 1);
+	printf("%d %d\n", r, errno == EINVAL);
+	errno = 0;
+	r = uvm_rss_limit(4, 0);
+	printf("%d %d\n", r, errno == ENOMEM);
+	r = uvm_rss_limit(1, 2);
+	printf("%d\n", r);
+
+	/* only two of the four frames are used */
+	char *pages[NPAGES];
+	for(int i = 0; i < NPAGES; ++i) {
+		pages[i] = uvm_extend();
+		sprintf(pages[i], "page%d", i);
+	}
+	for(int i = 0; i < NPAGES; ++i) {
+		assert(uvm_syslog(pages[i], 5) == 0);
+	}
+
+	/* lifting the limit lets faults use free frames again */
+	r = uvm_rss_limit(0, 0);
+	printf("%d %s %s\n", r, pages[0], pages[1]);
+	exit(EXIT_SUCCESS);
+}
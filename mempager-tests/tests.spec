@@ -10,3 +10,14 @@
 10 4 8 0
 11 2 3 1
 12 256 1024 1
+13 16 128 1
+14 8 64 1
+15 4 8 0
+16 2 8 0
+17 2 8 0
+18 4 16 0
+19 8 32 0
+20 4 64 0
+21 2 16 0
+22 2 4 0
+23 4 8 0
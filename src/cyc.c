@@ -6,6 +6,7 @@
 #include <unistd.h>
 
 #include "cyc.h"
+#include "lockprof.h"
 
 /*****************************************************************************
  * cyclic struct and function declarations
@@ -107,7 +108,7 @@ int cyc_printf(struct cyclic *cyc, const char *fmt, ...) /* {{{ */
 	int oldstate;
 	int cnt = 0;
 	va_start(ap, fmt);
-	pthread_mutex_lock(&cyc->mutex);
+	lock_acquire(&cyc->mutex);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
 	if(cyc_check_open_file(cyc)) {
 		vsnprintf(line, CYCLIC_LINEBUF, fmt, ap);
@@ -115,7 +116,7 @@ int cyc_printf(struct cyclic *cyc, const char *fmt, ...) /* {{{ */
 		fflush(cyc->file);
 	}
 	pthread_setcancelstate(oldstate, &oldstate);
-	pthread_mutex_unlock(&cyc->mutex);
+	lock_release(&cyc->mutex);
 	va_end(ap);
 	return cnt;
 } /* }}} */
@@ -125,7 +126,7 @@ int cyc_vprintf(struct cyclic *cyc, const char *fmt, va_list ap) /* {{{ */
 	char line[CYCLIC_LINEBUF];
 	int oldstate;
 	int cnt = 0;
-	pthread_mutex_lock(&cyc->mutex);
+	lock_acquire(&cyc->mutex);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
 	if(cyc_check_open_file(cyc)) {
 		vsnprintf(line, CYCLIC_LINEBUF, fmt, ap);
@@ -133,38 +134,38 @@ int cyc_vprintf(struct cyclic *cyc, const char *fmt, va_list ap) /* {{{ */
 		fflush(cyc->file);
 	}
 	pthread_setcancelstate(oldstate, &oldstate);
-	pthread_mutex_unlock(&cyc->mutex);
+	lock_release(&cyc->mutex);
 	return cnt;
 } /* }}} */
 
 void cyc_flush(struct cyclic *cyc) /* {{{ */
 {
 	int oldstate;
-	pthread_mutex_lock(&cyc->mutex);
+	lock_acquire(&cyc->mutex);
 	if(!cyc->file) {
-		pthread_mutex_unlock(&cyc->mutex);
+		lock_release(&cyc->mutex);
 		return;
 	}
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
 	fflush(cyc->file);
 	pthread_setcancelstate(oldstate, &oldstate);
-	pthread_mutex_unlock(&cyc->mutex);
+	lock_release(&cyc->mutex);
 } /* }}} */
 
 void cyc_file_lock(struct cyclic *cyc)/*{{{*/
 {
-	pthread_mutex_lock(&cyc->lock);
-	pthread_mutex_lock(&cyc->mutex);
+	lock_acquire(&cyc->lock);
+	lock_acquire(&cyc->mutex);
 	cyc->flock = 1;
-	pthread_mutex_unlock(&cyc->mutex);
+	lock_release(&cyc->mutex);
 }/*}}}*/
 
 void cyc_file_unlock(struct cyclic *cyc)/*{{{*/
 {
-	pthread_mutex_lock(&cyc->mutex);
+	lock_acquire(&cyc->mutex);
 	cyc->flock = 0;
-	pthread_mutex_unlock(&cyc->mutex);
-	pthread_mutex_unlock(&cyc->lock);
+	lock_release(&cyc->mutex);
+	lock_release(&cyc->lock);
 }/*}}}*/
 
 /*****************************************************************************
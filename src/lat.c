@@ -0,0 +1,108 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lat.h"
+
+/*****************************************************************************
+ * histogram definitions and static variables
+ ****************************************************************************/
+#define LAT_SUB_BITS 4	/* log2(LAT_SUB_BUCKETS) */
+#define LAT_NBUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS)
+
+struct lat_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[LAT_NBUCKETS];
+};
+
+static struct lat_hist hists[LAT_NSTAGES];
+
+static const char *names[LAT_NSTAGES] = {
+	"fault", "recv", "lock", "victim", "disk_read", "disk_write",
+	"zero_fill", "resident", "chprot",
+};
+
+static int lat_bucket(uint64_t ns);
+static uint64_t lat_bucket_high(int bucket);
+static uint64_t lat_percentile(const uint64_t *buckets, uint64_t count,
+		uint64_t max, double p);
+
+/*****************************************************************************
+ * public function implementations
+ ****************************************************************************/
+void lat_record(int stage, uint64_t ns) /* {{{ */
+{
+	struct lat_hist *h = &hists[stage];
+	__atomic_fetch_add(&h->buckets[lat_bucket(ns)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while(ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+} /* }}} */
+
+void lat_dump(FILE *file) /* {{{ */
+{
+	fprintf(file, "%-10s %10s %10s %10s %10s %10s %10s\n", "stage", "count",
+			"mean_us", "p50_us", "p99_us", "p999_us", "max_us");
+	for(int s = 0; s < LAT_NSTAGES; ++s) {
+		/* a snapshot; stages keep counting while we print */
+		uint64_t buckets[LAT_NBUCKETS];
+		uint64_t count = 0;
+		for(int i = 0; i < LAT_NBUCKETS; ++i) {
+			buckets[i] = __atomic_load_n(&hists[s].buckets[i],
+					__ATOMIC_RELAXED);
+			count += buckets[i];
+		}
+		uint64_t sum = __atomic_load_n(&hists[s].sum, __ATOMIC_RELAXED);
+		uint64_t max = __atomic_load_n(&hists[s].max, __ATOMIC_RELAXED);
+		double mean = count ? (double)sum / count : 0;
+		fprintf(file, "%-10s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+				names[s], (unsigned long long)count, mean / 1e3,
+				lat_percentile(buckets, count, max, 0.5) / 1e3,
+				lat_percentile(buckets, count, max, 0.99) / 1e3,
+				lat_percentile(buckets, count, max, 0.999) / 1e3, max / 1e3);
+	}
+	fflush(file);
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+/* Values below 2 * LAT_SUB_BUCKETS get a bucket each; above, each
+ * power of two is split in LAT_SUB_BUCKETS buckets. */
+static int lat_bucket(uint64_t ns) /* {{{ */
+{
+	if(ns < 2 * LAT_SUB_BUCKETS) return (int)ns;
+	int exp = 63 - __builtin_clzll(ns);
+	int shift = exp - LAT_SUB_BITS;
+	return shift * LAT_SUB_BUCKETS + (int)(ns >> shift);
+} /* }}} */
+
+/* The largest value that falls in =bucket=. */
+static uint64_t lat_bucket_high(int bucket) /* {{{ */
+{
+	if(bucket < 2 * LAT_SUB_BUCKETS) return bucket;
+	int shift = bucket / LAT_SUB_BUCKETS - 1;
+	uint64_t mantissa = bucket % LAT_SUB_BUCKETS + LAT_SUB_BUCKETS;
+	return ((mantissa + 1) << shift) - 1;
+} /* }}} */
+
+/* The top of the bucket holding the =p= quantile, but no more than the
+ * largest value recorded. */
+static uint64_t lat_percentile(const uint64_t *buckets, uint64_t count, /* {{{ */
+		uint64_t max, double p)
+{
+	if(count == 0) return 0;
+	uint64_t rank = (uint64_t)(p * count);
+	if(rank >= count) rank = count - 1;
+	uint64_t seen = 0;
+	for(int i = 0; i < LAT_NBUCKETS; ++i) {
+		seen += buckets[i];
+		if(seen <= rank) continue;
+		uint64_t high = lat_bucket_high(i);
+		return high < max ? high : max;
+	}
+	return max;
+} /* }}} */
@@ -0,0 +1,65 @@
+/* This module keeps latency histograms for the stages of the fault
+ * path, so a slow fault can be traced to the stage it spent its time
+ * in.  Histograms have logarithmic buckets, each split in
+ * LAT_SUB_BUCKETS linear ones (as in HDR histograms), so percentiles
+ * are within 1/LAT_SUB_BUCKETS of the true value from nanoseconds to
+ * hours.  Recording is a few atomic additions and never blocks:
+ *
+ * (1) take a timestamp with =lat_now= when a stage starts
+ * (2) call =lat_since= with the stage when it ends
+ * (3) print percentiles of every stage with =lat_dump=.
+ *
+ * The MMU dumps the histograms to LAT_DEFAULT_PATH on SIGUSR1 and
+ * when it shuts down. */
+
+#ifndef __LAT_HEADER__
+#define __LAT_HEADER__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* a whole SEGV request, from reading it to replying */
+#define LAT_FAULT 0
+/* reading the body of a request from the client socket */
+#define LAT_RECV 1
+/* waiting for the pager lock in a fault */
+#define LAT_LOCK 2
+/* choosing a frame to evict */
+#define LAT_VICTIM 3
+/* from queueing a disk transfer until it completes */
+#define LAT_DISK_READ 4
+#define LAT_DISK_WRITE 5
+#define LAT_ZERO_FILL 6
+/* `mmu_resident`, including the wait for the client's REMAP ack */
+#define LAT_RESIDENT 7
+/* `mmu_chprot` and `mmu_nonresident`, including the CHPROT ack */
+#define LAT_CHPROT 8
+#define LAT_NSTAGES 9
+
+#define LAT_SUB_BUCKETS 16
+#define LAT_DEFAULT_PATH "mmu.lat"
+
+/* Nanoseconds from CLOCK_MONOTONIC_RAW, which NTP does not slew. */
+static inline uint64_t lat_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Adds =ns= nanoseconds to the histogram of =stage=. */
+void lat_record(int stage, uint64_t ns);
+
+/* Records the time since =start= (from =lat_now=) for =stage=. */
+static inline void lat_since(int stage, uint64_t start)
+{
+	lat_record(stage, lat_now() - start);
+}
+
+/* Prints one line per stage with its count and the mean, p50, p99,
+ * p99.9, and maximum latencies in microseconds.  Histograms keep
+ * counting; the output covers everything since the program started. */
+void lat_dump(FILE *file);
+
+#endif
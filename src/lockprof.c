@@ -0,0 +1,170 @@
+#include "lockprof.h"
+
+#ifdef LOCKPROF
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*****************************************************************************
+ * definitions and static variables
+ ****************************************************************************/
+#define LOCKPROF_HELD 16	/* deeper nesting is not timed */
+
+/* mutexes the calling thread holds, innermost last */
+struct lockprof_held {
+	pthread_mutex_t *mutex;
+	struct lockprof_site *site;
+	uint64_t since;
+};
+
+static __thread struct lockprof_held held[LOCKPROF_HELD];
+static __thread int nheld;
+
+static struct lockprof_site *sites;
+
+static uint64_t lockprof_now(void);
+static void lockprof_register(struct lockprof_site *site);
+static void lockprof_add(uint64_t *total, uint64_t *max, uint64_t ns);
+static struct lockprof_held * lockprof_find(pthread_mutex_t *mutex);
+static int lockprof_cmp(const void *a, const void *b);
+static void lockprof_report(void);
+
+/*****************************************************************************
+ * public function implementations
+ ****************************************************************************/
+int lockprof_lock(struct lockprof_site *site, pthread_mutex_t *mutex) /* {{{ */
+{
+	if(!__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE))
+		lockprof_register(site);
+	int r = pthread_mutex_trylock(mutex);
+	uint64_t now = lockprof_now();
+	if(r == EBUSY) {
+		uint64_t start = now;
+		r = pthread_mutex_lock(mutex);
+		now = lockprof_now();
+		__atomic_fetch_add(&site->contended, 1, __ATOMIC_RELAXED);
+		lockprof_add(&site->wait_ns, &site->wait_max, now - start);
+	}
+	if(r) return r;
+	__atomic_fetch_add(&site->acquired, 1, __ATOMIC_RELAXED);
+	if(nheld < LOCKPROF_HELD) {
+		held[nheld].mutex = mutex;
+		held[nheld].site = site;
+		held[nheld].since = now;
+	}
+	nheld++;
+	return 0;
+} /* }}} */
+
+int lockprof_unlock(pthread_mutex_t *mutex) /* {{{ */
+{
+	struct lockprof_held *h = lockprof_find(mutex);
+	if(h) {
+		struct lockprof_site *site = h->site;
+		lockprof_add(&site->hold_ns, &site->hold_max,
+				lockprof_now() - h->since);
+		/* mutexes need not be released in order */
+		int top = (nheld < LOCKPROF_HELD ? nheld : LOCKPROF_HELD) - 1;
+		for(; h < &held[top]; ++h) *h = *(h + 1);
+	}
+	if(nheld > 0) nheld--;
+	return pthread_mutex_unlock(mutex);
+} /* }}} */
+
+int lockprof_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, /* {{{ */
+		const struct timespec *abstime)
+{
+	struct lockprof_held *h = lockprof_find(mutex);
+	if(h) lockprof_add(&h->site->hold_ns, &h->site->hold_max,
+			lockprof_now() - h->since);
+	int r;
+	if(abstime) r = pthread_cond_timedwait(cond, mutex, abstime);
+	else r = pthread_cond_wait(cond, mutex);
+	if(h) h->since = lockprof_now();
+	return r;
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+static uint64_t lockprof_now(void) /* {{{ */
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+} /* }}} */
+
+/* Pushes =site= on the list of sites; the first registration also
+ * schedules the report. */
+static void lockprof_register(struct lockprof_site *site) /* {{{ */
+{
+	if(__atomic_exchange_n(&site->registered, 1, __ATOMIC_ACQ_REL)) return;
+	struct lockprof_site *head = __atomic_load_n(&sites, __ATOMIC_RELAXED);
+	do {
+		site->next = head;
+	} while(!__atomic_compare_exchange_n(&sites, &head, site, 1,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	if(head == NULL) atexit(lockprof_report);
+} /* }}} */
+
+static void lockprof_add(uint64_t *total, uint64_t *max, uint64_t ns) /* {{{ */
+{
+	__atomic_fetch_add(total, ns, __ATOMIC_RELAXED);
+	uint64_t old = __atomic_load_n(max, __ATOMIC_RELAXED);
+	while(ns > old && !__atomic_compare_exchange_n(max, &old, ns, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+} /* }}} */
+
+/* The innermost entry for =mutex=, or NULL if it is not timed. */
+static struct lockprof_held * lockprof_find(pthread_mutex_t *mutex) /* {{{ */
+{
+	int top = nheld < LOCKPROF_HELD ? nheld : LOCKPROF_HELD;
+	for(int i = top - 1; i >= 0; --i) {
+		if(held[i].mutex == mutex) return &held[i];
+	}
+	return NULL;
+} /* }}} */
+
+/* Sorts by total wait, then by acquisitions. */
+static int lockprof_cmp(const void *a, const void *b) /* {{{ */
+{
+	const struct lockprof_site *x = *(struct lockprof_site * const *)a;
+	const struct lockprof_site *y = *(struct lockprof_site * const *)b;
+	if(x->wait_ns != y->wait_ns) return x->wait_ns < y->wait_ns ? 1 : -1;
+	if(x->acquired != y->acquired) return x->acquired < y->acquired ? 1 : -1;
+	return 0;
+} /* }}} */
+
+static void lockprof_report(void) /* {{{ */
+{
+	int n = 0;
+	struct lockprof_site *s;
+	for(s = __atomic_load_n(&sites, __ATOMIC_ACQUIRE); s; s = s->next) n++;
+	struct lockprof_site **order = malloc(n * sizeof(*order));
+	if(!order) return;
+	n = 0;
+	for(s = __atomic_load_n(&sites, __ATOMIC_ACQUIRE); s; s = s->next)
+		order[n++] = s;
+	qsort(order, n, sizeof(*order), lockprof_cmp);
+	fprintf(stderr, "lockprof pid %d: %d sites, times in us\n", (int)getpid(),
+			n);
+	fprintf(stderr, "%-36s %-18s %10s %10s %12s %10s %12s %10s\n", "site",
+			"lock", "acquired", "contended", "wait", "wait_max", "hold",
+			"hold_max");
+	for(int i = 0; i < n; ++i) {
+		s = order[i];
+		char where[96];
+		snprintf(where, sizeof(where), "%s:%d %s", s->file, s->line, s->func);
+		fprintf(stderr, "%-36s %-18s %10llu %10llu %12.1f %10.1f %12.1f %10.1f\n",
+				where, s->lock, (unsigned long long)s->acquired,
+				(unsigned long long)s->contended, s->wait_ns / 1e3,
+				s->wait_max / 1e3, s->hold_ns / 1e3, s->hold_max / 1e3);
+	}
+	free(order);
+} /* }}} */
+
+#endif
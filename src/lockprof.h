@@ -0,0 +1,68 @@
+/* This module measures contention on pthread mutexes.  Code locks and
+ * unlocks through the macros below instead of calling pthread
+ * directly.  Without -DLOCKPROF the macros are the pthread calls
+ * themselves and cost nothing.  With -DLOCKPROF every place that
+ * locks a mutex counts, in its own static =lockprof_site=:
+ *
+ * (1) acquisitions and how many found the mutex already locked
+ * (2) total and maximum time spent waiting for the mutex
+ * (3) total and maximum time the mutex was then held.
+ *
+ * Hold time ends at the unlock or at a condition wait, and restarts
+ * when the wait returns; time asleep on the condition counts as
+ * neither waiting nor holding.  The sites used by the process are
+ * printed to stderr when it exits, busiest first. */
+
+#ifndef __LOCKPROF_HEADER__
+#define __LOCKPROF_HEADER__
+
+#include <pthread.h>
+
+#ifdef LOCKPROF
+
+#include <stdint.h>
+#include <time.h>
+
+struct lockprof_site {
+	const char *file;
+	int line;
+	const char *func;
+	const char *lock;	/* the mutex expression, as written */
+	int registered;
+	uint64_t acquired;
+	uint64_t contended;
+	uint64_t wait_ns;
+	uint64_t wait_max;
+	uint64_t hold_ns;
+	uint64_t hold_max;
+	struct lockprof_site *next;
+};
+
+/* Each expansion gets its own static site, so no lookup is needed to
+ * find the counters. */
+#define lock_acquire(m) ({ \
+	static struct lockprof_site lockprof_site_ = \
+			{ __FILE__, __LINE__, __func__, #m }; \
+	lockprof_lock(&lockprof_site_, (m)); \
+})
+#define lock_release(m) lockprof_unlock(m)
+#define lock_wait(c, m) lockprof_wait((c), (m), NULL)
+#define lock_timedwait(c, m, t) lockprof_wait((c), (m), (t))
+
+int lockprof_lock(struct lockprof_site *site, pthread_mutex_t *mutex);
+int lockprof_unlock(pthread_mutex_t *mutex);
+/* Waits on =cond= like pthread_cond_wait, or like
+ * pthread_cond_timedwait when =abstime= is not NULL. */
+int lockprof_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+		const struct timespec *abstime);
+
+#else
+
+#define lock_acquire(m) pthread_mutex_lock(m)
+#define lock_release(m) pthread_mutex_unlock(m)
+#define lock_wait(c, m) pthread_cond_wait((c), (m))
+#define lock_timedwait(c, m, t) pthread_cond_timedwait((c), (m), (t))
+
+#endif
+
+#endif
@@ -1,26 +1,41 @@
+#define _GNU_SOURCE
+
+#include <linux/userfaultfd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "lat.h"
+#include "lockprof.h"
 #include "log.h"
+#include "pgmem.h"
+#include "trace.h"
 
+#include "mmu.h"
 #include "pager.h"
 #include "mmuproto.h"
 
 #define MMU_MAX_EVENTS 32
 #define MMU_MAX_SOCK 1024
+#define MMU_IO_THREADS 4
+#define MMU_WORKERS 8
 
 uint8_t pid2id[UINT16_MAX];
 uint8_t nextid = 0;
@@ -33,18 +48,131 @@ struct mmu_data {/*{{{*/
 	int npages;
 	char *pmem;
 	char *disk;
-	char *pmem_fn;
+	int disk_fd;
 	int pmem_fd;
 	int sock;
 	struct mmu_client * sock2client[MMU_MAX_SOCK];
+	int io_running;
+	pthread_mutex_t io_mutex;
+	pthread_cond_t io_cond;
+	struct mmu_io *io_head;
+	struct mmu_io *io_tail;
+	pthread_t io_threads[MMU_IO_THREADS];
+	uint8_t *frame_state;
+	int pool_running;
+	int pool_size;
+	int pool_count;
+	pthread_mutex_t pool_mutex;
+	pthread_cond_t pool_cond;
+	pthread_t pool_thread;
+	unsigned long pool_hits;
+	unsigned long pool_misses;
+	unsigned long faults_coalesced;
+	int work_running;
+	pthread_mutex_t work_mutex;
+	pthread_cond_t work_cond;
+	struct mmu_work *work_head;
+	struct mmu_work *work_tail;
+	pthread_t work_threads[MMU_WORKERS];
 };/*}}}*/
+/* `frame_state` values; frames in the pre-zeroed pool are FRAME_ZERO */
+#define FRAME_DIRTY 0
+#define FRAME_ZEROING 1
+#define FRAME_ZERO 2
+#define FRAME_INUSE 3
 struct mmu_client {/*{{{*/
 	int running;
 	int sock;
 	pid_t pid;
 	pthread_t thread;
+	pthread_mutex_t mutex;	/* serializes sends, protects fields below */
+	pthread_cond_t cond;	/* signaled on acks and finished requests */
+	int dead;	/* connection failed, stop waiting for acks */
+	int reading;	/* a thread is receiving from `sock` */
+	int inflight;	/* requests being serviced */
+	int exiting;	/* EXIT_REQ received, drop further requests */
+	uint32_t next_ack;
+	struct mmu_ack *acks;	/* REMAP/CHPROT waiting for the client */
+	struct mmu_fault *faults;	/* SEGV requests in the pager */
+	int uffd;	/* client's userfaultfd, -1 if it uses SIGSEGV */
+	int uffd_stop;	/* eventfd telling `uffd_thread` to exit */
+	pthread_t uffd_thread;
+	struct mmu_upage *upages;	/* per-page state in userfaultfd mode */
+};/*}}}*/
+/* What the MMU installed at a client page through the userfaultfd.
+ * The client page is a copy of `frame`; if the client was allowed to
+ * write it, it is copied back before the frame is used again. */
+struct mmu_upage {/*{{{*/
+	int frame;	/* -1 if nothing is installed */
+	int writable;
+};/*}}}*/
+struct mmu_ack {/*{{{*/
+	uint32_t id;
+	int done;
+	struct mmu_ack *next;
+};/*}}}*/
+/* A fault being serviced by the pager.  Faults on the same page that
+ * arrive meanwhile wait here and are answered together with it. */
+struct mmu_fault {/*{{{*/
+	uintptr_t vpage;
+	struct mmu_fault_waiter *waiters;
+	struct mmu_fault *next;
+};/*}}}*/
+struct mmu_fault_waiter {/*{{{*/
+	uint32_t id;
+	struct mmu_fault_waiter *next;
+};/*}}}*/
+union mmu_msg {/*{{{*/
+	struct mmu_proto_hdr hdr;
+	struct mmu_proto_create_req create;
+	struct mmu_proto_extend_req extend;
+	struct mmu_proto_syslog_req syslog;
+	struct mmu_proto_syslogv_req syslogv;
+	struct mmu_proto_release_req release;
+	struct mmu_proto_advise_req advise;
+	struct mmu_proto_pin_req pin;
+	struct mmu_proto_share_req share;
+	struct mmu_proto_map_req map;
+	struct mmu_proto_rss_req rss;
+	struct mmu_proto_mrc_req mrc;
+	struct mmu_proto_segv_req segv;
+	struct mmu_proto_remap_req remap;
+	struct mmu_proto_chprot_req chprot;
+	struct mmu_proto_uffd_req uffd;
+	struct mmu_proto_exit_req exit;
 };/*}}}*/
+/* A request read by a client thread, serviced by a worker. */
+struct mmu_work {/*{{{*/
+	struct mmu_client *c;
+	union mmu_msg msg;
+	struct mmu_work *next;
+};/*}}}*/
+struct mmu_io {/*{{{*/
+	int write;
+	int block;
+	int frame;
+	mmu_disk_cb cb;
+	void *arg;
+	uint64_t submitted;	/* `lat_now` when queued */
+	struct mmu_io *next;
+};/*}}}*/
+struct mmu_io_wait {/*{{{*/
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int done;
+	int err;
+};/*}}}*/
+struct mmu_opts {/*{{{*/
+	int hugepages;
+	const char *swapfn;
+	int pool_size;
+	int write_faults;
+	int load_control;
+	int partition;
+};/*}}}*/
+static struct mmu_opts opts;
 static struct mmu_data *mmu = NULL;
+static volatile sig_atomic_t mmu_lat_requested = 0;
 const char *pmem = NULL;
 static size_t PAGESIZE = 0;
 
@@ -53,9 +181,33 @@ static size_t PAGESIZE = 0;
  ***************************************************************************/
 static void mmu_destroy(void);
 static void mmu_client_destroy(struct mmu_client *c);
+static void mmu_client_fail(struct mmu_client *c);
+static int mmu_client_recv(struct mmu_client *c, union mmu_msg *msg);
+static int mmu_client_pump(struct mmu_client *c, union mmu_msg *msg);
+static void mmu_client_service(struct mmu_client *c, union mmu_msg *msg);
+static int mmu_client_send(struct mmu_client *c, const void *buf, size_t len);
+static int mmu_client_call(struct mmu_client *c, void *buf, size_t len);
+static void mmu_client_ack(struct mmu_client *c, uint32_t id);
+static ssize_t mmu_send_fd(int sock, const void *buf, size_t len, int fd);
+static int mmu_recv_fd(int sock, void *buf, size_t len);
 static void mmu_shutdown_action(int signum, siginfo_t *si, void *context);
+static void mmu_lat_action(int signum, siginfo_t *si, void *context);
+static void mmu_lat_dump(void);
 static void mmu_accept_loop(void);
+static void mmu_thread_create(pthread_t *thread, void *(*fn)(void *),
+		void *arg);
 static void * mmu_client_thread(void *vclient);
+static void mmu_work_submit(struct mmu_client *c, const union mmu_msg *msg);
+static void * mmu_work_thread(void *unused);
+static void * mmu_io_thread(void *unused);
+static void mmu_io_submit(int write, int block, int frame, mmu_disk_cb cb,
+		void *arg);
+static void mmu_io_wake(void *vwait, int err);
+static int mmu_io_wait(struct mmu_io_wait *w);
+static void * mmu_pool_thread(void *unused);
+static void mmu_emit(uint32_t op, int id, void *vaddr, int frame, int block,
+		int prot);
+static int mmu_frame_claim(int frame);
 
 /****************************************************************************
  * initialization functions {{{
@@ -63,6 +215,8 @@ static void * mmu_client_thread(void *vclient);
 static void mmu_init(int npages, int nblocks);
 static void mmu_init_disk(int nblocks);
 static void mmu_init_pmem(int npages);
+static void mmu_init_pool(int npages);
+static void mmu_init_work(void);
 static void mmu_init_sock(void);
 static void mmu_init_sigs(void);
 
@@ -74,9 +228,12 @@ void mmu_init(int npages, int nblocks)/*{{{*/
 	if(!mmu) logea(__FILE__, __LINE__, NULL);
 	mmu->running = 1;
 	mmu->npages = npages;
+	mmu->faults_coalesced = 0;
 
 	mmu_init_disk(nblocks);
 	mmu_init_pmem(npages);
+	mmu_init_pool(npages);
+	mmu_init_work();
 	mmu_init_sock();
 	mmu_init_sigs();
 	memset(mmu->sock2client, 0, MMU_MAX_SOCK*sizeof(mmu->sock2client[0]));
@@ -85,30 +242,108 @@ void mmu_init(int npages, int nblocks)/*{{{*/
 void mmu_init_disk(int nblocks)/*{{{*/
 {
 	size_t disksz = PAGESIZE * nblocks;
-	mmu->disk = malloc(disksz);
-	if(!mmu->disk) logea(__FILE__, __LINE__, NULL);
-	logd(LOG_INFO, "%s: %zu bytes in %d blocks\n", __func__, disksz, nblocks);
+	mmu->disk = NULL;
+	mmu->disk_fd = -1;
+	mmu->io_running = 0;
+	mmu->io_head = NULL;
+	mmu->io_tail = NULL;
+	if(!opts.swapfn) {
+		/* page-aligned so blocks can use the SIMD page kernels */
+		if(posix_memalign((void **)&mmu->disk, PAGESIZE, disksz))
+			logea(__FILE__, __LINE__, NULL);
+		logd(LOG_INFO, "%s: %zu bytes in %d blocks\n", __func__, disksz,
+				nblocks);
+		return;
+	}
+
+	int flags = O_RDWR | O_CREAT | O_CLOEXEC;
+	mmu->disk_fd = open(opts.swapfn, flags | O_DIRECT, 0600);
+	if(mmu->disk_fd == -1 && errno == EINVAL) {
+		/* tmpfs and a few other filesystems refuse O_DIRECT */
+		loge(LOG_WARN, __FILE__, __LINE__);
+		mmu->disk_fd = open(opts.swapfn, flags, 0600);
+	}
+	if(mmu->disk_fd == -1) logea(__FILE__, __LINE__, opts.swapfn);
+	struct stat st;
+	if(fstat(mmu->disk_fd, &st) == -1) logea(__FILE__, __LINE__, NULL);
+	if(S_ISREG(st.st_mode)) {
+		if(st.st_size < disksz && ftruncate(mmu->disk_fd, disksz) == -1)
+			logea(__FILE__, __LINE__, NULL);
+	} else if(lseek(mmu->disk_fd, 0, SEEK_END) < (off_t)disksz) {
+		logea(__FILE__, __LINE__, "swap device too small");
+	}
+
+	mmu->io_running = 1;
+	pthread_mutex_init(&mmu->io_mutex, NULL);
+	pthread_cond_init(&mmu->io_cond, NULL);
+	for(int i = 0; i < MMU_IO_THREADS; ++i) {
+		mmu_thread_create(&mmu->io_threads[i], mmu_io_thread, NULL);
+	}
+	logd(LOG_INFO, "%s: %zu bytes in %d blocks at %s\n", __func__, disksz,
+			nblocks, opts.swapfn);
 }/*}}}*/
 
 void mmu_init_pmem(int npages)/*{{{*/
 {
-	mmu->pmem_fn = strdup("mmu.pmem.img.XXXXXX");
-	if(mmu->pmem_fn == NULL) logea(__FILE__, __LINE__, NULL);
-	mmu->pmem_fd = mkstemp(mmu->pmem_fn);
+	/* An anonymous memory file needs no filesystem path and is
+	 * sized without touching its contents, so startup cost does not
+	 * depend on the number of frames.  Fall back to an unlinked
+	 * temporary file on kernels without memfd_create. */
+	mmu->pmem_fd = memfd_create("mmu.pmem", MFD_CLOEXEC);
+	if(mmu->pmem_fd == -1 && errno == ENOSYS) {
+		char fn[] = "mmu.pmem.img.XXXXXX";
+		mmu->pmem_fd = mkstemp(fn);
+		if(mmu->pmem_fd != -1) unlink(fn);
+	}
 	if(mmu->pmem_fd == -1) logea(__FILE__, __LINE__, NULL);
-	logd(LOG_INFO, "%s: mmap fd %d path %s\n", __func__, mmu->pmem_fd,
-			mmu->pmem_fn);
+	logd(LOG_INFO, "%s: memfd %d\n", __func__, mmu->pmem_fd);
 
 	size_t memsz = PAGESIZE * npages;
-	for(size_t i = 0; i < npages*PAGESIZE; ++i) {
-		write(mmu->pmem_fd, "z", 1);
-	}
+	if(ftruncate(mmu->pmem_fd, memsz) == -1)
+		logea(__FILE__, __LINE__, NULL);
+	/* Reserve backing store up front so clients cannot get SIGBUS
+	 * from a full tmpfs later; not all filesystems support this. */
+	if(fallocate(mmu->pmem_fd, 0, 0, memsz) == -1)
+		loge(LOG_INFO, __FILE__, __LINE__);
 
 	int prot = PROT_READ | PROT_WRITE;
 	mmu->pmem = mmap(NULL, memsz, prot, MAP_SHARED, mmu->pmem_fd, 0);
 	if(mmu->pmem == MAP_FAILED) logea(__FILE__, __LINE__, NULL);
+	if(opts.hugepages && madvise(mmu->pmem, memsz, MADV_HUGEPAGE) == -1)
+		loge(LOG_WARN, __FILE__, __LINE__);
 	pmem = mmu->pmem;
-	logd(LOG_INFO, "%s: %zu bytes in %d pages\n", __func__, memsz, npages);
+	logd(LOG_INFO, "%s: %zu bytes in %d pages, %s page kernels\n", __func__,
+			memsz, npages, pgmem_current());
+}/*}}}*/
+
+void mmu_init_pool(int npages)/*{{{*/
+{
+	mmu->frame_state = calloc(npages, sizeof(mmu->frame_state[0]));
+	if(!mmu->frame_state) logea(__FILE__, __LINE__, NULL);
+	mmu->pool_size = opts.pool_size < 0 ? npages : opts.pool_size;
+	mmu->pool_count = 0;
+	mmu->pool_hits = 0;
+	mmu->pool_misses = 0;
+	mmu->pool_running = mmu->pool_size > 0;
+	if(!mmu->pool_running) return;
+	pthread_mutex_init(&mmu->pool_mutex, NULL);
+	pthread_cond_init(&mmu->pool_cond, NULL);
+	mmu_thread_create(&mmu->pool_thread, mmu_pool_thread, NULL);
+	logd(LOG_INFO, "%s: keeping up to %d zeroed frames\n", __func__,
+			mmu->pool_size);
+}/*}}}*/
+
+void mmu_init_work(void)/*{{{*/
+{
+	mmu->work_running = 1;
+	mmu->work_head = NULL;
+	mmu->work_tail = NULL;
+	pthread_mutex_init(&mmu->work_mutex, NULL);
+	pthread_cond_init(&mmu->work_cond, NULL);
+	for(int i = 0; i < MMU_WORKERS; ++i) {
+		mmu_thread_create(&mmu->work_threads[i], mmu_work_thread, NULL);
+	}
+	logd(LOG_INFO, "%s: %d workers\n", __func__, MMU_WORKERS);
 }/*}}}*/
 
 void mmu_init_sock(void)/*{{{*/
@@ -136,6 +371,10 @@ void mmu_init_sigs(void)/*{{{*/
 	new.sa_sigaction = mmu_shutdown_action;
 	sigaction(SIGINT, &new, NULL);
 	logd(LOG_INFO, "%s: SIGINT triggers shutdown\n", __func__);
+	new.sa_sigaction = mmu_lat_action;
+	sigaction(SIGUSR1, &new, NULL);
+	logd(LOG_INFO, "%s: SIGUSR1 dumps latencies to %s\n", __func__,
+			LAT_DEFAULT_PATH);
 }
 /*}}}*/
 /*}}}*/
@@ -147,14 +386,48 @@ void mmu_destroy(void)/*{{{*/
 {
 	logd(LOG_DEBUG, "%s: starting\n", __func__);
 	assert(mmu);
-	unlink(mmu->pmem_fn);
-	free(mmu->pmem_fn);
 	for(int i = 3; i < MMU_MAX_SOCK; ++i) {
 		if(!mmu->sock2client[i]) continue;
 		mmu_client_destroy(mmu->sock2client[i]);
 	}
-	munmap(mmu->pmem, mmu->npages * PAGESIZE);
+	lock_acquire(&mmu->work_mutex);
+	mmu->work_running = 0;
+	pthread_cond_broadcast(&mmu->work_cond);
+	lock_release(&mmu->work_mutex);
+	for(int i = 0; i < MMU_WORKERS; ++i) {
+		pthread_join(mmu->work_threads[i], NULL);
+	}
+	pthread_mutex_destroy(&mmu->work_mutex);
+	pthread_cond_destroy(&mmu->work_cond);
+	if(mmu->pool_running) {
+		lock_acquire(&mmu->pool_mutex);
+		mmu->pool_running = 0;
+		pthread_cond_signal(&mmu->pool_cond);
+		lock_release(&mmu->pool_mutex);
+		pthread_join(mmu->pool_thread, NULL);
+		pthread_mutex_destroy(&mmu->pool_mutex);
+		pthread_cond_destroy(&mmu->pool_cond);
+	}
+	logd(LOG_INFO, "%s: zero pool hits %lu misses %lu\n", __func__,
+			mmu->pool_hits, mmu->pool_misses);
+	logd(LOG_INFO, "%s: %lu faults coalesced\n", __func__,
+			mmu->faults_coalesced);
+	free(mmu->frame_state);
+	if(mmu->disk_fd != -1) {
+		lock_acquire(&mmu->io_mutex);
+		mmu->io_running = 0;
+		pthread_cond_broadcast(&mmu->io_cond);
+		lock_release(&mmu->io_mutex);
+		for(int i = 0; i < MMU_IO_THREADS; ++i) {
+			pthread_join(mmu->io_threads[i], NULL);
+		}
+		pthread_mutex_destroy(&mmu->io_mutex);
+		pthread_cond_destroy(&mmu->io_cond);
+		close(mmu->disk_fd);
+	}
 	free(mmu->disk);
+	munmap(mmu->pmem, mmu->npages * PAGESIZE);
+	close(mmu->pmem_fd);
 	close(mmu->sock);
 	unlink(MMU_PROTO_UNIX_PATH);
 	free(mmu);
@@ -168,6 +441,30 @@ void mmu_shutdown_action(int signum, siginfo_t *si, void *context)/*{{{*/
 	mmu->running = 0;
 }
 /*}}}*/
+
+/* Only flags the request: the dump is not async-signal-safe, so the
+ * main loop does it when the signal interrupts ppoll(). */
+void mmu_lat_action(int signum, siginfo_t *si, void *context)/*{{{*/
+{
+	assert(si->si_signo == SIGUSR1);
+	mmu_lat_requested = 1;
+}
+/*}}}*/
+
+/* Latencies go to a file rather than stdout, which carries the
+ * clients' syslog output. */
+void mmu_lat_dump(void)/*{{{*/
+{
+	FILE *file = fopen(LAT_DEFAULT_PATH, "w");
+	if(!file) {
+		loge(LOG_WARN, __FILE__, __LINE__);
+		return;
+	}
+	lat_dump(file);
+	fclose(file);
+	logd(LOG_INFO, "%s: latencies in %s\n", __func__, LAT_DEFAULT_PATH);
+}
+/*}}}*/
 /*}}}*/
 
 /****************************************************************************
@@ -175,7 +472,20 @@ void mmu_shutdown_action(int signum, siginfo_t *si, void *context)/*{{{*/
  ***************************************************************************/
 void mmu_accept_loop(void)/*{{{*/
 {
+	/* SIGINT and SIGUSR1 are only let in while ppoll() sleeps, so one
+	 * that arrives after we check the flags still wakes us up */
+	sigset_t sigs, orig;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &sigs, &orig);
 	while(mmu->running) {
+		if(mmu_lat_requested) {
+			mmu_lat_requested = 0;
+			mmu_lat_dump();
+		}
+		struct pollfd pfd = { .fd = mmu->sock, .events = POLLIN };
+		if(ppoll(&pfd, 1, NULL, &orig) == -1) continue;
 		struct sockaddr_un addr;
 		socklen_t addrlen = sizeof(addr);
 		logd(LOG_DEBUG, "%s: accepting connection\n", __func__);
@@ -189,62 +499,123 @@ void mmu_accept_loop(void)/*{{{*/
 		c->running = 1;
 		c->sock = nsock;
 		c->pid = 0;
-		pthread_create(&c->thread, NULL, mmu_client_thread, c);
+		pthread_mutex_init(&c->mutex, NULL);
+		pthread_cond_init(&c->cond, NULL);
+		c->dead = 0;
+		c->reading = 0;
+		c->inflight = 0;
+		c->exiting = 0;
+		c->next_ack = 0;
+		c->acks = NULL;
+		c->faults = NULL;
+		c->uffd = -1;
+		c->uffd_stop = -1;
+		c->upages = NULL;
+		mmu_thread_create(&c->thread, mmu_client_thread, c);
 		pthread_detach(c->thread);
 	}
+	pthread_sigmask(SIG_SETMASK, &orig, NULL);
 	logd(LOG_DEBUG, "%s: exiting\n", __func__);
 }/*}}}*/
 
+/* Threads other than main() block all signals, so SIGINT and SIGUSR1
+ * interrupt ppoll() in the main loop. */
+void mmu_thread_create(pthread_t *thread, void *(*fn)(void *), void *arg)/*{{{*/
+{
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	pthread_create(thread, NULL, fn, arg);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}/*}}}*/
+
 static void mmu_client_log(const struct mmu_client *c, const char *fname, const char *msg);
-static void mmu_client_create(struct mmu_client *c);
-static void mmu_client_extend(struct mmu_client *c);
-static void mmu_client_syslog(struct mmu_client *c);
-static void mmu_client_segv(struct mmu_client *c);
-static void mmu_client_exit(struct mmu_client *c);
+static void mmu_client_create(struct mmu_client *c,
+		const struct mmu_proto_create_req *req);
+static void mmu_client_extend(struct mmu_client *c,
+		const struct mmu_proto_extend_req *req);
+static void mmu_client_syslog(struct mmu_client *c,
+		const struct mmu_proto_syslog_req *req);
+static void mmu_client_syslogv(struct mmu_client *c,
+		const struct mmu_proto_syslogv_req *req);
+static void mmu_client_release(struct mmu_client *c,
+		const struct mmu_proto_release_req *req);
+static void mmu_client_advise(struct mmu_client *c,
+		const struct mmu_proto_advise_req *req);
+static void mmu_client_pin(struct mmu_client *c,
+		const struct mmu_proto_pin_req *req);
+static void mmu_client_share(struct mmu_client *c,
+		const struct mmu_proto_share_req *req);
+static void mmu_client_map(struct mmu_client *c,
+		const struct mmu_proto_map_req *req);
+static void mmu_client_rss(struct mmu_client *c,
+		const struct mmu_proto_rss_req *req);
+static void mmu_client_mrc(struct mmu_client *c,
+		const struct mmu_proto_mrc_req *req);
+static void mmu_client_segv(struct mmu_client *c,
+		const struct mmu_proto_segv_req *req);
+static void mmu_client_uffd(struct mmu_client *c,
+		const struct mmu_proto_uffd_req *req);
+static void mmu_client_exit(struct mmu_client *c,
+		const struct mmu_proto_exit_req *req);
+
+/* userfaultfd mode, see `mmu_client_uffd` */
+static void * mmu_uffd_thread(void *vclient);
+static void mmu_uffd_stop(struct mmu_client *c);
+static struct mmu_upage * mmu_uffd_page(struct mmu_client *c, void *vaddr);
+static void mmu_uffd_wake(struct mmu_client *c, void *vaddr);
+static int mmu_uffd_resident(struct mmu_client *c, void *vaddr, int frame,
+		int prot);
+static int mmu_uffd_writeprotect(struct mmu_client *c, void *vaddr,
+		int protect);
+static int mmu_uffd_sync(struct mmu_client *c, void *vaddr, int forget);
+static void mmu_uffd_sync_range(struct mmu_client *c, void *vaddr,
+		size_t len);
 
+/* Reads messages from one client.  A request is serviced right here
+ * if the client has nothing else in flight; requests that arrive while
+ * another is being serviced go to the worker pool, so a multi-threaded
+ * client can have several requests in the pager at once.  While this
+ * thread is in the pager, pager calls waiting for an ack from the
+ * client read the socket themselves (see `mmu_client_call`). */
 void * mmu_client_thread(void *vclient)/*{{{*/
 {
 	struct mmu_client *c = vclient;
+	lock_acquire(&c->mutex);
 	while(mmu->running && c->running) {
 		mmu_client_log(c, __func__, "recv");
-		uint32_t type;
-		ssize_t cnt = recv(c->sock, &type, sizeof(type), MSG_PEEK);
+		while(c->reading && !c->dead)
+			lock_wait(&c->cond, &c->mutex);
+		union mmu_msg msg;
+		int r = c->dead ? -1 : mmu_client_pump(c, &msg);
 		if(!mmu->running || !c->running) {
 			mmu_client_log(c, __func__, "breaking loop");
 			break;
 		}
-		if(cnt != sizeof(type)) goto out_client;
-		switch(type) {
-		case MMU_PROTO_CREATE_REQ:
-			mmu_client_create(c);
-			break;
-		case MMU_PROTO_EXTEND_REQ:
-			mmu_client_extend(c);
-			break;
-		case MMU_PROTO_SYSLOG_REQ:
-			mmu_client_syslog(c);
-			break;
-		case MMU_PROTO_SEGV_REQ:
-			mmu_client_segv(c);
-			break;
-		case MMU_PROTO_REMAP_REQ:
-		case MMU_PROTO_CHPROT_REQ:
-			/* these messages are handled by the pager thread */
-			break;
-		case MMU_PROTO_EXIT_REQ:
-			mmu_client_exit(c);
-			break;
-		default:
-			mmu_client_log(c, __func__, "invalid message type");
-			goto out_client;
-			break;
+		if(r == -1) goto out_client;
+		if(r == 0) continue;
+		if(c->inflight > 0) {
+			mmu_work_submit(c, &msg);
+			continue;
 		}
+		c->inflight++;
+		lock_release(&c->mutex);
+		mmu_client_service(c, &msg);
+		lock_acquire(&c->mutex);
 	}
 	mmu_client_log(c, __func__, "finished");
+	while(c->inflight || c->reading) lock_wait(&c->cond, &c->mutex);
+	lock_release(&c->mutex);
+	close(c->sock);
+	if(c->uffd != -1) close(c->uffd);
+	free(c->upages);
+	pthread_mutex_destroy(&c->mutex);
+	pthread_cond_destroy(&c->cond);
 	free(c);
 	pthread_exit(NULL);
 
 	out_client:
+	lock_release(&c->mutex);
 	mmu_client_destroy(c);
 	pthread_exit(NULL);
 }/*}}}*/
@@ -255,145 +626,889 @@ void mmu_client_log(const struct mmu_client *c, const char *fname, const char *m
 			(int)c->pid, msg);
 }/*}}}*/
 
-void mmu_client_create(struct mmu_client *c)/*{{{*/
+int mmu_client_recv(struct mmu_client *c, union mmu_msg *msg)/*{{{*/
+{
+	ssize_t cnt = recv(c->sock, &msg->hdr, sizeof(msg->hdr), MSG_PEEK);
+	if(cnt != sizeof(msg->hdr)) return -1;
+	uint64_t start = lat_now();
+	size_t len;
+	switch(msg->hdr.type) {
+	case MMU_PROTO_CREATE_REQ: len = sizeof(msg->create); break;
+	case MMU_PROTO_EXTEND_REQ: len = sizeof(msg->extend); break;
+	case MMU_PROTO_SYSLOG_REQ: len = sizeof(msg->syslog); break;
+	case MMU_PROTO_RELEASE_REQ: len = sizeof(msg->release); break;
+	case MMU_PROTO_ADVISE_REQ: len = sizeof(msg->advise); break;
+	case MMU_PROTO_PIN_REQ: len = sizeof(msg->pin); break;
+	case MMU_PROTO_SHARE_REQ: len = sizeof(msg->share); break;
+	case MMU_PROTO_RSS_REQ: len = sizeof(msg->rss); break;
+	case MMU_PROTO_MRC_REQ: len = sizeof(msg->mrc); break;
+	case MMU_PROTO_SEGV_REQ: len = sizeof(msg->segv); break;
+	case MMU_PROTO_REMAP_REQ: len = sizeof(msg->remap); break;
+	case MMU_PROTO_CHPROT_REQ: len = sizeof(msg->chprot); break;
+	case MMU_PROTO_EXIT_REQ: len = sizeof(msg->exit); break;
+	case MMU_PROTO_SYSLOGV_REQ:
+		len = MMU_PROTO_SYSLOGV_LEN(0);
+		if(recv(c->sock, msg, len, MSG_PEEK | MSG_WAITALL) != len) return -1;
+		if(msg->syslogv.count > MMU_PROTO_SYSLOGV_MAX) return -1;
+		len = MMU_PROTO_SYSLOGV_LEN(msg->syslogv.count);
+		break;
+	case MMU_PROTO_UFFD_REQ:
+		/* only sent before any other request, nobody uses `uffd` yet */
+		if(c->uffd != -1) return -1;
+		c->uffd = mmu_recv_fd(c->sock, msg, sizeof(msg->uffd));
+		return c->uffd == -1 ? -1 : 0;
+	case MMU_PROTO_MAP_REQ:
+		msg->map.fd = mmu_recv_fd(c->sock, msg, sizeof(msg->map));
+		return msg->map.fd == -1 ? -1 : 0;
+	default: return 0; /* rejected by the caller */
+	}
+	if(recv(c->sock, msg, len, MSG_WAITALL) != len) return -1;
+	lat_since(LAT_RECV, start);
+	return 0;
+}/*}}}*/
+
+/* Receives one message; called with `c->mutex` locked and nobody else
+ * reading.  Acks are processed here.  Returns 1 if `msg` is a request
+ * for the caller to service or hand to a worker, 0 if it was an ack,
+ * and -1 if the connection failed. */
+int mmu_client_pump(struct mmu_client *c, union mmu_msg *msg)/*{{{*/
+{
+	c->reading = 1;
+	lock_release(&c->mutex);
+	int r = mmu_client_recv(c, msg);
+	lock_acquire(&c->mutex);
+	c->reading = 0;
+	pthread_cond_broadcast(&c->cond);
+	if(r == -1) {
+		c->dead = 1;
+		return -1;
+	}
+	switch(msg->hdr.type) {
+	case MMU_PROTO_REMAP_REQ:
+	case MMU_PROTO_CHPROT_REQ:
+		mmu_client_ack(c, msg->hdr.id);
+		return 0;
+	case MMU_PROTO_CREATE_REQ:
+	case MMU_PROTO_EXTEND_REQ:
+	case MMU_PROTO_SYSLOG_REQ:
+	case MMU_PROTO_SYSLOGV_REQ:
+	case MMU_PROTO_RELEASE_REQ:
+	case MMU_PROTO_ADVISE_REQ:
+	case MMU_PROTO_PIN_REQ:
+	case MMU_PROTO_SHARE_REQ:
+	case MMU_PROTO_MAP_REQ:
+	case MMU_PROTO_RSS_REQ:
+	case MMU_PROTO_MRC_REQ:
+	case MMU_PROTO_SEGV_REQ:
+	case MMU_PROTO_UFFD_REQ:
+	case MMU_PROTO_EXIT_REQ:
+		return 1;
+	default:
+		mmu_client_log(c, __func__, "invalid message type");
+		c->dead = 1;
+		return -1;
+	}
+}/*}}}*/
+
+/* Services a request counted in `c->inflight`. */
+void mmu_client_service(struct mmu_client *c, union mmu_msg *msg)/*{{{*/
+{
+	switch(msg->hdr.type) {
+	case MMU_PROTO_CREATE_REQ:
+		mmu_client_create(c, &msg->create);
+		break;
+	case MMU_PROTO_EXTEND_REQ:
+		mmu_client_extend(c, &msg->extend);
+		break;
+	case MMU_PROTO_SYSLOG_REQ:
+		mmu_client_syslog(c, &msg->syslog);
+		break;
+	case MMU_PROTO_SYSLOGV_REQ:
+		mmu_client_syslogv(c, &msg->syslogv);
+		break;
+	case MMU_PROTO_RELEASE_REQ:
+		mmu_client_release(c, &msg->release);
+		break;
+	case MMU_PROTO_ADVISE_REQ:
+		mmu_client_advise(c, &msg->advise);
+		break;
+	case MMU_PROTO_PIN_REQ:
+		mmu_client_pin(c, &msg->pin);
+		break;
+	case MMU_PROTO_SHARE_REQ:
+		mmu_client_share(c, &msg->share);
+		break;
+	case MMU_PROTO_MAP_REQ:
+		mmu_client_map(c, &msg->map);
+		break;
+	case MMU_PROTO_RSS_REQ:
+		mmu_client_rss(c, &msg->rss);
+		break;
+	case MMU_PROTO_MRC_REQ:
+		mmu_client_mrc(c, &msg->mrc);
+		break;
+	case MMU_PROTO_SEGV_REQ:
+		mmu_client_segv(c, &msg->segv);
+		break;
+	case MMU_PROTO_UFFD_REQ:
+		mmu_client_uffd(c, &msg->uffd);
+		break;
+	case MMU_PROTO_EXIT_REQ:
+		mmu_client_exit(c, &msg->exit);
+		break;
+	}
+	lock_acquire(&c->mutex);
+	c->inflight--;
+	pthread_cond_broadcast(&c->cond);
+	lock_release(&c->mutex);
+}/*}}}*/
+
+/* Sends a whole message; messages from workers and pager calls on
+ * other threads must not interleave. */
+int mmu_client_send(struct mmu_client *c, const void *buf, size_t len)/*{{{*/
+{
+	lock_acquire(&c->mutex);
+	ssize_t cnt = send(c->sock, buf, len, MSG_NOSIGNAL);
+	lock_release(&c->mutex);
+	return cnt == len ? 0 : -1;
+}/*}}}*/
+
+/* Sends a REMAP or CHPROT message and waits for its acknowledgement.
+ * The message id is filled in here.  If nobody is reading from the
+ * client (its thread may be in the pager), we read the ack ourselves,
+ * handing any request that comes first to the workers. */
+int mmu_client_call(struct mmu_client *c, void *buf, size_t len)/*{{{*/
+{
+	struct mmu_ack ack;
+	lock_acquire(&c->mutex);
+	if(c->dead) goto out_dead;
+	if(++c->next_ack == 0) ++c->next_ack;
+	ack.id = c->next_ack;
+	ack.done = 0;
+	ack.next = c->acks;
+	c->acks = &ack;
+	((struct mmu_proto_hdr *)buf)->id = ack.id;
+	if(send(c->sock, buf, len, MSG_NOSIGNAL) != len) c->dead = 1;
+	while(!ack.done && !c->dead) {
+		if(c->reading) {
+			lock_wait(&c->cond, &c->mutex);
+			continue;
+		}
+		union mmu_msg msg;
+		if(mmu_client_pump(c, &msg) == 1) mmu_work_submit(c, &msg);
+	}
+	struct mmu_ack **prev = &c->acks;
+	while(*prev != &ack) prev = &(*prev)->next;
+	*prev = ack.next;
+	if(!ack.done) goto out_dead;
+	lock_release(&c->mutex);
+	return 0;
+
+	out_dead:
+	lock_release(&c->mutex);
+	return -1;
+}/*}}}*/
+
+/* Called with `c->mutex` locked. */
+void mmu_client_ack(struct mmu_client *c, uint32_t id)/*{{{*/
+{
+	struct mmu_ack *ack = c->acks;
+	while(ack && ack->id != id) ack = ack->next;
+	if(ack) ack->done = 1;
+	else mmu_client_log(c, __func__, "unexpected ack");
+	pthread_cond_broadcast(&c->cond);
+}/*}}}*/
+
+void mmu_client_create(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_create_req *req)
 {
 	char msg[96];
-	struct mmu_proto_create_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_CREATE_REQ);
+	assert(req->type == MMU_PROTO_CREATE_REQ);
 
-	c->pid = (pid_t)req.pid;
+	c->pid = (pid_t)req->pid;
 	pid2id[c->pid] = nextid++;
-	printf("pager_create pid %d\n", (int)pid2id[c->pid]);
+	mmu_emit(TRACE_PAGER_CREATE, pid2id[c->pid], NULL, -1, -1, 0);
 	pager_create(c->pid);
 	snprintf(msg, 96, "create pid %d", (int)pid2id[c->pid]);
 	mmu_client_log(c, __func__, msg);
 
 	struct mmu_proto_create_rep rep;
 	rep.type = MMU_PROTO_CREATE_REP;
-	memset(rep.pmem_fn, '\0', MMU_PROTO_PATH_MAX);
-	strncat(rep.pmem_fn, mmu->pmem_fn, MMU_PROTO_PATH_MAX);
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	rep.id = req->id;
+	rep.pmemsz = (uint64_t)(PAGESIZE * mmu->npages);
+	if(mmu_send_fd(c->sock, &rep, sizeof(rep), mmu->pmem_fd) != sizeof(rep))
+		mmu_client_fail(c);
 }/*}}}*/
 
-void mmu_client_extend(struct mmu_client *c)/*{{{*/
+void mmu_client_extend(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_extend_req *req)
 {
 	char msg[96];
-	struct mmu_proto_extend_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_EXTEND_REQ);
+	assert(req->type == MMU_PROTO_EXTEND_REQ);
 
 	void *vaddr = pager_extend(c->pid);
-	printf("pager_extend pid %d vaddr %p\n", (int)pid2id[c->pid], vaddr);
+	mmu_emit(TRACE_PAGER_EXTEND, pid2id[c->pid], vaddr, -1, -1, 0);
 	snprintf(msg, 96, "extend vaddr %p", vaddr);
 	mmu_client_log(c, __func__, msg);
 
 	struct mmu_proto_extend_rep rep;
 	rep.type = MMU_PROTO_EXTEND_REP;
+	rep.id = req->id;
 	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
 }/*}}}*/
 
-void mmu_client_syslog(struct mmu_client *c)/*{{{*/
+void mmu_client_syslog(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_syslog_req *req)
 {
 	char msg[96];
-	struct mmu_proto_syslog_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_SYSLOG_REQ);
-
-	assert(req.addr < UINTPTR_MAX);
-	void *vaddr = (void *)(uintptr_t)req.addr;
-	size_t len = (size_t)req.len;
-	printf("pager_syslog pid %d %p\n", (int)pid2id[c->pid], vaddr);
+	assert(req->type == MMU_PROTO_SYSLOG_REQ);
+
+	assert(req->addr < UINTPTR_MAX);
+	void *vaddr = (void *)(uintptr_t)req->addr;
+	size_t len = (size_t)req->len;
+	if(c->uffd != -1) mmu_uffd_sync_range(c, vaddr, len);
+	mmu_emit(TRACE_PAGER_SYSLOG, pid2id[c->pid], vaddr, (int)len, -1, 0);
 	int status = pager_syslog(c->pid, vaddr, len);
 	snprintf(msg, 96, "vaddr %p len %zu retcode %d", vaddr, len, status);
 	mmu_client_log(c, __func__, msg);
 
 	struct mmu_proto_syslog_rep rep;
 	rep.type = MMU_PROTO_SYSLOG_REP;
+	rep.id = req->id;
 	rep.retcode = (uint32_t)status;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-	return;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
+}/*}}}*/
 
-	out_client:
-	mmu_client_destroy(c);
+void mmu_client_syslogv(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_syslogv_req *req)
+{
+	char msg[96];
+	assert(req->type == MMU_PROTO_SYSLOGV_REQ);
+
+	int count = (int)req->count;
+	struct iovec iov[MMU_PROTO_SYSLOGV_MAX];
+	for(int i = 0; i < count; ++i) {
+		assert(req->spans[i].addr < UINTPTR_MAX);
+		iov[i].iov_base = (void *)(uintptr_t)req->spans[i].addr;
+		iov[i].iov_len = (size_t)req->spans[i].len;
+		if(c->uffd != -1)
+			mmu_uffd_sync_range(c, iov[i].iov_base, iov[i].iov_len);
+	}
+	void *vaddr = count ? iov[0].iov_base : NULL;
+	mmu_emit(TRACE_PAGER_SYSLOGV, pid2id[c->pid], vaddr, count, -1, 0);
+	#ifdef MMUTRACE
+	for(int i = 0; i < count; ++i) {
+		mmu_emit(TRACE_PAGER_SYSLOG_SPAN, pid2id[c->pid], iov[i].iov_base,
+				(int)iov[i].iov_len, -1, 0);
+	}
+	#endif
+	int nlogged = pager_syslogv(c->pid, iov, count);
+	snprintf(msg, 96, "count %d logged %d", count, nlogged);
+	mmu_client_log(c, __func__, msg);
+
+	struct mmu_proto_syslogv_rep rep;
+	rep.type = MMU_PROTO_SYSLOGV_REP;
+	rep.id = req->id;
+	rep.retcode = nlogged == count ? 0 : -1;
+	rep.nlogged = (uint32_t)nlogged;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
 }/*}}}*/
 
-void mmu_client_segv(struct mmu_client *c)/*{{{*/
+void mmu_client_release(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_release_req *req)
 {
 	char msg[96];
-	struct mmu_proto_segv_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_SEGV_REQ);
-
-	assert(req.addr < UINTPTR_MAX);
-	void *vaddr = (void *)(uintptr_t)req.addr;
-	int code = (int)req.code;
-	snprintf(msg, 96, "vaddr %p code %d", vaddr, code);
+	assert(req->type == MMU_PROTO_RELEASE_REQ);
+
+	assert(req->vaddr < UINTPTR_MAX);
+	void *vaddr = (void *)(uintptr_t)req->vaddr;
+	int npages = (int)req->npages;
+	mmu_emit(TRACE_PAGER_RELEASE, pid2id[c->pid], vaddr, npages, -1, 0);
+	int status = pager_release(c->pid, vaddr, npages);
+	snprintf(msg, 96, "vaddr %p npages %d retcode %d", vaddr, npages, status);
 	mmu_client_log(c, __func__, msg);
 
-	printf("pager_fault pid %d vaddr %p\n", (int)pid2id[c->pid], vaddr);
-	pager_fault(c->pid, vaddr);
+	struct mmu_proto_release_rep rep;
+	rep.type = MMU_PROTO_RELEASE_REP;
+	rep.id = req->id;
+	rep.retcode = status;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
+}/*}}}*/
+
+void mmu_client_advise(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_advise_req *req)
+{
+	char msg[96];
+	assert(req->type == MMU_PROTO_ADVISE_REQ);
+
+	assert(req->vaddr < UINTPTR_MAX);
+	void *vaddr = (void *)(uintptr_t)req->vaddr;
+	int npages = (int)req->npages;
+	int advice = (int)req->advice;
+	mmu_emit(TRACE_PAGER_ADVISE, pid2id[c->pid], vaddr, npages, -1, advice);
+	int status = pager_advise(c->pid, vaddr, npages, advice);
+	snprintf(msg, 96, "vaddr %p npages %d advice %d retcode %d", vaddr,
+			npages, advice, status);
+	mmu_client_log(c, __func__, msg);
+
+	struct mmu_proto_advise_rep rep;
+	rep.type = MMU_PROTO_ADVISE_REP;
+	rep.id = req->id;
+	rep.retcode = status;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
+}/*}}}*/
+
+void mmu_client_pin(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_pin_req *req)
+{
+	char msg[96];
+	assert(req->type == MMU_PROTO_PIN_REQ);
+
+	assert(req->vaddr < UINTPTR_MAX);
+	void *vaddr = (void *)(uintptr_t)req->vaddr;
+	int npages = (int)req->npages;
+	int pin = req->pin != 0;
+	mmu_emit(TRACE_PAGER_PIN, pid2id[c->pid], vaddr, npages, -1, pin);
+	int status = pager_pin(c->pid, vaddr, npages, pin) ? errno : 0;
+	snprintf(msg, 96, "vaddr %p npages %d pin %d retcode %d", vaddr,
+			npages, pin, status);
+	mmu_client_log(c, __func__, msg);
+
+	struct mmu_proto_pin_rep rep;
+	rep.type = MMU_PROTO_PIN_REP;
+	rep.id = req->id;
+	rep.retcode = status;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
+}/*}}}*/
+
+/* Pages of userfaultfd clients are private copies of the frames, so
+ * they cannot share memory with other clients. */
+void mmu_client_share(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_share_req *req)
+{
+	char msg[96];
+	assert(req->type == MMU_PROTO_SHARE_REQ);
+
+	char name[UVM_SHARE_NAME_MAX];
+	memcpy(name, req->name, sizeof(name));
+	name[sizeof(name) - 1] = '\0';
+	int npages = (int)req->npages;
+	void *vaddr = NULL;
+	int status = 0;
+	if(c->uffd != -1) {
+		status = EOPNOTSUPP;
+	} else if(req->create) {
+		vaddr = pager_share(c->pid, name, npages);
+		if(!vaddr) status = errno;
+		mmu_emit(TRACE_PAGER_SHARE, pid2id[c->pid], vaddr, npages, -1, 0);
+	} else {
+		vaddr = pager_attach(c->pid, name, &npages);
+		if(!vaddr) status = errno;
+		mmu_emit(TRACE_PAGER_ATTACH, pid2id[c->pid], vaddr, npages, -1, 0);
+	}
+	snprintf(msg, 96, "name %.32s create %u vaddr %p npages %d retcode %d",
+			name, req->create, vaddr, npages, status);
+	mmu_client_log(c, __func__, msg);
+
+	struct mmu_proto_share_rep rep;
+	rep.type = MMU_PROTO_SHARE_REP;
+	rep.id = req->id;
+	rep.retcode = status;
+	rep.npages = vaddr ? npages : 0;
+	rep.vaddr = (intptr_t)vaddr;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
+}/*}}}*/
+
+/* The pager owns `req->fd` if the mapping succeeds. */
+void mmu_client_map(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_map_req *req)
+{
+	char msg[96];
+	assert(req->type == MMU_PROTO_MAP_REQ);
+
+	int npages = (int)req->npages;
+	int flags = (int)req->flags;
+	void *vaddr = pager_map_file(c->pid, req->fd, (off_t)req->offset,
+			npages, flags);
+	int status = vaddr ? 0 : errno;
+	if(!vaddr) close(req->fd);
+	mmu_emit(TRACE_PAGER_MAP_FILE, pid2id[c->pid], vaddr, npages, -1, flags);
+	snprintf(msg, 96, "offset %llu npages %d flags %d vaddr %p retcode %d",
+			(unsigned long long)req->offset, npages, flags, vaddr, status);
+	mmu_client_log(c, __func__, msg);
 
+	struct mmu_proto_map_rep rep;
+	rep.type = MMU_PROTO_MAP_REP;
+	rep.id = req->id;
+	rep.retcode = status;
+	rep.vaddr = (intptr_t)vaddr;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
+}/*}}}*/
+
+/* May come from a connection without CREATE (see `mmuctl`), which
+ * can only name other processes. */
+void mmu_client_rss(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_rss_req *req)
+{
+	char msg[96];
+	assert(req->type == MMU_PROTO_RSS_REQ);
+
+	pid_t pid = req->pid ? (pid_t)req->pid : c->pid;
+	struct pager_rss rss;
+	memset(&rss, 0, sizeof(rss));
+	int status = 0;
+	if(pid <= 0 || pid >= UINT16_MAX || pid2id[pid] == 255) {
+		status = ESRCH;
+	} else {
+		if(req->set && pager_set_rss(pid, req->min, req->max)) status = errno;
+		if(req->set) mmu_emit(TRACE_PAGER_SET_RSS, pid2id[pid], NULL,
+				req->min, req->max, 0);
+		if(pager_get_rss(pid, &rss) && !status) status = errno;
+	}
+	snprintf(msg, 96, "pid %d set %u min %d max %d retcode %d",
+			(int)pid, req->set, req->min, req->max, status);
+	mmu_client_log(c, __func__, msg);
+
+	struct mmu_proto_rss_rep rep;
+	rep.type = MMU_PROTO_RSS_REP;
+	rep.id = req->id;
+	rep.retcode = status;
+	rep.resident = rss.resident;
+	rep.min = rss.min;
+	rep.max = rss.max;
+	rep.steals = rss.steals;
+	rep.stolen = rss.stolen;
+	rep.suspended = rss.suspended;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
+}/*}}}*/
+
+/* Like `mmu_client_rss`, may come from `mmuctl`. */
+void mmu_client_mrc(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_mrc_req *req)
+{
+	char msg[96];
+	assert(req->type == MMU_PROTO_MRC_REQ);
+
+	pid_t pid = req->pid ? (pid_t)req->pid : c->pid;
+	struct pager_mrc curve;
+	memset(&curve, 0, sizeof(curve));
+	int status = 0;
+	if(pid <= 0 || pid >= UINT16_MAX || pid2id[pid] == 255) {
+		status = ESRCH;
+	} else if(pager_get_mrc(pid, &curve)) {
+		status = errno;
+	}
+	snprintf(msg, 96, "pid %d retcode %d", (int)pid, status);
+	mmu_client_log(c, __func__, msg);
+
+	struct mmu_proto_mrc_rep rep;
+	memset(&rep, 0, sizeof(rep));
+	rep.type = MMU_PROTO_MRC_REP;
+	rep.id = req->id;
+	rep.retcode = status;
+	rep.npoints = curve.npoints;
+	rep.refs = curve.refs;
+	for(int i = 0; i < curve.npoints; ++i) rep.misses[i] = curve.misses[i];
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
+}/*}}}*/
+
+void mmu_client_segv(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_segv_req *req)
+{
+	char msg[96];
+	assert(req->type == MMU_PROTO_SEGV_REQ);
+	uint64_t start = lat_now();
+
+	assert(req->addr < UINTPTR_MAX);
+	void *vaddr = (void *)(uintptr_t)req->addr;
+	int code = (int)req->code;
+	snprintf(msg, 96, "vaddr %p code %d write %u", vaddr, code, req->write);
+	mmu_client_log(c, __func__, msg);
+
+	/* Another thread of the client already faulted on this page; its
+	 * reply is ours too.  If the mapping it gets is not enough for
+	 * this access the thread simply faults again. */
+	struct mmu_fault fault;
+	fault.vpage = (uintptr_t)vaddr & ~(uintptr_t)(PAGESIZE - 1);
+	lock_acquire(&c->mutex);
+	struct mmu_fault *f = c->faults;
+	while(f && f->vpage != fault.vpage) f = f->next;
+	if(f && c->uffd != -1) {
+		/* the kernel wakes every thread waiting on the page */
+		lock_release(&c->mutex);
+		__atomic_add_fetch(&mmu->faults_coalesced, 1, __ATOMIC_RELAXED);
+		mmu_client_log(c, __func__, "coalesced");
+		return;
+	} else if(f) {
+		struct mmu_fault_waiter *w = malloc(sizeof(*w));
+		if(!w) logea(__FILE__, __LINE__, NULL);
+		w->id = req->id;
+		w->next = f->waiters;
+		f->waiters = w;
+		lock_release(&c->mutex);
+		__atomic_add_fetch(&mmu->faults_coalesced, 1, __ATOMIC_RELAXED);
+		mmu_client_log(c, __func__, "coalesced");
+		return;
+	}
+	fault.waiters = NULL;
+	fault.next = c->faults;
+	c->faults = &fault;
+	lock_release(&c->mutex);
+
+	int write = opts.write_faults && req->write;
+	mmu_emit(TRACE_PAGER_FAULT, pid2id[c->pid], vaddr, -1, -1, write);
+	if(write) pager_write_fault(c->pid, vaddr);
+	else pager_fault(c->pid, vaddr);
+
+	lock_acquire(&c->mutex);
+	struct mmu_fault **prev = &c->faults;
+	while(*prev != &fault) prev = &(*prev)->next;
+	*prev = fault.next;
+	lock_release(&c->mutex);
+
+	if(c->uffd != -1) {
+		/* in case the pager changed nothing the thread waits for */
+		mmu_uffd_wake(c, (void *)fault.vpage);
+		lat_since(LAT_FAULT, start);
+		return;
+	}
 	struct mmu_proto_segv_rep rep;
 	rep.type = MMU_PROTO_SEGV_REP;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-	return;
+	rep.id = req->id;
+	int fail = mmu_client_send(c, &rep, sizeof(rep));
+	while(fault.waiters) {
+		struct mmu_fault_waiter *w = fault.waiters;
+		fault.waiters = w->next;
+		rep.id = w->id;
+		if(!fail) fail = mmu_client_send(c, &rep, sizeof(rep));
+		free(w);
+	}
+	if(fail) mmu_client_fail(c);
+	lat_since(LAT_FAULT, start);
+}/*}}}*/
 
-	out_client:
-	mmu_client_destroy(c);
+/* Takes over fault handling for the client: faults on its pages are
+ * read from the userfaultfd by `mmu_uffd_thread` and serviced like
+ * SEGV requests, and the pager's mapping changes are applied with
+ * userfaultfd ioctls instead of REMAP and CHPROT messages.  Client
+ * pages are private copies of the frames, so we also need to read
+ * the client's memory to copy written pages back. */
+void mmu_client_uffd(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_uffd_req *req)
+{
+	assert(req->type == MMU_PROTO_UFFD_REQ);
+	struct mmu_proto_uffd_rep rep;
+	rep.type = MMU_PROTO_UFFD_REP;
+	rep.id = req->id;
+	rep.retcode = 0;
+
+	char byte;
+	struct iovec local = { .iov_base = &byte, .iov_len = 1 };
+	struct iovec remote = { .iov_base = (void *)(uintptr_t)req->probe,
+			.iov_len = 1 };
+	size_t npages = (UVM_MAXADDR - UVM_BASEADDR + 1) / PAGESIZE;
+	if(process_vm_readv(c->pid, &local, 1, &remote, 1, 0) != 1) {
+		rep.retcode = errno;
+	} else if(!(c->upages = malloc(npages * sizeof(c->upages[0])))) {
+		rep.retcode = errno;
+	} else if((c->uffd_stop = eventfd(0, EFD_CLOEXEC)) == -1) {
+		rep.retcode = errno;
+	}
+	if(rep.retcode) {
+		mmu_client_log(c, __func__, strerror(rep.retcode));
+		free(c->upages);
+		c->upages = NULL;
+		close(c->uffd);
+		c->uffd = -1;
+	} else {
+		for(size_t i = 0; i < npages; ++i) {
+			c->upages[i].frame = -1;
+			c->upages[i].writable = 0;
+		}
+		mmu_thread_create(&c->uffd_thread, mmu_uffd_thread, c);
+		mmu_client_log(c, __func__, "faults come through userfaultfd");
+	}
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
 }/*}}}*/
 
-void mmu_client_exit(struct mmu_client *c)/*{{{*/
+void mmu_client_exit(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_exit_req *req)
 {
-	struct mmu_proto_exit_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
 	mmu_client_log(c, __func__, "exiting cleanly");
-	assert(req.type == MMU_PROTO_EXIT_REQ);
+	assert(req->type == MMU_PROTO_EXIT_REQ);
 	assert(c->pid);
-	printf("pager_destroy pid %d\n", (int)pid2id[c->pid]);
+	mmu_uffd_stop(c);
+	lock_acquire(&c->mutex);
+	/* requests from other client threads must not reach the pager
+	 * after `pager_destroy` */
+	c->exiting = 1;
+	while(c->inflight > 1) lock_wait(&c->cond, &c->mutex);
+	lock_release(&c->mutex);
+	mmu_emit(TRACE_PAGER_DESTROY, pid2id[c->pid], NULL, -1, -1, 0);
 	pager_destroy(c->pid);
 
-	struct mmu_proto_segv_rep rep;
-	rep.type = MMU_PROTO_EXIT_REP;
-	send(c->sock, &rep, sizeof(rep), 0); /* ignoring return value */
-
 	mmu->sock2client[c->sock] = NULL;
 	c->running = 0;
-	close(c->sock);
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	struct mmu_proto_exit_rep rep;
+	rep.type = MMU_PROTO_EXIT_REP;
+	rep.id = req->id;
+	mmu_client_send(c, &rep, sizeof(rep)); /* ignoring return value */
+	/* the client thread closes the socket once we are done */
+	shutdown(c->sock, SHUT_RDWR);
 }/*}}}*/
 
+/* Tears down a client from its own thread (or at shutdown) once no
+ * worker is servicing one of its requests. */
 void mmu_client_destroy(struct mmu_client *c)/*{{{*/
 {
 	loge(LOG_WARN, __FILE__, __LINE__);
 	mmu_client_log(c, __func__, "running");
+	mmu_uffd_stop(c);
+	lock_acquire(&c->mutex);
+	c->dead = 1;
+	pthread_cond_broadcast(&c->cond);
+	while(c->inflight) lock_wait(&c->cond, &c->mutex);
+	lock_release(&c->mutex);
+	/* may get here before CREATE_REQ happens, or after an EXIT_REQ
+	 * destroyed the process while we waited for it.  The pager may
+	 * still unmap the process' pages meanwhile, so it must be found
+	 * by pid until `pager_destroy` returns. */
+	if(c->pid && !c->exiting) {
+		pager_destroy(c->pid);
+	}
 	mmu->sock2client[c->sock] = NULL;
 	c->running = 0;
 	close(c->sock);
-	if(c->pid) { /* may get here before CREATE_REQ happens */
-		pager_destroy(c->pid);
+	if(c->uffd != -1) close(c->uffd);
+	c->uffd = -1;
+}/*}}}*/
+
+/* Called on send errors from workers and pager calls, which may hold
+ * the pager lock: wakes up everything waiting on the client and lets
+ * its thread, whose recv fails, destroy it. */
+void mmu_client_fail(struct mmu_client *c)/*{{{*/
+{
+	mmu_client_log(c, __func__, "connection failed");
+	lock_acquire(&c->mutex);
+	c->dead = 1;
+	pthread_cond_broadcast(&c->cond);
+	lock_release(&c->mutex);
+	shutdown(c->sock, SHUT_RDWR);
+}/*}}}*/
+
+/* Turns userfaultfd events into SEGV requests for the workers; the
+ * faulting threads stay blocked in the kernel until the pager
+ * installs the page or `mmu_client_segv` wakes them. */
+void * mmu_uffd_thread(void *vclient)/*{{{*/
+{
+	struct mmu_client *c = vclient;
+	struct pollfd fds[2] = {
+		{ .fd = c->uffd, .events = POLLIN },
+		{ .fd = c->uffd_stop, .events = POLLIN },
+	};
+	while(1) {
+		if(poll(fds, 2, -1) == -1) {
+			if(errno == EINTR) continue;
+			loge(LOG_WARN, __FILE__, __LINE__);
+			break;
+		}
+		if(fds[1].revents) break;
+		struct uffd_msg ev;
+		ssize_t cnt = read(c->uffd, &ev, sizeof(ev));
+		if(cnt == -1 && errno == EAGAIN) continue;
+		if(cnt != sizeof(ev)) {
+			loge(LOG_WARN, __FILE__, __LINE__);
+			break;
+		}
+		if(ev.event != UFFD_EVENT_PAGEFAULT) continue;
+		union mmu_msg msg;
+		msg.segv.type = MMU_PROTO_SEGV_REQ;
+		msg.segv.id = 0;
+		msg.segv.code = (ev.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP)
+				? SEGV_ACCERR : SEGV_MAPERR;
+		msg.segv.write = (ev.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE)
+				!= 0;
+		msg.segv.addr = ev.arg.pagefault.address;
+		lock_acquire(&c->mutex);
+		if(!c->dead) mmu_work_submit(c, &msg);
+		lock_release(&c->mutex);
 	}
+	return NULL;
+}/*}}}*/
+
+/* Stops `mmu_uffd_thread`; after this no new faults come in.  The
+ * descriptor stays open for requests still in the pager. */
+void mmu_uffd_stop(struct mmu_client *c)/*{{{*/
+{
+	if(c->uffd_stop == -1) return;
+	uint64_t one = 1;
+	if(write(c->uffd_stop, &one, sizeof(one)) != sizeof(one))
+		logea(__FILE__, __LINE__, NULL);
+	pthread_join(c->uffd_thread, NULL);
+	close(c->uffd_stop);
+	c->uffd_stop = -1;
+}/*}}}*/
+
+struct mmu_upage * mmu_uffd_page(struct mmu_client *c, void *vaddr)/*{{{*/
+{
+	assert((intptr_t)vaddr >= UVM_BASEADDR);
+	assert((intptr_t)vaddr <= UVM_MAXADDR);
+	return &c->upages[((intptr_t)vaddr - UVM_BASEADDR) / PAGESIZE];
+}/*}}}*/
+
+void mmu_uffd_wake(struct mmu_client *c, void *vaddr)/*{{{*/
+{
+	struct uffdio_range range = { .start = (uintptr_t)vaddr, .len = PAGESIZE };
+	if(ioctl(c->uffd, UFFDIO_WAKE, &range) == -1)
+		loge(LOG_WARN, __FILE__, __LINE__);
+}/*}}}*/
+
+/* Copies `frame` into the client page at `vaddr`, which must not be
+ * populated.  Pages without PROT_WRITE are installed write-protected,
+ * so the first write faults like it would with SIGSEGV. */
+int mmu_uffd_resident(struct mmu_client *c, void *vaddr, int frame,/*{{{*/
+		int prot)
+{
+	struct uffdio_copy copy;
+	copy.dst = (uintptr_t)vaddr;
+	copy.src = (uintptr_t)(mmu->pmem + PAGESIZE * frame);
+	copy.len = PAGESIZE;
+	copy.mode = (prot & PROT_WRITE) ? 0 : UFFDIO_COPY_MODE_WP;
+	copy.copy = 0;
+	while(ioctl(c->uffd, UFFDIO_COPY, &copy) == -1) {
+		if(errno != EAGAIN) {
+			loge(LOG_WARN, __FILE__, __LINE__);
+			return -1;
+		}
+		copy.copy = 0;
+	}
+	lock_acquire(&c->mutex);
+	struct mmu_upage *p = mmu_uffd_page(c, vaddr);
+	p->frame = frame;
+	p->writable = (prot & PROT_WRITE) != 0;
+	lock_release(&c->mutex);
+	return 0;
+}/*}}}*/
+
+/* Write-protects the page at `vaddr` or lifts the protection, waking
+ * threads waiting to write.  Read access cannot be revoked without
+ * dropping the page, so the pager's PROT_NONE on a resident page
+ * only stops writes. */
+int mmu_uffd_writeprotect(struct mmu_client *c, void *vaddr,/*{{{*/
+		int protect)
+{
+	struct uffdio_writeprotect wp;
+	wp.range.start = (uintptr_t)vaddr;
+	wp.range.len = PAGESIZE;
+	wp.mode = protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+	while(ioctl(c->uffd, UFFDIO_WRITEPROTECT, &wp) == -1) {
+		if(errno != EAGAIN) {
+			loge(LOG_WARN, __FILE__, __LINE__);
+			return -1;
+		}
+	}
+	if(protect) return 0;
+	lock_acquire(&c->mutex);
+	mmu_uffd_page(c, vaddr)->writable = 1;
+	lock_release(&c->mutex);
+	return 0;
+}/*}}}*/
+
+/* Copies the client page at `vaddr` back into its frame if the client
+ * may have written it.  With `forget`, the page is being evicted and
+ * the frame no longer belongs to it.  `c->mutex` is held while
+ * copying so the frame cannot be evicted and reused under us. */
+int mmu_uffd_sync(struct mmu_client *c, void *vaddr, int forget)/*{{{*/
+{
+	int r = 0;
+	lock_acquire(&c->mutex);
+	struct mmu_upage *p = mmu_uffd_page(c, vaddr);
+	if(p->frame != -1 && p->writable) {
+		struct iovec local = { .iov_base = mmu->pmem + PAGESIZE * p->frame,
+				.iov_len = PAGESIZE };
+		struct iovec remote = { .iov_base = vaddr, .iov_len = PAGESIZE };
+		if(process_vm_readv(c->pid, &local, 1, &remote, 1, 0) != PAGESIZE) {
+			loge(LOG_WARN, __FILE__, __LINE__);
+			r = -1;
+		}
+	}
+	if(forget) {
+		p->frame = -1;
+		p->writable = 0;
+	}
+	lock_release(&c->mutex);
+	return r;
+}/*}}}*/
+
+/* Copies back the client pages the pager reads to print the `len`
+ * bytes at `vaddr`. */
+void mmu_uffd_sync_range(struct mmu_client *c, void *vaddr, size_t len)/*{{{*/
+{
+	uintptr_t start = (uintptr_t)vaddr & ~(uintptr_t)(PAGESIZE - 1);
+	uintptr_t end = (uintptr_t)vaddr + len;
+	if(start < UVM_BASEADDR) start = UVM_BASEADDR;
+	if(end > UVM_MAXADDR + 1) end = UVM_MAXADDR + 1;
+	for(uintptr_t page = start; page < end; page += PAGESIZE) {
+		if(mmu_uffd_sync(c, (void *)page, 0)) mmu_client_fail(c);
+	}
+}/*}}}*/
+
+ssize_t mmu_send_fd(int sock, const void *buf, size_t len, int fd)/*{{{*/
+{
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctl;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	return sendmsg(sock, &msg, 0);
+}/*}}}*/
+
+int mmu_recv_fd(int sock, void *buf, size_t len)/*{{{*/
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctl;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+	if(recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != len) return -1;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if(cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+			cmsg->cmsg_type != SCM_RIGHTS) {
+		errno = EPROTO;
+		return -1;
+	}
+	int fd;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	return fd;
 }/*}}}*/
 /*}}}*/
 
@@ -414,123 +1529,444 @@ struct mmu_client * mmu_client_search(pid_t pid)/*{{{*/
 
 void mmu_zero_fill(int frame)/*{{{*/
 {
-	printf("%s frame %u\n", __func__, frame);
+	mmu_emit(TRACE_ZERO_FILL, -1, NULL, frame, -1, 0);
+	uint64_t start = lat_now();
+	if(mmu_frame_claim(frame) == FRAME_ZERO) {
+		__atomic_add_fetch(&mmu->pool_hits, 1, __ATOMIC_RELAXED);
+	} else {
+		__atomic_add_fetch(&mmu->pool_misses, 1, __ATOMIC_RELAXED);
+		pgmem_fill(mmu->pmem + (PAGESIZE*frame), '0', PAGESIZE);
+	}
+	lat_since(LAT_ZERO_FILL, start);
+}/*}}}*/
+
+void mmu_frame_release(int frame)/*{{{*/
+{
 	logd(LOG_DEBUG, "%s frame %u\n", __func__, frame);
-	memset(mmu->pmem + (PAGESIZE*frame), '0', PAGESIZE);
+	__atomic_store_n(&mmu->frame_state[frame], FRAME_DIRTY, __ATOMIC_RELEASE);
+	if(!mmu->pool_running) return;
+	lock_acquire(&mmu->pool_mutex);
+	pthread_cond_signal(&mmu->pool_cond);
+	lock_release(&mmu->pool_mutex);
 }/*}}}*/
 
+/* These functions wait for the application to effect the mapping or
+ * protection change before returning to the pager.  The client
+ * thread of `pid` receives the acknowledgement and wakes us up. */
 void mmu_resident(pid_t pid, void *vaddr, int frame, int prot)/*{{{*/
 {
-	printf("%s pid %d vaddr %p prot %d frame %u\n", __func__,
-			(int)pid2id[pid], vaddr, prot, frame);
-	logd(LOG_DEBUG, "%s pid %d vaddr %p prot %d frame %u\n", __func__,
-			(int)pid2id[pid], vaddr, prot, frame);
+	mmu_emit(TRACE_RESIDENT, pid2id[pid], vaddr, frame, -1, prot);
+	uint64_t start = lat_now();
 	struct mmu_client *c = mmu_client_search(pid);
+	if(c->uffd != -1) {
+		if(mmu_uffd_resident(c, vaddr, frame, prot)) mmu_client_fail(c);
+		lat_since(LAT_RESIDENT, start);
+		return;
+	}
 	struct mmu_proto_remap_rep rep;
 	rep.type = MMU_PROTO_REMAP_REP;
 	rep.prot = (int32_t)prot;
 	rep.offset = (uint64_t)(PAGESIZE * frame);
 	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-
-	/* We need these functions to wait for the application to
-	 * effect the protection change before we return to the
-	 * pager.  This loop is necessary because mmu_client_thread
-	 * is already in the pager and blocked here (so we cannot
-	 * wait on a condition variable to be signaled forward as
-	 * there is no one else to recv the REMAP_REQ message).  An
-	 * alternative approach would be to use two sockets or
-	 * threads. */
-	uint32_t t;
-	do {
-		 if(recv(c->sock, &t, sizeof(t), MSG_PEEK) != sizeof(t))
-			goto out_client;
-	} while(t != MMU_PROTO_REMAP_REQ);
-	struct mmu_proto_remap_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_REMAP_REQ);
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	if(mmu_client_call(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
+	lat_since(LAT_RESIDENT, start);
 }/*}}}*/
 
 void mmu_nonresident(pid_t pid, void *vaddr)/*{{{*/
 {
-	printf("%s pid %d vaddr %p\n", __func__, (int)pid2id[pid], vaddr);
-	logd(LOG_DEBUG, "%s pid %d vaddr %p\n", __func__, (int)pid2id[pid], vaddr);
+	mmu_emit(TRACE_NONRESIDENT, pid2id[pid], vaddr, -1, -1, PROT_NONE);
+	uint64_t start = lat_now();
 	struct mmu_client *c = mmu_client_search(pid);
+	if(c->uffd != -1) {
+		/* stop writes, take the contents, then have the client drop
+		 * the page so the next access faults again */
+		if(mmu_uffd_writeprotect(c, vaddr, 1) || mmu_uffd_sync(c, vaddr, 1)) {
+			mmu_client_fail(c);
+			return;
+		}
+	}
 	struct mmu_proto_chprot_rep rep;
 	rep.type = MMU_PROTO_CHPROT_REP;
 	rep.prot = PROT_NONE;
 	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-
-	uint32_t t;
-	do {
-		if(recv(c->sock, &t, sizeof(t), MSG_PEEK) != sizeof(t))
-			goto out_client;
-	} while(t != MMU_PROTO_CHPROT_REQ);
-	struct mmu_proto_chprot_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_CHPROT_REQ);
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	if(mmu_client_call(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
+	lat_since(LAT_CHPROT, start);
 }/*}}}*/
 
 void mmu_chprot(pid_t pid, void *vaddr, int prot)/*{{{*/
 {
-	printf("%s pid %d vaddr %p prot %d\n", __func__, (int)pid2id[pid],
-			vaddr, prot);
-	logd(LOG_DEBUG, "%s pid %d vaddr %p prot %d\n", __func__,
-			(int)pid2id[pid], vaddr,prot);
+	mmu_emit(TRACE_CHPROT, pid2id[pid], vaddr, -1, -1, prot);
+	uint64_t start = lat_now();
 	struct mmu_client *c = mmu_client_search(pid);
+	if(c->uffd != -1) {
+		if(mmu_uffd_writeprotect(c, vaddr, !(prot & PROT_WRITE)))
+			mmu_client_fail(c);
+		lat_since(LAT_CHPROT, start);
+		return;
+	}
 	struct mmu_proto_chprot_rep rep;
 	rep.type = MMU_PROTO_CHPROT_REP;
 	rep.prot = (int32_t)prot;
 	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-
-	uint32_t t;
-	do {
-		if(recv(c->sock, &t, sizeof(t), MSG_PEEK) != sizeof(t))
-			goto out_client;
-	} while(t != MMU_PROTO_CHPROT_REQ);
-	struct mmu_proto_chprot_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_CHPROT_REQ);
-	return;
+	if(mmu_client_call(c, &rep, sizeof(rep)))
+		mmu_client_fail(c);
+	lat_since(LAT_CHPROT, start);
+}/*}}}*/
 
-	out_client:
-	mmu_client_destroy(c);
+int mmu_disk_read(int block_from, int frame_to)/*{{{*/
+{
+	struct mmu_io_wait w = { PTHREAD_MUTEX_INITIALIZER,
+			PTHREAD_COND_INITIALIZER, 0, 0 };
+	mmu_disk_read_async(block_from, frame_to, mmu_io_wake, &w);
+	return mmu_io_wait(&w);
 }/*}}}*/
 
-void mmu_disk_read(int block_from, int frame_to)/*{{{*/
+int mmu_disk_write(int frame_from, int block_to)/*{{{*/
 {
-	printf("%s from block %d to frame %d\n", __func__,
-			block_from, frame_to);
-	logd(LOG_DEBUG, "%s from block %d to frame %d\n", __func__,
-			block_from, frame_to);
-	memcpy(mmu->pmem + frame_to*PAGESIZE, mmu->disk + block_from*PAGESIZE,
-			PAGESIZE);
+	struct mmu_io_wait w = { PTHREAD_MUTEX_INITIALIZER,
+			PTHREAD_COND_INITIALIZER, 0, 0 };
+	mmu_disk_write_async(frame_from, block_to, mmu_io_wake, &w);
+	return mmu_io_wait(&w);
 }/*}}}*/
 
-void mmu_disk_write(int frame_from, int block_to)/*{{{*/
+void mmu_disk_read_async(int block_from, int frame_to, mmu_disk_cb cb,/*{{{*/
+		void *arg)
 {
-	printf("%s from frame %d to block %d\n", __func__,
-			frame_from, block_to);
-	logd(LOG_DEBUG, "%s from frame %d to block %d\n", __func__,
-			frame_from, block_to);
-	memcpy(mmu->disk + block_to*PAGESIZE, mmu->pmem + frame_from*PAGESIZE,
-			PAGESIZE);
+	mmu_emit(TRACE_DISK_READ, -1, NULL, frame_to, block_from, 0);
+	mmu_frame_claim(frame_to);
+	mmu_io_submit(0, block_from, frame_to, cb, arg);
+}/*}}}*/
+
+void mmu_disk_write_async(int frame_from, int block_to, mmu_disk_cb cb,/*{{{*/
+		void *arg)
+{
+	mmu_emit(TRACE_DISK_WRITE, -1, NULL, frame_from, block_to, 0);
+	mmu_io_submit(1, block_to, frame_from, cb, arg);
+}/*}}}*/
+
+/* Unlike disk blocks, file pages are read and written by the calling
+ * thread itself. */
+void mmu_file_read(int fd, off_t offset, int frame)/*{{{*/
+{
+	mmu_emit(TRACE_FILE_READ, -1, (void *)(intptr_t)offset, frame, -1, 0);
+	mmu_frame_claim(frame);
+	char *buf = mmu->pmem + frame*PAGESIZE;
+	size_t done = 0;
+	while(done < PAGESIZE) {
+		ssize_t r = pread(fd, buf + done, PAGESIZE - done, offset + done);
+		if(r == -1 && errno == EINTR) continue;
+		if(r == -1) loge(LOG_WARN, __FILE__, __LINE__);
+		if(r <= 0) break;
+		done += r;
+	}
+	if(done < PAGESIZE) pgmem_fill(buf + done, '0', PAGESIZE - done);
+}/*}}}*/
+
+void mmu_file_write(int frame, int fd, off_t offset)/*{{{*/
+{
+	mmu_emit(TRACE_FILE_WRITE, -1, (void *)(intptr_t)offset, frame, -1, 0);
+	struct stat st;
+	if(fstat(fd, &st) == -1) {
+		loge(LOG_WARN, __FILE__, __LINE__);
+		return;
+	}
+	if(st.st_size <= offset) return;
+	size_t len = st.st_size - offset < PAGESIZE ? st.st_size - offset : PAGESIZE;
+	const char *buf = mmu->pmem + frame*PAGESIZE;
+	size_t done = 0;
+	while(done < len) {
+		ssize_t r = pwrite(fd, buf + done, len - done, offset + done);
+		if(r == -1 && errno == EINTR) continue;
+		if(r == -1) {
+			loge(LOG_WARN, __FILE__, __LINE__);
+			return;
+		}
+		done += r;
+	}
+}/*}}}*/
+
+void mmu_syslog_print(const void *buf, size_t len)/*{{{*/
+{
+	#ifdef MMUTRACE
+	if(len > 0) trace_record_data(buf, len);
+	#else
+	if(len == 0) return;
+	char *line = malloc(8*len + 1);
+	if(!line) logea(__FILE__, __LINE__, NULL);
+	size_t n = pgmem_hex(line, buf, len);
+	line[n++] = '\n';
+	fwrite(line, 1, n, stdout);
+	free(line);
+	#endif
+}/*}}}*/
+
+void mmu_disk_discard(int block)/*{{{*/
+{
+	logd(LOG_DEBUG, "%s block %d\n", __func__, block);
+	if(mmu->disk_fd == -1) return;
+	int mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+	if(fallocate(mmu->disk_fd, mode, (off_t)block * PAGESIZE, PAGESIZE))
+		loge(LOG_DEBUG, __FILE__, __LINE__);
+}/*}}}*/
+
+/* Unlike `mmu_client_search`, a client that is already gone is fine:
+ * its thread destroys the process anyway. */
+void mmu_kill(pid_t pid)/*{{{*/
+{
+	logd(LOG_WARN, "%s pid %d\n", __func__, (int)pid);
+	for(int i = 3; i < MMU_MAX_SOCK; ++i) {
+		struct mmu_client *c = mmu->sock2client[i];
+		if(c && c->pid == pid) {
+			mmu_client_fail(c);
+			return;
+		}
+	}
+}/*}}}*/
+/*}}}*/
+
+/****************************************************************************
+ * disk I/O {{{
+ ***************************************************************************/
+void mmu_io_submit(int write, int block, int frame, mmu_disk_cb cb,/*{{{*/
+		void *arg)
+{
+	if(mmu->disk_fd == -1) {
+		uint64_t start = lat_now();
+		char *f = mmu->pmem + frame*PAGESIZE;
+		char *b = mmu->disk + block*PAGESIZE;
+		if(write) pgmem_copy(b, f, PAGESIZE);
+		else pgmem_copy(f, b, PAGESIZE);
+		lat_since(write ? LAT_DISK_WRITE : LAT_DISK_READ, start);
+		cb(arg, 0);
+		return;
+	}
+	struct mmu_io *io = malloc(sizeof(*io));
+	if(!io) logea(__FILE__, __LINE__, NULL);
+	io->write = write;
+	io->block = block;
+	io->frame = frame;
+	io->cb = cb;
+	io->arg = arg;
+	io->submitted = lat_now();
+	io->next = NULL;
+	lock_acquire(&mmu->io_mutex);
+	if(mmu->io_tail) mmu->io_tail->next = io;
+	else mmu->io_head = io;
+	mmu->io_tail = io;
+	pthread_cond_signal(&mmu->io_cond);
+	lock_release(&mmu->io_mutex);
+}/*}}}*/
+
+void * mmu_io_thread(void *unused)/*{{{*/
+{
+	lock_acquire(&mmu->io_mutex);
+	while(1) {
+		while(mmu->io_running && !mmu->io_head)
+			lock_wait(&mmu->io_cond, &mmu->io_mutex);
+		if(!mmu->io_head) break;
+		struct mmu_io *io = mmu->io_head;
+		mmu->io_head = io->next;
+		if(!mmu->io_head) mmu->io_tail = NULL;
+		lock_release(&mmu->io_mutex);
+
+		/* frames are page-aligned in `pmem`, so they can be used as
+		 * O_DIRECT buffers as is. */
+		char *buf = mmu->pmem + io->frame*PAGESIZE;
+		off_t off = (off_t)io->block * PAGESIZE;
+		size_t done = 0;
+		int err = 0;
+		while(done < PAGESIZE) {
+			ssize_t r;
+			if(io->write) r = pwrite(mmu->disk_fd, buf + done,
+					PAGESIZE - done, off + done);
+			else r = pread(mmu->disk_fd, buf + done,
+					PAGESIZE - done, off + done);
+			if(r == -1 && errno == EINTR) continue;
+			if(r == -1) { /* the pager decides what to do */
+				err = -errno;
+				loge(LOG_WARN, __FILE__, __LINE__);
+				break;
+			}
+			if(r == 0) { /* hole past the end of the file */
+				memset(buf + done, 0, PAGESIZE - done);
+				break;
+			}
+			done += r;
+		}
+		lat_since(io->write ? LAT_DISK_WRITE : LAT_DISK_READ, io->submitted);
+		io->cb(io->arg, err);
+		free(io);
+
+		lock_acquire(&mmu->io_mutex);
+	}
+	lock_release(&mmu->io_mutex);
+	return NULL;
+}/*}}}*/
+
+void mmu_io_wake(void *vwait, int err)/*{{{*/
+{
+	struct mmu_io_wait *w = vwait;
+	lock_acquire(&w->mutex);
+	w->done = 1;
+	w->err = err;
+	pthread_cond_signal(&w->cond);
+	lock_release(&w->mutex);
+}/*}}}*/
+
+int mmu_io_wait(struct mmu_io_wait *w)/*{{{*/
+{
+	lock_acquire(&w->mutex);
+	while(!w->done) lock_wait(&w->cond, &w->mutex);
+	lock_release(&w->mutex);
+	pthread_mutex_destroy(&w->mutex);
+	pthread_cond_destroy(&w->cond);
+	return w->err;
+}/*}}}*/
+/*}}}*/
+
+/****************************************************************************
+ * request workers {{{
+ ***************************************************************************/
+/* Called with `c->mutex` locked.  Requests from a client that is
+ * exiting are dropped; the client never waits for their replies. */
+void mmu_work_submit(struct mmu_client *c, const union mmu_msg *msg)/*{{{*/
+{
+	if(c->exiting) {
+		mmu_client_log(c, __func__, "exiting, request dropped");
+		if(msg->hdr.type == MMU_PROTO_MAP_REQ) close(msg->map.fd);
+		return;
+	}
+	struct mmu_work *w = malloc(sizeof(*w));
+	if(!w) logea(__FILE__, __LINE__, NULL);
+	w->c = c;
+	w->msg = *msg;
+	w->next = NULL;
+	c->inflight++;
+	lock_acquire(&mmu->work_mutex);
+	if(mmu->work_tail) mmu->work_tail->next = w;
+	else mmu->work_head = w;
+	mmu->work_tail = w;
+	pthread_cond_signal(&mmu->work_cond);
+	lock_release(&mmu->work_mutex);
+}/*}}}*/
+
+void * mmu_work_thread(void *unused)/*{{{*/
+{
+	lock_acquire(&mmu->work_mutex);
+	while(1) {
+		while(mmu->work_running && !mmu->work_head)
+			lock_wait(&mmu->work_cond, &mmu->work_mutex);
+		if(!mmu->work_head) break;
+		struct mmu_work *w = mmu->work_head;
+		mmu->work_head = w->next;
+		if(!mmu->work_head) mmu->work_tail = NULL;
+		lock_release(&mmu->work_mutex);
+
+		mmu_client_service(w->c, &w->msg);
+		free(w);
+
+		lock_acquire(&mmu->work_mutex);
+	}
+	lock_release(&mmu->work_mutex);
+	return NULL;
+}/*}}}*/
+/*}}}*/
+
+/****************************************************************************
+ * operation log {{{
+ ***************************************************************************/
+/* Every pager call and MMU primitive produces one line of output (the
+ * text graded against the `.mmu.out` files).  With MMUTRACE the line
+ * is recorded as a binary trace record and rendered offline by
+ * `mmutrace`, keeping formatting off the fault path. */
+void mmu_emit(uint32_t op, int id, void *vaddr, int frame, int block,/*{{{*/
+		int prot)
+{
+	struct trace_rec rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.op = op;
+	rec.pid = id;
+	rec.ev.vaddr = (uintptr_t)vaddr;
+	rec.ev.frame = frame;
+	rec.ev.block = block;
+	rec.ev.prot = prot;
+	#ifdef MMUTRACE
+	trace_record(&rec);
+	#else
+	char line[128];
+	trace_format(line, sizeof(line), &rec);
+	fputs(line, stdout);
+	logd(LOG_DEBUG, "%s", line);
+	#endif
+}/*}}}*/
+/*}}}*/
+
+/****************************************************************************
+ * pre-zeroed frame pool {{{
+ ***************************************************************************/
+/* Marks `frame` as in use by the pager and returns its previous state.
+ * Waits for the pool thread if it is in the middle of zeroing the
+ * frame, which takes less than a page fill. */
+int mmu_frame_claim(int frame)/*{{{*/
+{
+	uint8_t *state = &mmu->frame_state[frame];
+	uint8_t old = __atomic_load_n(state, __ATOMIC_ACQUIRE);
+	while(1) {
+		if(old == FRAME_ZEROING) {
+			sched_yield();
+			old = __atomic_load_n(state, __ATOMIC_ACQUIRE);
+			continue;
+		}
+		if(__atomic_compare_exchange_n(state, &old, FRAME_INUSE, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) break;
+	}
+	if(old == FRAME_ZERO) {
+		lock_acquire(&mmu->pool_mutex);
+		mmu->pool_count--;
+		pthread_cond_signal(&mmu->pool_cond);
+		lock_release(&mmu->pool_mutex);
+	}
+	return old;
+}/*}}}*/
+
+/* Fills free frames with '0' while the machine is otherwise idle, so
+ * that first-touch faults find them ready.  Lower frames go first as
+ * the pager allocates the lowest-numbered free frame. */
+void * mmu_pool_thread(void *unused)/*{{{*/
+{
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+	lock_acquire(&mmu->pool_mutex);
+	while(mmu->pool_running) {
+		int frame = -1;
+		if(mmu->pool_count < mmu->pool_size) {
+			for(int i = 0; i < mmu->npages; ++i) {
+				uint8_t old = FRAME_DIRTY;
+				if(__atomic_compare_exchange_n(&mmu->frame_state[i], &old,
+						FRAME_ZEROING, 0, __ATOMIC_ACQ_REL,
+						__ATOMIC_RELAXED)) {
+					frame = i;
+					break;
+				}
+			}
+		}
+		if(frame == -1) {
+			lock_wait(&mmu->pool_cond, &mmu->pool_mutex);
+			continue;
+		}
+		mmu->pool_count++;
+		lock_release(&mmu->pool_mutex);
+		pgmem_fill(mmu->pmem + (PAGESIZE*frame), '0', PAGESIZE);
+		__atomic_store_n(&mmu->frame_state[frame], FRAME_ZERO,
+				__ATOMIC_RELEASE);
+		lock_acquire(&mmu->pool_mutex);
+	}
+	lock_release(&mmu->pool_mutex);
+	return NULL;
 }/*}}}*/
 /*}}}*/
 
@@ -541,32 +1977,80 @@ void mmu_disk_write(int frame_from, int block_to)/*{{{*/
 void pager_free(void);
 #endif
 void usage(int argc, char **argv) {/*{{{*/
-	printf("usage: %s NFRAMES NBLOCKS\n", argv[0]);
+	printf("usage: %s [-Hptw] [-s SWAPFILE] [-z POOLSIZE] NFRAMES NBLOCKS\n",
+			argv[0]);
 	printf("\n");
 	printf("valid ranges: 2 <= NFRAMES <= 256\n");
 	printf("              4 <= NBLOCKS <= 1024\n");
+	printf("\n");
+	printf("  -H  back physical memory with transparent huge pages\n");
+	printf("  -p  split frames among processes by their miss-ratio curves\n");
+	printf("  -s  keep swap blocks in SWAPFILE (a file or block device)\n");
+	printf("  -t  suspend processes while they thrash (load control)\n");
+	printf("  -z  keep up to POOLSIZE free frames zeroed in the background\n");
+	printf("      (default NFRAMES, 0 disables)\n");
+	printf("  -w  map pages writable right away on write faults\n");
+	printf("\n");
+	printf("SIGUSR1 and shutdown write fault-path latencies to %s\n",
+			LAT_DEFAULT_PATH);
 	exit(EXIT_FAILURE);
 }/*}}}*/
 
 int main(int argc, char **argv) {/*{{{*/
-	if(argc != 3) usage(argc, argv);
-	int npages = atoi(argv[1]);
-	if(npages < 1 || npages > 256) usage(argc, argv);
-	int nblocks = atoi(argv[2]);
+	int opt;
+	memset(&opts, 0, sizeof(opts));
+	opts.pool_size = -1;
+	while((opt = getopt(argc, argv, "Hps:twz:")) != -1) {
+		switch(opt) {
+		case 'H':
+			opts.hugepages = 1;
+			break;
+		case 'p':
+			opts.partition = 1;
+			break;
+		case 's':
+			opts.swapfn = optarg;
+			break;
+		case 't':
+			opts.load_control = 1;
+			break;
+		case 'w':
+			opts.write_faults = 1;
+			break;
+		case 'z':
+			opts.pool_size = atoi(optarg);
+			if(opts.pool_size < 0) usage(argc, argv);
+			break;
+		default:
+			usage(argc, argv);
+		}
+	}
+	if(argc - optind != 2) usage(argc, argv);
+	int npages = atoi(argv[optind]);
+	if(npages < 1 || npages > MMU_MAX_FRAMES) usage(argc, argv);
+	int nblocks = atoi(argv[optind+1]);
 	if(nblocks < 2 || nblocks > 1024) usage(argc, argv);
 	#ifdef MMULOG
 	log_init(LOG_EXTRA, "mmu.log", 1, 1<<20);
 	#endif
 	memset(pid2id, 255, UINT16_MAX);
+	#ifdef MMUTRACE
+	trace_init(TRACE_DEFAULT_PATH);
+	#endif
 	mmu_init(npages, nblocks);
 	pager_init(npages, nblocks);
+	if(opts.load_control) pager_set_load_control(1);
+	if(opts.partition) pager_set_partition(1);
 	mmu_accept_loop();
 	#ifdef MMUFREE
 	pager_free();
 	#endif
 	mmu_destroy();
+	mmu_lat_dump();
+	#ifdef MMUTRACE
+	trace_destroy();
+	#endif
 	#ifdef MMULOG
 	log_destroy();
 	#endif
 }/*}}}*/
-
@@ -19,6 +19,37 @@
  * and `UVM_MAXADDR` are sent to the pager. */
 #define UVM_MAXADDR ((intptr_t)0x600FFFFF)
 
+/* The MMU runs with at most `MMU_MAX_FRAMES` frames of physical
+ * memory, so miss-ratio curves (see `pager_get_mrc`) have at most
+ * `MMU_MAX_FRAMES + 1` points. */
+#define MMU_MAX_FRAMES 256
+
+/* Advice about how a range of pages will be accessed, given with
+ * `uvm_advise` and passed on to `pager_advise`.  `NORMAL` is the
+ * default.  `SEQUENTIAL` pages are read ahead on faults and dropped
+ * soon after the accesses move past them; `RANDOM` pages are never
+ * read ahead.  `WILLNEED` brings pages in now and `DONTNEED` pages
+ * them out now, keeping their contents.  `COLD` pages are the first
+ * to be evicted until they are accessed again.  `WILLNEED` and
+ * `DONTNEED` do not change the advice recorded for the pages. */
+#define UVM_ADV_NORMAL 0
+#define UVM_ADV_SEQUENTIAL 1
+#define UVM_ADV_RANDOM 2
+#define UVM_ADV_WILLNEED 3
+#define UVM_ADV_DONTNEED 4
+#define UVM_ADV_COLD 5
+
+/* Shared regions created with `uvm_share` are named by strings of up
+ * to `UVM_SHARE_NAME_MAX - 1` characters. */
+#define UVM_SHARE_NAME_MAX 32
+
+/* Flags for `uvm_map_file`.  Pages of a `PRIVATE` mapping are copies
+ * of the file: writes stay in memory and swap.  Dirty pages of a
+ * `WRITEBACK` mapping are written back to the file when they are paged
+ * out or released, and never use swap. */
+#define UVM_MAP_PRIVATE 0
+#define UVM_MAP_WRITEBACK 1
+
 /* `pmem` points to the physical memory maintained by the MMU.  Your
  * pager should never write to `pmem`.  */
 extern const char *pmem;
@@ -32,6 +63,11 @@ extern const char *pmem;
  * allowing read access to a page.  */
 void mmu_zero_fill(int frame);
 
+/* `mmu_frame_release` tells the MMU that `frame` is free and no
+ * process maps it anymore.  The MMU zeroes released frames in the
+ * background, which makes a later `mmu_zero_fill` on them free.  */
+void mmu_frame_release(int frame);
+
 /* `mmu_resident` will map address `vaddr` in process `pid` to
  * `frame` with protection level `prot`.  `vaddr` should be
  * page-aligned (i.e., `vaddr & (PAGESIZE-1)` should be zero).
@@ -52,8 +88,50 @@ void mmu_chprot(pid_t pid, void *vaddr, int prot);
 /* `mmu_disk_read` copies content from disk block `block_from` into
  * physical frame `frame_to`.  `mmu_disk_write` copies content from
  * frame `frame_from` to disk block `block_to`.  Your pager shoudl
- * use these functions to save paged-out frames.  */
-void mmu_disk_read(int block_from, int frame_to);
-void mmu_disk_write(int frame_from, int block_to);
+ * use these functions to save paged-out frames.  Both return 0 on
+ * success, or a negative errno value if the swap file could not be
+ * read or written.  */
+int mmu_disk_read(int block_from, int frame_to);
+int mmu_disk_write(int frame_from, int block_to);
+
+/* `mmu_disk_read_async` and `mmu_disk_write_async` start the same
+ * copies as `mmu_disk_read` and `mmu_disk_write` but do not wait for
+ * them.  `cb(arg, err)` is called once the copy completes, with `err`
+ * as `mmu_disk_read` would return it, possibly from another thread
+ * and possibly before the function returns.  The
+ * frame must not be touched or reused until `cb` runs.  When the MMU
+ * keeps the disk in memory these complete immediately; with a swap
+ * file (`-s`) they are serviced by a pool of I/O threads. */
+typedef void (*mmu_disk_cb)(void *arg, int err);
+void mmu_disk_read_async(int block_from, int frame_to, mmu_disk_cb cb,
+		void *arg);
+void mmu_disk_write_async(int frame_from, int block_to, mmu_disk_cb cb,
+		void *arg);
+
+/* `mmu_file_read` copies the page at `offset` in the file open on `fd`
+ * into `frame`; bytes past the end of the file are zeroes (character
+ * '0', as in `mmu_zero_fill`).  `mmu_file_write` copies `frame` back
+ * to the file at `offset`, but only the bytes before the end of the
+ * file, so the file never grows.  `offset` should be page-aligned.
+ * Your pager should use these functions to page file mappings in and
+ * out (see `pager_map_file`).  */
+void mmu_file_read(int fd, off_t offset, int frame);
+void mmu_file_write(int frame, int fd, off_t offset);
+
+/* `mmu_syslog_print` writes the `len` bytes at `buf` to the MMU
+ * output as a line of hexadecimal digits.  Your pager should use it
+ * to print messages in `pager_syslog`.  */
+void mmu_syslog_print(const void *buf, size_t len);
+
+/* `mmu_disk_discard` tells the MMU the contents of `block` are no
+ * longer needed.  With a swap file this releases the storage backing
+ * the block (hole punching).  */
+void mmu_disk_discard(int block);
+
+/* `mmu_kill` disconnects process `pid`, e.g., when its pages could
+ * not be read from or written to disk.  The MMU calls `pager_destroy`
+ * for it later, from another thread, so the pager must keep the
+ * process' pages consistent until then.  */
+void mmu_kill(pid_t pid);
 
 #endif
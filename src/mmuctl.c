@@ -0,0 +1,114 @@
+/* Administration tool for a running MMU.  Shows the resident-set
+ * limits and counters of a client process and, given MIN and MAX,
+ * changes its limits (see `pager_set_rss`).  Run it in the directory
+ * where the MMU was started, as it connects to the MMU socket there.
+ *
+ * usage: mmuctl PID [MIN MAX]
+ *        mmuctl -c PID
+ *
+ * Prints one line: the frames the process holds, its limits, and how
+ * many frames it took from other processes (steals) and lost to them
+ * (stolen), followed by "suspended" while load control (`mmu -t`)
+ * keeps it from running.  MAX 0 means no limit.
+ *
+ * With -c, prints the miss-ratio curve of the process instead (see
+ * `pager_get_mrc`) for capacity planning: a comment line with the
+ * number of recent faults, then one line per memory size with the
+ * frames, the predicted faults, and the predicted miss ratio. */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "mmuproto.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s PID [MIN MAX]\n", prog);
+	fprintf(stderr, "       %s -c PID\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+static int connect_mmu(void)
+{
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, MMU_PROTO_UNIX_PATH, sizeof(addr.sun_path) - 1);
+	if(sock == -1 || connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror(MMU_PROTO_UNIX_PATH);
+		exit(EXIT_FAILURE);
+	}
+	return sock;
+}
+
+static void transact(int sock, const void *req, size_t reqsz, void *rep,
+		size_t repsz)
+{
+	if(send(sock, req, reqsz, 0) != reqsz ||
+			recv(sock, rep, repsz, MSG_WAITALL) != repsz) {
+		perror("mmuctl");
+		exit(EXIT_FAILURE);
+	}
+	close(sock);
+}
+
+static int curve(uint32_t pid)
+{
+	struct mmu_proto_mrc_req req;
+	memset(&req, 0, sizeof(req));
+	req.type = MMU_PROTO_MRC_REQ;
+	req.pid = pid;
+	struct mmu_proto_mrc_rep rep;
+	transact(connect_mmu(), &req, sizeof(req), &rep, sizeof(rep));
+	if(rep.retcode) {
+		fprintf(stderr, "pid %u: %s\n", pid, strerror(rep.retcode));
+		exit(EXIT_FAILURE);
+	}
+	printf("# pid %u faults %llu\n", pid, (unsigned long long)rep.refs);
+	for(int i = 0; i < rep.npoints; ++i) {
+		double ratio = rep.refs ? (double)rep.misses[i] / rep.refs : 0;
+		printf("%d %llu %.4f\n", i, (unsigned long long)rep.misses[i], ratio);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc == 3 && strcmp(argv[1], "-c") == 0) {
+		uint32_t pid = atoi(argv[2]);
+		if(pid == 0) usage(argv[0]);
+		return curve(pid);
+	}
+	if(argc != 2 && argc != 4) usage(argv[0]);
+	struct mmu_proto_rss_req req;
+	memset(&req, 0, sizeof(req));
+	req.type = MMU_PROTO_RSS_REQ;
+	req.pid = atoi(argv[1]);
+	if(req.pid == 0) usage(argv[0]);
+	if(argc == 4) {
+		req.set = 1;
+		req.min = atoi(argv[2]);
+		req.max = atoi(argv[3]);
+	}
+
+	struct mmu_proto_rss_rep rep;
+	transact(connect_mmu(), &req, sizeof(req), &rep, sizeof(rep));
+	if(rep.retcode) {
+		fprintf(stderr, "pid %u: %s\n", req.pid, strerror(rep.retcode));
+		exit(EXIT_FAILURE);
+	}
+	printf("pid %u resident %d min %d max %d steals %llu stolen %llu%s\n",
+			req.pid, rep.resident, rep.min, rep.max,
+			(unsigned long long)rep.steals, (unsigned long long)rep.stolen,
+			rep.suspended ? " suspended" : "");
+	return 0;
+}
@@ -11,23 +11,58 @@
  *
  * The `CREATE` message and its reply are exchanged before the
  * `vmu_thread` starts.  Clients send their PID to the MMU, and
- * receive the path to the memory-mapped file representing physical
- * memory.
+ * receive a file descriptor for the anonymous memory file (memfd)
+ * representing physical memory.  The descriptor is passed as
+ * SCM_RIGHTS ancillary data attached to `CREATE_REP`, so clients do
+ * not depend on any file in the filesystem.
  *
- * The `EXTEND` and `SEGV` messages are generated by the client when
- * they allocate memory and experience a segmentation fault,
- * respectively.  The request functions (`uvm_extend` and
- * `uvm_segv_action`) wait on a condition variable for the request
- * to be serviced.
+ * The `EXTEND`, `SYSLOG` and `SEGV` messages are generated by the
+ * client when they allocate memory, print, and experience a
+ * segmentation fault, respectively.  `SYSLOGV` prints up to
+ * `MMU_PROTO_SYSLOGV_MAX` buffers at once; only the first `count`
+ * entries of `spans` are sent, and the reply tells how many spans
+ * were printed before one failed.  `RELEASE` gives `npages` pages
+ * starting at `vaddr` back to the MMU; once it is acknowledged, the
+ * client unmaps them.  `ADVISE` passes `uvm_advise` hints on to the
+ * pager, and `PIN` pins or unpins pages; its `retcode` is an errno
+ * value.  `SHARE` creates a shared region (`create` set) or attaches
+ * an existing one; the reply carries the address where the region was
+ * attached and its size, or an errno value in `retcode`.  `MAP` maps
+ * `npages` pages of a file starting at `offset`; the client passes a
+ * descriptor for the file as SCM_RIGHTS ancillary data, which the MMU
+ * stores in `fd` when it receives the message.  `RSS` sets the
+ * resident-set limits of process `pid` (with `set`) and reports its
+ * limits and counters; `pid` zero means the sender.  Administration
+ * tools such as `mmuctl` send it right after connecting, without
+ * `CREATE`, to inspect or limit other processes.  `MRC` reports the
+ * miss-ratio curve of process `pid` the same way.  Every request
+ * carries an `id` chosen by the client and echoed in its reply, so a
+ * client may have several requests in flight (one per thread) and the
+ * MMU may service them concurrently and reply in any order.
  *
  * The `REMAP` and `CHPROT` messages are generated by the MMU and
- * are processed by `uvm_thread` asynchronously.  These messages are
+ * are processed by the client asynchronously.  These messages are
  * used to service sergmentation faults and whenever the pager pages
- * some of the processes pages to disk. */
+ * some of the processes pages to disk.  Here the MMU picks the `id`
+ * and the client echoes it in the `REMAP_REQ` or `CHPROT_REQ` that
+ * acknowledges the change.
+ *
+ * A client may send `UFFD` right after `CREATE` to hand the MMU a
+ * userfaultfd covering its pages, passed as SCM_RIGHTS ancillary
+ * data like the pmem descriptor.  If the MMU accepts it (`retcode`
+ * zero), it resolves the client's faults through that descriptor:
+ * no `SEGV`, `REMAP` or `CHPROT` messages are exchanged, except for a
+ * `CHPROT` to `PROT_NONE` asking the client to drop a page the MMU
+ * has already copied back.  `probe` is the address of some client
+ * memory the MMU reads to check it can access the client's memory.
+ *
+ * Every message starts with a `struct mmu_proto_hdr`. */
 
 #ifndef __MMUPROTO_HEADER__
 #define __MMUPROTO_HEADER__
 
+#include <stddef.h>
+
 /* From UNIX_PATH_MAX, see man (7) unix: */
 #define MMU_PROTO_PATH_MAX 108
 #define MMU_PROTO_UNIX_PATH "mmu.sock"
@@ -44,51 +79,210 @@
 #define MMU_PROTO_REMAP_REP 10
 #define MMU_PROTO_CHPROT_REQ 11
 #define MMU_PROTO_CHPROT_REP 12
+#define MMU_PROTO_UFFD_REQ 13
+#define MMU_PROTO_UFFD_REP 14
+#define MMU_PROTO_SYSLOGV_REQ 15
+#define MMU_PROTO_SYSLOGV_REP 16
+#define MMU_PROTO_RELEASE_REQ 17
+#define MMU_PROTO_RELEASE_REP 18
+#define MMU_PROTO_ADVISE_REQ 19
+#define MMU_PROTO_ADVISE_REP 20
+#define MMU_PROTO_PIN_REQ 21
+#define MMU_PROTO_PIN_REP 22
+#define MMU_PROTO_SHARE_REQ 23
+#define MMU_PROTO_SHARE_REP 24
+#define MMU_PROTO_MAP_REQ 25
+#define MMU_PROTO_MAP_REP 26
+#define MMU_PROTO_RSS_REQ 27
+#define MMU_PROTO_RSS_REP 28
+#define MMU_PROTO_MRC_REQ 29
+#define MMU_PROTO_MRC_REP 30
 #define MMU_PROTO_EXIT_REQ 32
 #define MMU_PROTO_EXIT_REP 33
 
+struct mmu_proto_hdr {
+	uint32_t type;
+	uint32_t id;
+} __attribute__((packed));
+
 struct mmu_proto_create_req {
 	uint32_t type;
+	uint32_t id;
 	uint32_t pid;
 } __attribute__((packed));
 struct mmu_proto_create_rep {
 	uint32_t type;
-	char pmem_fn[MMU_PROTO_PATH_MAX];
+	uint32_t id;
+	uint64_t pmemsz;
 } __attribute__((packed));
+// pmem file descriptor goes in SCM_RIGHTS ancillary data
 
 struct mmu_proto_extend_req {
 	uint32_t type;
+	uint32_t id;
 } __attribute__((packed));
 struct mmu_proto_extend_rep {
 	uint32_t type;
+	uint32_t id;
 	uint64_t vaddr;
 } __attribute__((packed));
 
 struct mmu_proto_syslog_req {
 	uint32_t type;
+	uint32_t id;
 	uint32_t len;
 	uint64_t addr;
 } __attribute__((packed));
 struct mmu_proto_syslog_rep {
 	uint32_t type;
+	uint32_t id;
 	uint32_t retcode;
 } __attribute__((packed));
 
+#define MMU_PROTO_SYSLOGV_MAX 64
+struct mmu_proto_span {
+	uint64_t addr;
+	uint32_t len;
+} __attribute__((packed));
+struct mmu_proto_syslogv_req {
+	uint32_t type;
+	uint32_t id;
+	uint32_t count;
+	struct mmu_proto_span spans[MMU_PROTO_SYSLOGV_MAX];
+} __attribute__((packed));
+#define MMU_PROTO_SYSLOGV_LEN(count) \
+	(offsetof(struct mmu_proto_syslogv_req, spans) + \
+	 (count) * sizeof(struct mmu_proto_span))
+struct mmu_proto_syslogv_rep {
+	uint32_t type;
+	uint32_t id;
+	int32_t retcode;	/* 0 if every span was printed, -1 otherwise */
+	uint32_t nlogged;	/* spans printed, index of the failed one */
+} __attribute__((packed));
+
+struct mmu_proto_release_req {
+	uint32_t type;
+	uint32_t id;
+	uint32_t npages;
+	uint64_t vaddr;
+} __attribute__((packed));
+struct mmu_proto_release_rep {
+	uint32_t type;
+	uint32_t id;
+	int32_t retcode;
+} __attribute__((packed));
+
+struct mmu_proto_advise_req {
+	uint32_t type;
+	uint32_t id;
+	uint32_t npages;
+	uint32_t advice;	/* UVM_ADV_* */
+	uint64_t vaddr;
+} __attribute__((packed));
+struct mmu_proto_advise_rep {
+	uint32_t type;
+	uint32_t id;
+	int32_t retcode;
+} __attribute__((packed));
+
+struct mmu_proto_pin_req {
+	uint32_t type;
+	uint32_t id;
+	uint32_t npages;
+	uint32_t pin;	/* 1 to pin, 0 to unpin */
+	uint64_t vaddr;
+} __attribute__((packed));
+struct mmu_proto_pin_rep {
+	uint32_t type;
+	uint32_t id;
+	int32_t retcode;	/* 0 or an errno value */
+} __attribute__((packed));
+
+struct mmu_proto_share_req {
+	uint32_t type;
+	uint32_t id;
+	uint32_t npages;	/* ignored when attaching */
+	uint32_t create;	/* 1 to create, 0 to attach */
+	char name[UVM_SHARE_NAME_MAX];	/* NUL-terminated, see mmu.h */
+} __attribute__((packed));
+struct mmu_proto_share_rep {
+	uint32_t type;
+	uint32_t id;
+	int32_t retcode;	/* 0 or an errno value */
+	uint32_t npages;
+	uint64_t vaddr;
+} __attribute__((packed));
+
+struct mmu_proto_map_req {
+	uint32_t type;
+	uint32_t id;
+	uint32_t npages;
+	uint32_t flags;	/* UVM_MAP_* */
+	uint64_t offset;
+	int32_t fd;	/* set by the MMU, ignored on the wire */
+} __attribute__((packed));
+struct mmu_proto_map_rep {
+	uint32_t type;
+	uint32_t id;
+	int32_t retcode;	/* 0 or an errno value */
+	uint64_t vaddr;
+} __attribute__((packed));
+// file descriptor goes in SCM_RIGHTS ancillary data
+
+struct mmu_proto_rss_req {
+	uint32_t type;
+	uint32_t id;
+	uint32_t pid;	/* 0 for the sender */
+	uint32_t set;	/* 1 to set the limits below, 0 to only report */
+	int32_t min;	/* frames */
+	int32_t max;	/* frames, 0 for no limit */
+} __attribute__((packed));
+struct mmu_proto_rss_rep {
+	uint32_t type;
+	uint32_t id;
+	int32_t retcode;	/* 0 or an errno value */
+	int32_t resident;
+	int32_t min;
+	int32_t max;
+	uint64_t steals;	/* frames taken from other processes */
+	uint64_t stolen;	/* frames other processes took */
+	int32_t suspended;	/* 1 if load control suspended it */
+} __attribute__((packed));
+
+struct mmu_proto_mrc_req {
+	uint32_t type;
+	uint32_t id;
+	uint32_t pid;	/* 0 for the sender */
+} __attribute__((packed));
+struct mmu_proto_mrc_rep {
+	uint32_t type;
+	uint32_t id;
+	int32_t retcode;	/* 0 or an errno value */
+	int32_t npoints;
+	uint64_t refs;	/* recent page faults */
+	uint64_t misses[MMU_MAX_FRAMES + 1];	/* faults with 0, 1, ... frames */
+} __attribute__((packed));
+
 struct mmu_proto_segv_req {
 	uint32_t type;
+	uint32_t id;
 	int32_t code;
+	uint32_t write;	/* 1 if the access was a write, 0 if a read or unknown */
 	uint64_t addr;
 } __attribute__((packed));
 struct mmu_proto_segv_rep {
 	uint32_t type;
+	uint32_t id;
 } __attribute__((packed));
 // segv causes remap and chprot to happen
 
 struct mmu_proto_remap_req {
 	uint32_t type;
+	uint32_t id;
 } __attribute__((packed));
 struct mmu_proto_remap_rep {
 	uint32_t type;
+	uint32_t id;
 	int32_t prot;
 	uint64_t offset;
 	uint64_t vaddr;
@@ -96,18 +290,34 @@ struct mmu_proto_remap_rep {
 
 struct mmu_proto_chprot_req {
 	uint32_t type;
+	uint32_t id;
 } __attribute__((packed));
 struct mmu_proto_chprot_rep {
 	uint32_t type;
+	uint32_t id;
 	int32_t prot;
 	uint64_t vaddr;
 } __attribute__((packed));
 
+struct mmu_proto_uffd_req {
+	uint32_t type;
+	uint32_t id;
+	uint64_t probe;
+} __attribute__((packed));
+struct mmu_proto_uffd_rep {
+	uint32_t type;
+	uint32_t id;
+	int32_t retcode;
+} __attribute__((packed));
+// userfaultfd file descriptor goes in SCM_RIGHTS ancillary data
+
 struct mmu_proto_exit_req {
 	uint32_t type;
+	uint32_t id;
 } __attribute__((packed));
 struct mmu_proto_exit_rep {
 	uint32_t type;
+	uint32_t id;
 } __attribute__((packed));
 
 #endif
@@ -0,0 +1,72 @@
+/* Decoder for binary MMU traces (see trace.h).  Prints the trace in
+ * the text format the MMU writes to stdout, so traces recorded by an
+ * MMU built with -DMMUTRACE can be compared with the `.mmu.out`
+ * files in mempager-tests.
+ *
+ * usage: mmutrace [-t] [TRACEFILE]
+ *
+ * With -t, every line is prefixed with the record timestamp in
+ * microseconds since the first record. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static int cmp_seq(const void *va, const void *vb)
+{
+	const struct trace_rec *a = va;
+	const struct trace_rec *b = vb;
+	return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+int main(int argc, char **argv)
+{
+	int timestamps = 0;
+	int opt;
+	while((opt = getopt(argc, argv, "t")) != -1) {
+		if(opt != 't') {
+			fprintf(stderr, "usage: %s [-t] [TRACEFILE]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		timestamps = 1;
+	}
+	const char *path = optind < argc ? argv[optind] : TRACE_DEFAULT_PATH;
+	FILE *file = fopen(path, "r");
+	if(!file) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	size_t n = 0, cap = 1024;
+	struct trace_rec *recs = malloc(cap * sizeof(*recs));
+	while(recs && fread(&recs[n], sizeof(*recs), 1, file) == 1) {
+		if(++n == cap) {
+			cap *= 2;
+			recs = realloc(recs, cap * sizeof(*recs));
+		}
+	}
+	if(!recs) {
+		perror("mmutrace");
+		exit(EXIT_FAILURE);
+	}
+	fclose(file);
+	qsort(recs, n, sizeof(*recs), cmp_seq);
+
+	char line[256];
+	int midline = 0;
+	for(size_t i = 0; i < n; ++i) {
+		int cnt = trace_format(line, sizeof(line), &recs[i]);
+		if(cnt < 0) cnt = trace_format_data(line, sizeof(line), &recs[i]);
+		if(cnt == 0) continue;	/* records that are never printed */
+		if(timestamps && !midline) {
+			printf("%12.3f ", (recs[i].ts - recs[0].ts) / 1e3);
+		}
+		fputs(line, stdout);
+		midline = recs[i].op == TRACE_SYSLOG_DATA;
+	}
+	free(recs);
+	return 0;
+}
@@ -3,12 +3,17 @@
 #include <sys/mman.h>
 
 #include <assert.h>
+#include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "lat.h"
+#include "lockprof.h"
 #include "mmu.h"
 
 /////////////////////////////////list////////////////////////////////////////
@@ -27,28 +32,100 @@ struct dlist *dlist_create(void);
 void dlist_destroy(struct dlist *dl, dlist_data_func);
 void *dlist_pop_right(struct dlist *dl);
 void *dlist_push_right(struct dlist *dl, void *data);
+void dlist_remove(struct dlist *dl, void *data);
 int dlist_empty(struct dlist *dl);
 
 /* gets the data at index =idx.  =idx can be negative. */
 void * dlist_get_index(const struct dlist *dl, int idx);
 ////////////////////////////list end///////////////////////////////////////////////
 
-typedef struct {
+//a page of a shared region is a backing page, which holds the frame
+//and block, plus one entry in the page table of each process that
+//attaches it. entries have `shared` set; their `isvalid` tells whether
+//the page is mapped in that process, and other fields are unused
+typedef struct Page {
     int isvalid;
+    int busy; //page contents are in transit between a frame and the disk
     int frame_number;
     int block_number;
     int dirty; //when the page is dirty, it must to be wrote on the disk before swaping it
+    int released; //given back with pager_release, no frame nor block
+    int advice; //UVM_ADV_* from pager_advise
     intptr_t vaddr;
+    pid_t pid; //process of an entry attaching a shared page
+    struct Page *shared; //backing page of an entry, NULL for private pages
+    struct dlist *mappers; //entries attaching a backing page (reverse map)
+    struct Region *region; //region of a backing page
+    struct MappedFile *file; //file the page starts with, NULL for zero fill
+    off_t file_offset;
 } Page;
 
+//a file given to pager_map_file. pages of a writeback mapping have no
+//block: the file holds them while they are paged out
+typedef struct MappedFile {
+    int fd;
+    int writeback;
+    int npages; //pages still using it, fd is closed when none is left
+} MappedFile;
+
+typedef struct Region {
+    char name[UVM_SHARE_NAME_MAX];
+    int npages;
+    int nlive; //backing pages not freed yet
+    int listed; //in `regions`, where pager_attach finds it by name
+    Page **pages;
+} Region;
+
 typedef struct {
     pid_t pid;
     struct dlist *pages;
+    int npinned; //pages pinned or being pinned, up to the quota
+    int nresident; //frames owned by the process
+    int min_frames; //not taken by other processes below this, 0 if none
+    int rss_min; //minimum set by pager_set_rss, partitions keep at least this
+    int max_frames; //replaces its own pages at this size, 0 if no limit
+    unsigned long steals; //frames taken from other processes
+    unsigned long stolen; //frames other processes took
+    int suspended; //faults wait, see load_control
+    int suspending; //suspend_process writing its pages, destroy waits
+    int destroying; //pager_destroy running, load control leaves it alone
+    int window_faults; //faults in the current load control window
+    struct Mrc *mrc; //sampled miss-ratio curve
 } PageTable;
 
+//miss-ratio curve of a process, estimated SHARDS style: only pages
+//whose address hashes below 1/MRC_SAMPLE_DIV of the hash range are
+//tracked, in an LRU stack that also keeps pages no longer in memory
+//(ghost entries). a fault on a tracked page at depth d means about
+//d * MRC_SAMPLE_DIV other pages were touched since its last fault, so
+//it would have hit with more frames than that. hist[k] counts faults
+//that need k frames to hit, hist[nframes + 1] the ones no memory size
+//avoids (stack overflow); cold counts first touches
+#define MRC_SAMPLE_DIV 4
+#define MRC_STACK 1024
+typedef struct Mrc {
+    intptr_t stack[MRC_STACK]; //tracked pages, most recent first
+    int depth;
+    unsigned long *hist;
+    unsigned long cold;
+    unsigned long refs; //sampled faults
+} Mrc;
+
+//every MRC_PERIOD faults curves are aged (halved) so they follow the
+//current behavior and, with pager_set_partition, frames are split
+#define MRC_PERIOD 1024
+struct {
+    int partition;
+    int faults;
+    int changed; //a curve got a sample since frames were last split
+} mrc_state;
+
 typedef struct {
     pid_t pid;
+    PageTable *owner; //page table of pid, so scans need not look it up
     int accessed; //to be used by second change algorithm
+    int busy; //frame is being filled or written back, cannot be evicted
+    int pinned; //never evicted, skipped by the clock hand
     Page *page;
 } FrameNode;
 
@@ -57,6 +134,10 @@ typedef struct {
     int page_size;
     int sec_chance_index;
     FrameNode *frames;
+    int npinned; //frames pinned or being pinned by all processes
+    int *clock_next; //next frame after each one that is not pinned
+    int nclock; //frames not pinned, the ones the clock visits
+    int ncold; //resident pages advised UVM_ADV_COLD
 } FrameTable;
 
 typedef struct {
@@ -72,6 +153,22 @@ typedef struct {
 FrameTable frame_table;
 BlockTable block_table;
 struct dlist *page_tables;
+struct dlist *regions;
+
+//load control (pager_set_load_control). time is split in windows of
+//LOAD_WINDOW_MS; when faults page out more than all frames in a
+//window, the process that faulted the most is suspended: its pages go
+//to disk and its faults wait. once a window pages out less than
+//nframes / LOAD_RESUME_DIV frames, the oldest suspended one resumes
+#define LOAD_WINDOW_MS 100
+#define LOAD_RESUME_DIV 4
+struct {
+    int enabled;
+    struct timespec window_start;
+    int window_evictions;
+    struct dlist *suspended; //page tables, oldest first
+    pthread_cond_t resume_cond;
+} load;
 
 /****************************************************************************
  * external functions
@@ -79,11 +176,59 @@ struct dlist *page_tables;
 int get_new_frame();
 int get_new_block();
 PageTable* find_page_table(pid_t pid);
+PageTable* lookup_page_table(pid_t pid);
 Page* get_page(PageTable *pt, intptr_t vaddr); 
+int disk_io(int write, int frame_no, int block_no);
+void file_io(int write, int frame_no, Page *page);
+void fault(pid_t pid, void *vaddr, int write);
+int page_in(pid_t pid, Page *page, int write);
+void release_page(PageTable *pt, Page *page);
+void unpin_page(PageTable *pt, Page *page);
+int is_pinned(Page *page);
+void rebuild_clock();
+int clock_scan(PageTable *pt, int victims);
+int is_victim(int frame_no, PageTable *pt, int victims);
+int fair_share();
+int at_max(PageTable *pt);
+void set_frame_owner(int frame_no, pid_t pid);
+void set_advice(Page *page, int advice);
+void load_control(PageTable *pt);
+void load_window();
+void suspend_process(PageTable *pt);
+void resume_process(PageTable *pt);
+void mrc_sample(PageTable *pt, intptr_t vaddr);
+unsigned long mrc_misses(Mrc *mrc, int nframes);
+void mrc_period();
+void partition_frames();
+void evict_frame(int frame_no);
+void reclaim_page(Page *page);
+void read_ahead(pid_t pid, PageTable *pt, Page *page);
+int syslog_span(pid_t pid, PageTable *pt, void *addr, size_t len);
+Page* backing(Page *page);
+void map_shared(pid_t pid, Page *page, int write);
+void unmap_frame(int frame_no);
+void chprot_frame(int frame_no, int prot);
+void *attach_region(PageTable *pt, pid_t pid, Region *region);
+void detach_page(PageTable *pt, Page *page);
+Region* find_region(const char *name);
 pthread_mutex_t locker;
+pthread_cond_t busy_cond = PTHREAD_COND_INITIALIZER;
+
+//pages brought in after a fault on a UVM_ADV_SEQUENTIAL page
+#define READAHEAD 4
+
+//a process may pin up to nframes / PIN_QUOTA_DIV frames (at least
+//one), and one frame always stays unpinned for faults
+#define PIN_QUOTA_DIV 4
+
+//frames clock_scan may choose, see second_chance
+#define VICTIM_OWN 0
+#define VICTIM_OVER_SHARE 1
+#define VICTIM_OVER_MIN 2
+#define VICTIM_ANY 3
 
 void pager_init(int nframes, int nblocks) {
-    pthread_mutex_lock(&locker);
+    lock_acquire(&locker);
     frame_table.nframes = nframes;
     frame_table.page_size = sysconf(_SC_PAGESIZE);
     frame_table.sec_chance_index = 0;
@@ -91,167 +236,1244 @@ void pager_init(int nframes, int nblocks) {
     frame_table.frames = malloc(nframes * sizeof(FrameNode));
     for(int i = 0; i < nframes; i++) {
         frame_table.frames[i].pid = -1;
+        frame_table.frames[i].owner = NULL;
+        frame_table.frames[i].busy = 0;
+        frame_table.frames[i].pinned = 0;
     }
+    frame_table.npinned = 0;
+    frame_table.ncold = 0;
+    frame_table.clock_next = malloc(nframes * sizeof(int));
+    rebuild_clock();
 
     block_table.nblocks = nblocks;
     block_table.blocks = malloc(nblocks * sizeof(BlockNode));
     for(int i = 0; i < nblocks; i++) {
         block_table.blocks[i].used = 0;
+        block_table.blocks[i].page = NULL;
     }
     page_tables = dlist_create();
-    pthread_mutex_unlock(&locker);
+    regions = dlist_create();
+    load.enabled = 0;
+    load.suspended = dlist_create();
+    mrc_state.partition = 0;
+    mrc_state.faults = 0;
+    mrc_state.changed = 0;
+    pthread_cond_init(&load.resume_cond, NULL);
+    lock_release(&locker);
 }
 
 void pager_create(pid_t pid) {
-    pthread_mutex_lock(&locker);
+    lock_acquire(&locker);
     PageTable *pt = (PageTable*) malloc(sizeof(PageTable));
     pt->pid = pid;
     pt->pages = dlist_create();
+    pt->npinned = 0;
+    pt->nresident = 0;
+    pt->min_frames = 0;
+    pt->rss_min = 0;
+    pt->max_frames = 0;
+    pt->steals = 0;
+    pt->stolen = 0;
+    pt->suspended = 0;
+    pt->suspending = 0;
+    pt->destroying = 0;
+    pt->window_faults = 0;
+    pt->mrc = calloc(1, sizeof(Mrc));
+    pt->mrc->hist = calloc(frame_table.nframes + 2, sizeof(unsigned long));
 
     dlist_push_right(page_tables, pt);
-    pthread_mutex_unlock(&locker);
+    lock_release(&locker);
 }
 
 void *pager_extend(pid_t pid) {
-    pthread_mutex_lock(&locker);
+    lock_acquire(&locker);
     int block_no = get_new_block();
 
     //there is no blocks available anymore
     if(block_no == -1) {
-        pthread_mutex_unlock(&locker);
+        lock_release(&locker);
         return NULL;
     }
 
     PageTable *pt = find_page_table(pid); 
-    Page *page = (Page*) malloc(sizeof(Page));
+    //fill holes left by pager_release before growing
+    Page *page = NULL;
+    for(struct dnode *node = pt->pages->head; node; node = node->next) {
+        Page *hole = node->data;
+        if(hole->released) {
+            page = hole;
+            break;
+        }
+    }
+    if(page == NULL) {
+        intptr_t vaddr = UVM_BASEADDR + pt->pages->count * frame_table.page_size;
+        //the address space is full
+        if(vaddr + frame_table.page_size - 1 > UVM_MAXADDR) {
+            lock_release(&locker);
+            return NULL;
+        }
+        page = (Page*) malloc(sizeof(Page));
+        page->vaddr = vaddr;
+        dlist_push_right(pt->pages, page);
+    }
     page->isvalid = 0;
-    page->vaddr = UVM_BASEADDR + pt->pages->count * frame_table.page_size;
+    page->busy = 0;
+    page->released = 0;
+    page->advice = UVM_ADV_NORMAL;
     page->block_number = block_no;
-    dlist_push_right(pt->pages, page);
+    page->shared = NULL;
+    page->mappers = NULL;
+    page->file = NULL;
 
     block_table.blocks[block_no].page = page;
 
-    pthread_mutex_unlock(&locker);
+    lock_release(&locker);
     return (void*)page->vaddr;
 }
 
-int second_chance() {
+//picks a frame for process `pid` when all are in use. processes over
+//their fair share of the frames give one up first; a process that has
+//its share replaces its own pages; then any process above its minimum
+//(or `pid` itself) gives one up, then anyone. returns -1 when every
+//frame is busy with disk I/O
+int second_chance(pid_t pid) {
+    uint64_t start = lat_now();
+    PageTable *pt = find_page_table(pid);
+    int frame_no = clock_scan(pt, VICTIM_OVER_SHARE);
+    //below its minimum a process grows past its share
+    if(frame_no == -1 && pt->nresident >= fair_share() && pt->nresident >= pt->min_frames) {
+        frame_no = clock_scan(pt, VICTIM_OWN);
+    }
+    if(frame_no == -1) frame_no = clock_scan(pt, VICTIM_OVER_MIN);
+    if(frame_no == -1) frame_no = clock_scan(pt, VICTIM_ANY);
+    lat_since(LAT_VICTIM, start);
+    return frame_no;
+}
+
+//runs the clock over the frames is_victim accepts. the hand only moves
+//when a frame is found, so scans finding nothing change nothing
+int clock_scan(PageTable *pt, int victims) {
     FrameNode *frames = frame_table.frames;
-    int frame_to_swap = -1;
+    if(frame_table.nclock == 0) return -1;
+    int start = frame_table.sec_chance_index;
+    if(frames[start].pinned) start = frame_table.clock_next[start];
+
+    //pages advised cold go first, in clock order
+    int index = start;
+    for(int i = 0; frame_table.ncold > 0 && i < frame_table.nclock; i++) {
+        if(!frames[index].busy && is_victim(index, pt, victims) &&
+                frames[index].page->advice == UVM_ADV_COLD) {
+            frame_table.sec_chance_index = frame_table.clock_next[index];
+            return index;
+        }
+        index = frame_table.clock_next[index];
+    }
 
-    while(frame_to_swap == -1) {
-        int index = frame_table.sec_chance_index;
-        if(frames[index].accessed == 0) {
-            frame_to_swap = index;
+    index = start;
+    for(int scanned = 0; scanned < 2 * frame_table.nclock; scanned++) {
+        if(frames[index].busy || !is_victim(index, pt, victims)) {
+            //skip, frames in transit will be reused by their owners
+        } else if(frames[index].accessed == 0) {
+            frame_table.sec_chance_index = frame_table.clock_next[index];
+            return index;
         } else {
             frames[index].accessed = 0;
         }
-        frame_table.sec_chance_index = (index + 1) % frame_table.nframes;
+        index = frame_table.clock_next[index];
     }
+    return -1;
+}
 
-    return frame_to_swap;
+int is_victim(int frame_no, PageTable *pt, int victims) {
+    //free frames show up when a process at its maximum scans its own
+    if(frame_table.frames[frame_no].pid == -1) return 0;
+    PageTable *owner = frame_table.frames[frame_no].owner;
+    switch(victims) {
+    case VICTIM_OWN:
+        return owner == pt;
+    case VICTIM_OVER_SHARE:
+        return owner->nresident > fair_share() && owner->nresident > owner->min_frames;
+    case VICTIM_OVER_MIN:
+        return owner == pt || owner->nresident > owner->min_frames;
+    default:
+        return 1;
+    }
 }
 
 void swap_out_page(int frame_no) {
+    load.window_evictions++;
     //gambis: I do not know why I have to set PROT_NONE to all pages
     //when I am swapping the first one. Must investigate
     if(frame_no == 0) {
         for(int i = 0; i < frame_table.nframes; i++) {
-            Page *page = frame_table.frames[i].page;
-            mmu_chprot(frame_table.frames[i].pid, (void*)page->vaddr, PROT_NONE);
+            if(frame_table.frames[i].busy || frame_table.frames[i].pinned) continue;
+            //free frames are left when a process stays under its maximum
+            if(frame_table.frames[i].pid == -1) continue;
+            chprot_frame(i, PROT_NONE);
         }
     }
+    evict_frame(frame_no);
+}
 
+//unmaps the page in frame_no and writes it to disk if dirty. the
+//frame is left busy for the caller to reuse or free
+void evict_frame(int frame_no) {
     FrameNode *frame = &frame_table.frames[frame_no];
     Page *removed_page = frame->page;
+    frame->busy = 1;
+    unmap_frame(frame_no);
     removed_page->isvalid = 0;
-    mmu_nonresident(frame->pid, (void*)removed_page->vaddr); 
+    if(removed_page->advice == UVM_ADV_COLD) frame_table.ncold--;
     
+    //clean file pages are read from the file again
     if(removed_page->dirty == 1) {
-        block_table.blocks[removed_page->block_number].used = 1;
-        mmu_disk_write(frame_no, removed_page->block_number);
+        removed_page->busy = 1;
+        if(removed_page->file && removed_page->file->writeback) {
+            file_io(1, frame_no, removed_page);
+        } else {
+            block_table.blocks[removed_page->block_number].used = 1;
+            if(disk_io(1, frame_no, removed_page->block_number)) {
+                //the page is lost. its process goes away, and reads it
+                //as zeroes until then
+                block_table.blocks[removed_page->block_number].used = 0;
+                mmu_kill(frame->pid);
+            }
+        }
+        removed_page->busy = 0;
+        pthread_cond_broadcast(&busy_cond);
     }
 }
 
 void pager_fault(pid_t pid, void *vaddr) {
-    pthread_mutex_lock(&locker);
+    fault(pid, vaddr, 0);
+}
+
+void pager_write_fault(pid_t pid, void *vaddr) {
+    fault(pid, vaddr, 1);
+}
+
+void fault(pid_t pid, void *vaddr, int write) {
+    uint64_t start = lat_now();
+    lock_acquire(&locker);
+    lat_since(LAT_LOCK, start);
     PageTable *pt = find_page_table(pid); 
+    if(load.enabled) load_control(pt);
     vaddr = (void*)((intptr_t)vaddr - (intptr_t)vaddr % frame_table.page_size);
-    Page *page = get_page(pt, (intptr_t)vaddr); 
+    mrc_sample(pt, (intptr_t)vaddr);
+    if(++mrc_state.faults == MRC_PERIOD) mrc_period();
+    Page *page;
+
+    //another fault is bringing this page in or writing it out
+    while((page = get_page(pt, (intptr_t)vaddr)) != NULL && backing(page)->busy) {
+        lock_wait(&busy_cond, &locker);
+    }
+
+    //released by another thread of the process, which will see it
+    //is gone when it faults again
+    if(page == NULL) {
+        lock_release(&locker);
+        return;
+    }
+
+    //an access makes a cold page normal again
+    Page *b = backing(page);
+    if(b->advice == UVM_ADV_COLD) set_advice(b, UVM_ADV_NORMAL);
 
     if(page->isvalid == 1) {
         mmu_chprot(pid, vaddr, PROT_READ | PROT_WRITE);
-        frame_table.frames[page->frame_number].accessed = 1;
-        page->dirty = 1;
+        frame_table.frames[b->frame_number].accessed = 1;
+        b->dirty = 1;
+    } else if(b->isvalid == 1) {
+        //shared page brought in by another process
+        map_shared(pid, page, write);
     } else {
-        int frame_no = get_new_frame();
+        if(page_in(pid, page, write) == 0 && b->advice == UVM_ADV_SEQUENTIAL && !page->shared) {
+            read_ahead(pid, pt, page);
+        }
+    }
+    lock_release(&locker);
+}
+
+//called with locker held and the page not busy. for a shared page,
+//`page` is the entry of process `pid`, where the page gets mapped.
+//returns -1 if the page could not be read, and the process is killed
+int page_in(pid_t pid, Page *page, int write) {
+    Page *entry = page;
+    page = backing(page);
+    page->busy = 1;
+    int frame_no;
 
-        //there is no frames available
-        if(frame_no == -1) {
-            frame_no = second_chance();
-            swap_out_page(frame_no);
+    //a process at its maximum replaces its own pages if it can.
+    //otherwise, there is no frames available. frames may be freed
+    //while we wait
+    uint64_t start = lat_now();
+    if(at_max(find_page_table(pid)) &&
+            (frame_no = clock_scan(find_page_table(pid), VICTIM_OWN)) != -1) {
+        lat_since(LAT_VICTIM, start);
+        swap_out_page(frame_no);
+    } else {
+        while((frame_no = get_new_frame()) == -1) {
+            if((frame_no = second_chance(pid)) != -1) {
+                swap_out_page(frame_no);
+                break;
+            }
+            lock_wait(&busy_cond, &locker);
         }
+    }
 
-        FrameNode *frame = &frame_table.frames[frame_no];
-        frame->pid = pid;
-        frame->page = page;
-        frame->accessed = 1;
+    FrameNode *frame = &frame_table.frames[frame_no];
+    if(frame->pid != -1 && frame->pid != pid) {
+        find_page_table(pid)->steals++;
+        find_page_table(frame->pid)->stolen++;
+    }
+    set_frame_owner(frame_no, pid);
+    frame->page = page;
+    frame->accessed = 1;
+    frame->busy = 1;
 
-        page->isvalid = 1;
-        page->frame_number = frame_no;
-        page->dirty = 0;
+    page->frame_number = frame_no;
+    page->dirty = write;
 
-        //this page was already swapped out from main memory
-        if(block_table.blocks[page->block_number].used == 1) {
-            mmu_disk_read(page->block_number, frame_no);
-        } else {
-            mmu_zero_fill(frame_no);
+    //this page was already swapped out from main memory
+    if(page->block_number != -1 && block_table.blocks[page->block_number].used == 1) {
+        if(disk_io(0, frame_no, page->block_number)) {
+            frame->busy = 0;
+            set_frame_owner(frame_no, -1);
+            frame->page = NULL;
+            frame->accessed = 0;
+            mmu_frame_release(frame_no);
+            page->busy = 0;
+            pthread_cond_broadcast(&busy_cond);
+            mmu_kill(pid);
+            return -1;
         }
-        mmu_resident(pid, vaddr, frame_no, PROT_READ);
+    } else if(page->file) {
+        file_io(0, frame_no, page);
+    } else {
+        mmu_zero_fill(frame_no);
     }
-    pthread_mutex_unlock(&locker);
+    page->isvalid = 1;
+    entry->isvalid = 1;
+    if(page->advice == UVM_ADV_COLD) frame_table.ncold++;
+    //a write fault would just fault again on a read-only page
+    mmu_resident(pid, (void*)entry->vaddr, frame_no, write ? PROT_READ | PROT_WRITE : PROT_READ);
+
+    page->busy = 0;
+    frame->busy = 0;
+    pthread_cond_broadcast(&busy_cond);
+    return 0;
 }
 
 int pager_syslog(pid_t pid, void *addr, size_t len) {
-    pthread_mutex_lock(&locker);
+    lock_acquire(&locker);
     PageTable *pt = find_page_table(pid); 
-    char *buf = (char*) malloc(len + 1);
+    int ret = syslog_span(pid, pt, addr, len);
+    lock_release(&locker);
+    return ret;
+}
 
-    for (size_t i = 0, m = 0; i < len; i++) {
-        Page *page = get_page(pt, (intptr_t)addr + i);
+int pager_syslogv(pid_t pid, const struct iovec *iov, int iovcnt) {
+    lock_acquire(&locker);
+    PageTable *pt = find_page_table(pid); 
+    int i;
+    for(i = 0; i < iovcnt; i++) {
+        if(syslog_span(pid, pt, iov[i].iov_base, iov[i].iov_len) == -1) break;
+    }
+    lock_release(&locker);
+    return i;
+}
 
-        //string out of process allocated space
+//called with locker held. copies the string one page at a time,
+//bringing in pages that are not resident like a read fault would
+int syslog_span(pid_t pid, PageTable *pt, void *addr, size_t len) {
+    if(len == 0) return 0;
+    intptr_t start = (intptr_t)addr;
+    intptr_t first = start - start % frame_table.page_size;
+
+    //string out of process allocated space
+    for(intptr_t vaddr = first; vaddr < start + (intptr_t)len; vaddr += frame_table.page_size) {
+        if(get_page(pt, vaddr) == NULL) return -1;
+    }
+
+    char *buf = (char*) malloc(len);
+    size_t copied = 0;
+    while(copied < len) {
+        intptr_t vaddr = start + copied;
+        size_t offset = vaddr % frame_table.page_size;
+        size_t n = frame_table.page_size - offset;
+        if(n > len - copied) n = len - copied;
+
+        Page *page;
+        while((page = get_page(pt, vaddr)) != NULL && backing(page)->busy) {
+            lock_wait(&busy_cond, &locker);
+        }
+        //released while we waited
         if(page == NULL) {
-            pthread_mutex_unlock(&locker);
+            free(buf);
+            return -1;
+        }
+        if(backing(page)->isvalid == 0) {
+            if(page_in(pid, page, 0)) {
+                free(buf);
+                return -1;
+            }
+            continue; //locker may have been released, check again
+        }
+        int frame_no = backing(page)->frame_number;
+        frame_table.frames[frame_no].accessed = 1;
+        memcpy(buf + copied, pmem + frame_no * frame_table.page_size + offset, n);
+        copied += n;
+    }
+    mmu_syslog_print(buf, len);
+    free(buf);
+    return 0;
+}
+
+int pager_release(pid_t pid, void *vaddr, int npages) {
+    lock_acquire(&locker);
+    PageTable *pt = find_page_table(pid); 
+    intptr_t start = (intptr_t)vaddr;
+
+    //every page must be allocated before we touch any
+    if(npages <= 0 || start % frame_table.page_size != 0) {
+        lock_release(&locker);
+        return -1;
+    }
+    for(int i = 0; i < npages; i++) {
+        if(get_page(pt, start + i * frame_table.page_size) == NULL) {
+            lock_release(&locker);
+            return -1;
+        }
+    }
+
+    for(int i = 0; i < npages; i++) {
+        intptr_t addr = start + i * frame_table.page_size;
+        Page *page;
+        while((page = get_page(pt, addr)) != NULL && backing(page)->busy) {
+            lock_wait(&busy_cond, &locker);
+        }
+        //another thread of the process released it while we waited
+        if(page == NULL) continue;
+        if(page->isvalid == 1) mmu_nonresident(pid, (void*)page->vaddr);
+        release_page(pt, page);
+    }
+    rebuild_clock();
+
+    //released pages at the top are handed out again by pager_extend
+    while(!dlist_empty(pt->pages)) {
+        Page *page = dlist_get_index(pt->pages, -1);
+        if(!page->released) break;
+        free(dlist_pop_right(pt->pages));
+    }
+    lock_release(&locker);
+    return 0;
+}
+
+int pager_advise(pid_t pid, void *vaddr, int npages, int advice) {
+    lock_acquire(&locker);
+    PageTable *pt = find_page_table(pid); 
+    intptr_t start = (intptr_t)vaddr;
+
+    if(npages <= 0 || start % frame_table.page_size != 0 ||
+            advice < UVM_ADV_NORMAL || advice > UVM_ADV_COLD) {
+        lock_release(&locker);
+        return -1;
+    }
+    for(int i = 0; i < npages; i++) {
+        if(get_page(pt, start + i * frame_table.page_size) == NULL) {
+            lock_release(&locker);
             return -1;
         }
+    }
+
+    //bringing in more pages than fit would evict the first ones
+    int budget = frame_table.nframes;
+    for(int i = 0; i < npages; i++) {
+        intptr_t addr = start + i * frame_table.page_size;
+        Page *page;
+        while((page = get_page(pt, addr)) != NULL && backing(page)->busy) {
+            lock_wait(&busy_cond, &locker);
+        }
+        //released by another thread of the process
+        if(page == NULL) continue;
+
+        //advice on a shared page applies to every process attaching it
+        Page *b = backing(page);
+        switch(advice) {
+        case UVM_ADV_WILLNEED:
+            if(b->isvalid == 0 && budget-- > 0) page_in(pid, page, 0);
+            break;
+        case UVM_ADV_DONTNEED:
+            if(b->isvalid == 1 && !is_pinned(b)) reclaim_page(b);
+            break;
+        case UVM_ADV_COLD:
+            if(b->isvalid == 1) frame_table.frames[b->frame_number].accessed = 0;
+            set_advice(b, advice);
+            break;
+        default:
+            set_advice(b, advice);
+            break;
+        }
+    }
+    lock_release(&locker);
+    return 0;
+}
+
+int pager_pin(pid_t pid, void *vaddr, int npages, int pin) {
+    lock_acquire(&locker);
+    PageTable *pt = find_page_table(pid); 
+    intptr_t start = (intptr_t)vaddr;
+
+    if(npages <= 0 || start % frame_table.page_size != 0) {
+        lock_release(&locker);
+        errno = EINVAL;
+        return -1;
+    }
+    int topin = 0;
+    for(int i = 0; i < npages; i++) {
+        Page *page = get_page(pt, start + i * frame_table.page_size);
+        //shared pages cannot be pinned
+        if(page == NULL || page->shared) {
+            lock_release(&locker);
+            errno = EINVAL;
+            return -1;
+        }
+        if(!is_pinned(page)) topin++;
+    }
+
+    if(!pin) {
+        for(int i = 0; i < npages; i++) {
+            Page *page = get_page(pt, start + i * frame_table.page_size);
+            if(is_pinned(page)) unpin_page(pt, page);
+        }
+        rebuild_clock();
+        lock_release(&locker);
+        return 0;
+    }
+
+    int quota = frame_table.nframes / PIN_QUOTA_DIV;
+    if(quota < 1) quota = 1;
+    if(pt->npinned + topin > quota || frame_table.npinned + topin > frame_table.nframes - 1) {
+        lock_release(&locker);
+        errno = ENOMEM;
+        return -1;
+    }
+    //reserved now, so other processes cannot take the frames while we
+    //wait for pages to come in
+    pt->npinned += topin;
+    frame_table.npinned += topin;
+
+    for(int i = 0; i < npages; i++) {
+        intptr_t addr = start + i * frame_table.page_size;
+        Page *page;
+        while((page = get_page(pt, addr)) != NULL && page->busy) {
+            lock_wait(&busy_cond, &locker);
+        }
+        //released by another thread of the process
+        if(page == NULL || is_pinned(page)) continue;
+        if(page->isvalid == 0 && page_in(pid, page, 0)) continue;
+        frame_table.frames[page->frame_number].pinned = 1;
+        rebuild_clock();
+        topin--;
+    }
+    pt->npinned -= topin;
+    frame_table.npinned -= topin;
+    lock_release(&locker);
+    return 0;
+}
+
+void *pager_share(pid_t pid, const char *name, int npages) {
+    lock_acquire(&locker);
+    PageTable *pt = find_page_table(pid); 
+
+    if(npages <= 0 || name[0] == '\0') {
+        lock_release(&locker);
+        errno = EINVAL;
+        return NULL;
+    }
+    if(find_region(name) != NULL) {
+        lock_release(&locker);
+        errno = EEXIST;
+        return NULL;
+    }
+    int nfree = 0;
+    for(int i = 0; i < block_table.nblocks && nfree < npages; i++) {
+        if(block_table.blocks[i].page == NULL) nfree++;
+    }
+    intptr_t end = UVM_BASEADDR + (pt->pages->count + npages) * frame_table.page_size;
+    if(nfree < npages || end - 1 > UVM_MAXADDR) {
+        lock_release(&locker);
+        errno = ENOSPC;
+        return NULL;
+    }
+
+    Region *region = (Region*) malloc(sizeof(Region));
+    strcpy(region->name, name);
+    region->npages = npages;
+    region->nlive = npages;
+    region->listed = 1;
+    region->pages = (Page**) malloc(npages * sizeof(Page*));
+    for(int i = 0; i < npages; i++) {
+        Page *page = (Page*) malloc(sizeof(Page));
+        page->isvalid = 0;
+        page->busy = 0;
+        page->released = 0;
+        page->advice = UVM_ADV_NORMAL;
+        page->vaddr = 0; //mapped at a different address in each process
+        page->block_number = get_new_block();
+        page->shared = NULL;
+        page->mappers = dlist_create();
+        page->region = region;
+        page->file = NULL;
+        block_table.blocks[page->block_number].page = page;
+        region->pages[i] = page;
+    }
+    dlist_push_right(regions, region);
+
+    void *vaddr = attach_region(pt, pid, region);
+    lock_release(&locker);
+    return vaddr;
+}
+
+void *pager_attach(pid_t pid, const char *name, int *npages) {
+    lock_acquire(&locker);
+    PageTable *pt = find_page_table(pid); 
+
+    Region *region = find_region(name);
+    if(region == NULL) {
+        lock_release(&locker);
+        errno = ENOENT;
+        return NULL;
+    }
+    intptr_t end = UVM_BASEADDR + (pt->pages->count + region->npages) * frame_table.page_size;
+    if(end - 1 > UVM_MAXADDR) {
+        lock_release(&locker);
+        errno = ENOSPC;
+        return NULL;
+    }
+    *npages = region->npages;
+    void *vaddr = attach_region(pt, pid, region);
+    lock_release(&locker);
+    return vaddr;
+}
+
+void *pager_map_file(pid_t pid, int fd, off_t offset, int npages, int flags) {
+    lock_acquire(&locker);
+    PageTable *pt = find_page_table(pid); 
+
+    if(npages <= 0 || offset < 0 || offset % frame_table.page_size != 0 ||
+            (flags != UVM_MAP_PRIVATE && flags != UVM_MAP_WRITEBACK)) {
+        lock_release(&locker);
+        errno = EINVAL;
+        return NULL;
+    }
+    int writeback = flags == UVM_MAP_WRITEBACK;
+    //writeback pages are paged out to the file, private ones need blocks
+    int nfree = 0;
+    for(int i = 0; i < block_table.nblocks && nfree < npages && !writeback; i++) {
+        if(block_table.blocks[i].page == NULL) nfree++;
+    }
+    intptr_t end = UVM_BASEADDR + (pt->pages->count + npages) * frame_table.page_size;
+    if((!writeback && nfree < npages) || end - 1 > UVM_MAXADDR) {
+        lock_release(&locker);
+        errno = ENOSPC;
+        return NULL;
+    }
+
+    MappedFile *file = (MappedFile*) malloc(sizeof(MappedFile));
+    file->fd = fd;
+    file->writeback = writeback;
+    file->npages = npages;
+    intptr_t start = UVM_BASEADDR + pt->pages->count * frame_table.page_size;
+    for(int i = 0; i < npages; i++) {
+        Page *page = (Page*) malloc(sizeof(Page));
+        page->isvalid = 0;
+        page->busy = 0;
+        page->released = 0;
+        page->advice = UVM_ADV_NORMAL;
+        page->vaddr = start + i * frame_table.page_size;
+        page->block_number = writeback ? -1 : get_new_block();
+        page->shared = NULL;
+        page->mappers = NULL;
+        page->file = file;
+        page->file_offset = offset + (off_t)i * frame_table.page_size;
+        if(!writeback) block_table.blocks[page->block_number].page = page;
+        dlist_push_right(pt->pages, page);
+    }
+    lock_release(&locker);
+    return (void*)start;
+}
+
+int pager_set_rss(pid_t pid, int min, int max) {
+    lock_acquire(&locker);
+    PageTable *pt = lookup_page_table(pid);
+    if(pt == NULL) {
+        lock_release(&locker);
+        errno = ESRCH;
+        return -1;
+    }
+    if(min < 0 || max < 0 || (max > 0 && min > max)) {
+        lock_release(&locker);
+        errno = EINVAL;
+        return -1;
+    }
+    //like pins, minimums leave one frame for everyone else
+    int reserved = min;
+    for(int i = 0; i < page_tables->count; i++) {
+        PageTable *other = dlist_get_index(page_tables, i);
+        if(other != pt) reserved += other->rss_min;
+    }
+    if(reserved > frame_table.nframes - 1) {
+        lock_release(&locker);
+        errno = ENOMEM;
+        return -1;
+    }
+    pt->min_frames = min;
+    pt->rss_min = min;
+    pt->max_frames = max;
+    lock_release(&locker);
+    return 0;
+}
+
+int pager_get_rss(pid_t pid, struct pager_rss *rss) {
+    lock_acquire(&locker);
+    PageTable *pt = lookup_page_table(pid);
+    if(pt == NULL) {
+        lock_release(&locker);
+        errno = ESRCH;
+        return -1;
+    }
+    rss->resident = pt->nresident;
+    rss->min = pt->rss_min;
+    rss->max = pt->max_frames;
+    rss->steals = pt->steals;
+    rss->stolen = pt->stolen;
+    rss->suspended = pt->suspended;
+    lock_release(&locker);
+    return 0;
+}
 
-        buf[m++] = pmem[page->frame_number * frame_table.page_size + i];
+int pager_get_mrc(pid_t pid, struct pager_mrc *curve) {
+    lock_acquire(&locker);
+    PageTable *pt = lookup_page_table(pid);
+    if(pt == NULL) {
+        lock_release(&locker);
+        errno = ESRCH;
+        return -1;
     }
-    for(int i = 0; i < len; i++) { // len é o número de bytes a imprimir
-        printf("%02x", (unsigned)buf[i]); // buf contém os dados a serem impressos
+    curve->refs = pt->mrc->refs * MRC_SAMPLE_DIV;
+    curve->npoints = frame_table.nframes + 1;
+    for(int c = 0; c < curve->npoints; c++) {
+        curve->misses[c] = mrc_misses(pt->mrc, c) * MRC_SAMPLE_DIV;
     }
-    if(len > 0) printf("\n");
-    pthread_mutex_unlock(&locker);
+    lock_release(&locker);
     return 0;
 }
 
+void pager_set_partition(int enable) {
+    lock_acquire(&locker);
+    mrc_state.partition = enable;
+    lock_release(&locker);
+}
+
+void pager_set_load_control(int enable) {
+    lock_acquire(&locker);
+    load.enabled = enable;
+    clock_gettime(CLOCK_MONOTONIC, &load.window_start);
+    load.window_evictions = 0;
+    while(!dlist_empty(load.suspended)) resume_process(dlist_get_index(load.suspended, 0));
+    lock_release(&locker);
+}
+
 void pager_destroy(pid_t pid) {
-    pthread_mutex_lock(&locker);
+    lock_acquire(&locker);
     PageTable *pt = find_page_table(pid); 
+    //waits below and release_page let go of locker
+    pt->destroying = 1;
+    while(pt->suspending) lock_wait(&busy_cond, &locker);
+    if(pt->suspended) resume_process(pt);
 
     while(!dlist_empty(pt->pages)) {
         Page *page = dlist_pop_right(pt->pages);
-        block_table.blocks[page->block_number].page = NULL;
-        if(page->isvalid == 1) {
-            frame_table.frames[page->frame_number].pid = -1;
-        }
+        while(backing(page)->busy) lock_wait(&busy_cond, &locker);
+        if(!page->released) release_page(pt, page);
+        free(page);
     }
+    rebuild_clock();
     dlist_destroy(pt->pages, NULL);
-    pthread_mutex_unlock(&locker);
+    dlist_remove(page_tables, pt);
+    free(pt->mrc->hist);
+    free(pt->mrc);
+    free(pt);
+    lock_release(&locker);
 }
 
 /////////////////Auxiliar functions ////////////////////////////////
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int done;
+    int err;
+} DiskRequest;
+
+void disk_io_done(void *arg, int err) {
+    DiskRequest *req = arg;
+    lock_acquire(&req->mutex);
+    req->done = 1;
+    req->err = err;
+    pthread_cond_signal(&req->cond);
+    lock_release(&req->mutex);
+}
+
+//starts a disk transfer and waits only for it; `locker` is released
+//while the transfer is in flight so other faults can proceed. callers
+//mark the frame and page busy beforehand. returns the error from the
+//MMU, 0 on success
+int disk_io(int write, int frame_no, int block_no) {
+    DiskRequest req = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0 };
+    if(write) mmu_disk_write_async(frame_no, block_no, disk_io_done, &req);
+    else mmu_disk_read_async(block_no, frame_no, disk_io_done, &req);
+
+    lock_acquire(&req.mutex);
+    if(!req.done) {
+        lock_release(&locker);
+        while(!req.done) lock_wait(&req.cond, &req.mutex);
+        lock_release(&req.mutex);
+        lock_acquire(&locker);
+    } else {
+        lock_release(&req.mutex);
+    }
+    pthread_mutex_destroy(&req.mutex);
+    pthread_cond_destroy(&req.cond);
+    return req.err;
+}
+
+//like disk_io for pages of a mapped file. the MMU does file I/O
+//synchronously, so we just let go of locker meanwhile
+void file_io(int write, int frame_no, Page *page) {
+    lock_release(&locker);
+    if(write) mmu_file_write(frame_no, page->file->fd, page->file_offset);
+    else mmu_file_read(page->file->fd, page->file_offset, frame_no);
+    lock_acquire(&locker);
+}
+
+//called with locker held and the page not busy. the process must not
+//map the page anymore. locker is let go of to write back file pages
+void release_page(PageTable *pt, Page *page) {
+    if(page->shared) {
+        detach_page(pt, page);
+        page->released = 1;
+        return;
+    }
+    if(is_pinned(page)) unpin_page(pt, page);
+    if(page->block_number != -1) {
+        if(block_table.blocks[page->block_number].used == 1) {
+            mmu_disk_discard(page->block_number);
+            block_table.blocks[page->block_number].used = 0;
+        }
+        block_table.blocks[page->block_number].page = NULL;
+    }
+    if(page->file) {
+        //the last writes to a writeback page go to the file, with
+        //the page and frame busy like in an eviction
+        if(page->file->writeback && page->isvalid == 1 && page->dirty == 1) {
+            FrameNode *frame = &frame_table.frames[page->frame_number];
+            page->busy = 1;
+            frame->busy = 1;
+            file_io(1, page->frame_number, page);
+            frame->busy = 0;
+            page->busy = 0;
+        }
+        if(--page->file->npages == 0) {
+            close(page->file->fd);
+            free(page->file);
+        }
+        page->file = NULL;
+    }
+    if(page->isvalid == 1) {
+        FrameNode *frame = &frame_table.frames[page->frame_number];
+        set_frame_owner(page->frame_number, -1);
+        frame->page = NULL;
+        frame->accessed = 0;
+        mmu_frame_release(page->frame_number);
+        page->isvalid = 0;
+        if(page->advice == UVM_ADV_COLD) frame_table.ncold--;
+        pthread_cond_broadcast(&busy_cond);
+    }
+    page->released = 1;
+}
+
+//called with locker held and the page resident and not busy. pages
+//it out like an eviction would and frees its frame
+void reclaim_page(Page *page) {
+    int frame_no = page->frame_number;
+    FrameNode *frame = &frame_table.frames[frame_no];
+    evict_frame(frame_no);
+    frame->busy = 0;
+    set_frame_owner(frame_no, -1);
+    frame->page = NULL;
+    frame->accessed = 0;
+    mmu_frame_release(frame_no);
+    pthread_cond_broadcast(&busy_cond);
+}
+
+//called with locker held after a fault brought in a sequential page.
+//reads the next pages into free frames and frees the pages the scan
+//has moved past, so the following faults find free frames too
+void read_ahead(pid_t pid, PageTable *pt, Page *page) {
+    intptr_t vaddr = page->vaddr;
+    for(int i = 2; i <= READAHEAD + 1; i++) {
+        Page *behind = get_page(pt, vaddr - i * frame_table.page_size);
+        if(behind == NULL || behind->shared || behind->advice != UVM_ADV_SEQUENTIAL) break;
+        if(behind->busy || behind->isvalid == 0 || is_pinned(behind)) break;
+        reclaim_page(behind);
+    }
+    for(int i = 1; i <= READAHEAD; i++) {
+        Page *next = get_page(pt, vaddr + i * frame_table.page_size);
+        if(next == NULL || next->shared || next->advice != UVM_ADV_SEQUENTIAL) break;
+        if(next->busy || next->isvalid == 1) continue;
+        if(get_new_frame() == -1 || at_max(pt)) break;
+        if(page_in(pid, next, 0)) break;
+    }
+}
+
+Page* backing(Page *page) {
+    return page->shared ? page->shared : page;
+}
+
+//called with locker held. maps a resident shared page in one more
+//process, like a fault on a resident page would
+void map_shared(pid_t pid, Page *page, int write) {
+    Page *b = page->shared;
+    mmu_resident(pid, (void*)page->vaddr, b->frame_number, write ? PROT_READ | PROT_WRITE : PROT_READ);
+    page->isvalid = 1;
+    frame_table.frames[b->frame_number].accessed = 1;
+    if(write) b->dirty = 1;
+}
+
+//unmaps the page in frame_no from every process that maps it
+void unmap_frame(int frame_no) {
+    FrameNode *frame = &frame_table.frames[frame_no];
+    Page *page = frame->page;
+    if(page->mappers == NULL) {
+        mmu_nonresident(frame->pid, (void*)page->vaddr);
+        return;
+    }
+    for(struct dnode *node = page->mappers->head; node; node = node->next) {
+        Page *entry = node->data;
+        if(entry->isvalid == 0) continue;
+        mmu_nonresident(entry->pid, (void*)entry->vaddr);
+        entry->isvalid = 0;
+    }
+}
+
+void chprot_frame(int frame_no, int prot) {
+    FrameNode *frame = &frame_table.frames[frame_no];
+    Page *page = frame->page;
+    if(page->mappers == NULL) {
+        mmu_chprot(frame->pid, (void*)page->vaddr, prot);
+        return;
+    }
+    for(struct dnode *node = page->mappers->head; node; node = node->next) {
+        Page *entry = node->data;
+        if(entry->isvalid == 1) mmu_chprot(entry->pid, (void*)entry->vaddr, prot);
+    }
+}
+
+//called with locker held. adds entries for every page of the region
+//after the last page of the process
+void *attach_region(PageTable *pt, pid_t pid, Region *region) {
+    intptr_t start = UVM_BASEADDR + pt->pages->count * frame_table.page_size;
+    for(int i = 0; i < region->npages; i++) {
+        Page *page = (Page*) malloc(sizeof(Page));
+        page->isvalid = 0;
+        page->busy = 0;
+        page->released = 0;
+        page->advice = UVM_ADV_NORMAL;
+        page->vaddr = start + i * frame_table.page_size;
+        page->block_number = -1;
+        page->pid = pid;
+        page->shared = region->pages[i];
+        page->mappers = NULL;
+        page->file = NULL;
+        dlist_push_right(pt->pages, page);
+        dlist_push_right(region->pages[i]->mappers, page);
+    }
+    return (void*)start;
+}
+
+//called with locker held and the entry not mapped anymore. a shared
+//page nobody attaches is freed, and its region can no longer be
+//attached; the region goes away with its last page
+void detach_page(PageTable *pt, Page *page) {
+    Page *b = page->shared;
+    Region *region = b->region;
+    dlist_remove(b->mappers, page);
+    page->shared = NULL;
+    page->isvalid = 0;
+    if(!dlist_empty(b->mappers)) {
+        //the frame is charged to a process still attaching it
+        if(b->isvalid == 1 && frame_table.frames[b->frame_number].pid == pt->pid) {
+            Page *entry = dlist_get_index(b->mappers, 0);
+            set_frame_owner(b->frame_number, entry->pid);
+        }
+        return;
+    }
+
+    dlist_destroy(b->mappers, NULL);
+    b->mappers = NULL;
+    release_page(pt, b);
+    if(region->listed) {
+        dlist_remove(regions, region);
+        region->listed = 0;
+    }
+    if(--region->nlive == 0) {
+        for(int i = 0; i < region->npages; i++) free(region->pages[i]);
+        free(region->pages);
+        free(region);
+    }
+}
+
+Region* find_region(const char *name) {
+    for(int i = 0; i < regions->count; i++) {
+        Region *region = dlist_get_index(regions, i);
+        if(strcmp(region->name, name) == 0) return region;
+    }
+    return NULL;
+}
+
+//called with locker held. the caller rebuilds the clock
+void unpin_page(PageTable *pt, Page *page) {
+    frame_table.frames[page->frame_number].pinned = 0;
+    pt->npinned--;
+    frame_table.npinned--;
+}
+
+int is_pinned(Page *page) {
+    if(page->shared) return 0;
+    return page->isvalid == 1 && frame_table.frames[page->frame_number].pinned;
+}
+
+int fair_share() {
+    return frame_table.nframes / page_tables->count;
+}
+
+//called with locker held on every fault. counts the fault and, while
+//the process is suspended, makes it wait. waiting threads check the
+//window themselves, so processes resume even if nobody else faults
+void load_control(PageTable *pt) {
+    load_window();
+    pt->window_faults++;
+    while(pt->suspended) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOAD_WINDOW_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        lock_timedwait(&load.resume_cond, &locker, &deadline);
+        load_window();
+    }
+}
+
+//closes the current window if it is over and suspends or resumes a
+//process depending on how many pages it paged out
+void load_window() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed = (now.tv_sec - load.window_start.tv_sec) * 1000 +
+            (now.tv_nsec - load.window_start.tv_nsec) / 1000000;
+    if(elapsed < LOAD_WINDOW_MS) return;
+
+    //the process with most faults is suspended, as long as another
+    //one that faulted keeps running
+    PageTable *victim = NULL;
+    int nfaulting = 0;
+    for(int i = 0; i < page_tables->count; i++) {
+        PageTable *pt = dlist_get_index(page_tables, i);
+        if(pt->suspended || pt->destroying || pt->window_faults == 0) continue;
+        nfaulting++;
+        if(victim == NULL || pt->window_faults > victim->window_faults ||
+                (pt->window_faults == victim->window_faults &&
+                 pt->nresident > victim->nresident)) {
+            victim = pt;
+        }
+    }
+    int evictions = load.window_evictions;
+    for(int i = 0; i < page_tables->count; i++) {
+        PageTable *pt = dlist_get_index(page_tables, i);
+        pt->window_faults = 0;
+    }
+    load.window_start = now;
+    load.window_evictions = 0;
+
+    if(evictions > frame_table.nframes && nfaulting >= 2) {
+        suspend_process(victim);
+    } else if(!dlist_empty(load.suspended) &&
+            (evictions < frame_table.nframes / LOAD_RESUME_DIV || nfaulting == 0)) {
+        resume_process(dlist_get_index(load.suspended, 0));
+    }
+}
+
+//called with locker held. pages out every private page of the process
+//so the others get its frames right away
+void suspend_process(PageTable *pt) {
+    pt->suspended = 1;
+    dlist_push_right(load.suspended, pt);
+    //reclaim_page lets go of locker to write pages. pager_destroy waits
+    //for suspending to drop, and pager_release waits for the busy page
+    //being written, so node stays in the list; pages popped after it
+    //leave its next NULL
+    pt->suspending++;
+    for(struct dnode *node = pt->pages->head; node; node = node->next) {
+        Page *page = node->data;
+        if(page->released || page->shared || page->busy) continue;
+        if(page->isvalid == 0 || is_pinned(page)) continue;
+        reclaim_page(page);
+    }
+    pt->suspending--;
+    pthread_cond_broadcast(&busy_cond);
+}
+
+void resume_process(PageTable *pt) {
+    pt->suspended = 0;
+    dlist_remove(load.suspended, pt);
+    pthread_cond_broadcast(&load.resume_cond);
+}
+
+//called with locker held on every fault
+void mrc_sample(PageTable *pt, intptr_t vaddr) {
+    Mrc *mrc = pt->mrc;
+    uint64_t hash = (uint64_t)(vaddr / frame_table.page_size) * 0x9e3779b97f4a7c15ULL;
+    if(hash >= UINT64_MAX / MRC_SAMPLE_DIV) return;
+
+    //a fault right after another on the same page (a write to a page
+    //mapped read-only) is the same reference
+    if(mrc->depth > 0 && mrc->stack[0] == vaddr) return;
+    mrc->refs++;
+    mrc_state.changed = 1;
+    int d = 0;
+    while(d < mrc->depth && mrc->stack[d] != vaddr) d++;
+    if(d == mrc->depth) {
+        mrc->cold++;
+        //the least recent page falls off the stack
+        if(mrc->depth < MRC_STACK) mrc->depth++;
+    } else {
+        int need = d * MRC_SAMPLE_DIV + 1;
+        if(need > frame_table.nframes) need = frame_table.nframes + 1;
+        mrc->hist[need]++;
+    }
+    if(d == MRC_STACK) d--;
+    memmove(&mrc->stack[1], &mrc->stack[0], d * sizeof(intptr_t));
+    mrc->stack[0] = vaddr;
+}
+
+//sampled faults the process would take with `nframes` frames
+unsigned long mrc_misses(Mrc *mrc, int nframes) {
+    unsigned long misses = mrc->cold + mrc->hist[frame_table.nframes + 1];
+    for(int k = nframes + 1; k <= frame_table.nframes; k++) misses += mrc->hist[k];
+    return misses;
+}
+
+void mrc_period() {
+    mrc_state.faults = 0;
+    //aging halves every curve alike, which leaves the split as it is
+    if(mrc_state.partition && mrc_state.changed) {
+        partition_frames();
+        mrc_state.changed = 0;
+    }
+    for(int i = 0; i < page_tables->count; i++) {
+        Mrc *mrc = ((PageTable*)dlist_get_index(page_tables, i))->mrc;
+        for(int k = 0; k <= frame_table.nframes + 1; k++) mrc->hist[k] /= 2;
+        mrc->cold /= 2;
+        mrc->refs /= 2;
+    }
+}
+
+//gives each process as its minimum the frames that, by the curves,
+//save the most faults overall (lookahead: a run of frames counts by
+//its average gain, so a curve flat until a knee is not starved). one
+//frame is left out of the minimums, like pager_set_rss requires.
+//minimums and maximums set by pager_set_rss bound what it gives
+void partition_frames() {
+    int n = page_tables->count;
+    int npoints = frame_table.nframes + 1;
+    int *alloc = calloc(n, sizeof(int));
+    unsigned long *curves = malloc(n * npoints * sizeof(unsigned long));
+    for(int i = 0; i < n; i++) {
+        PageTable *pt = dlist_get_index(page_tables, i);
+        for(int c = 0; c < npoints; c++) curves[i * npoints + c] = mrc_misses(pt->mrc, c);
+    }
+    int budget = frame_table.nframes - 1;
+    for(int i = 0; i < n; i++) {
+        alloc[i] = ((PageTable*)dlist_get_index(page_tables, i))->rss_min;
+        budget -= alloc[i];
+    }
+    while(budget > 0) {
+        int best = -1, best_k = 0;
+        double best_gain = 0;
+        for(int i = 0; i < n; i++) {
+            PageTable *pt = dlist_get_index(page_tables, i);
+            unsigned long *curve = &curves[i * npoints];
+            int limit = pt->max_frames ? pt->max_frames : frame_table.nframes;
+            for(int k = 1; k <= budget && alloc[i] + k <= limit; k++) {
+                double gain = (double)(curve[alloc[i]] - curve[alloc[i] + k]) / k;
+                if(gain > best_gain) {
+                    best = i;
+                    best_k = k;
+                    best_gain = gain;
+                }
+            }
+        }
+        if(best == -1) break;
+        alloc[best] += best_k;
+        budget -= best_k;
+    }
+    for(int i = 0; i < n; i++) {
+        PageTable *pt = dlist_get_index(page_tables, i);
+        pt->min_frames = alloc[i];
+    }
+    free(curves);
+    free(alloc);
+}
+
+int at_max(PageTable *pt) {
+    return pt->max_frames > 0 && pt->nresident >= pt->max_frames;
+}
+
+//gives the frame to `pid`, or frees it if `pid` is -1, keeping the
+//resident set sizes up to date
+void set_frame_owner(int frame_no, pid_t pid) {
+    FrameNode *frame = &frame_table.frames[frame_no];
+    if(frame->owner) frame->owner->nresident--;
+    frame->owner = pid == -1 ? NULL : find_page_table(pid);
+    if(frame->owner) frame->owner->nresident++;
+    frame->pid = pid;
+}
+
+//keeps frame_table.ncold, which lets clock_scan skip looking for cold
+//pages when there are none, in step with advice on resident pages
+void set_advice(Page *page, int advice) {
+    if(page->isvalid == 1) {
+        frame_table.ncold += (advice == UVM_ADV_COLD) - (page->advice == UVM_ADV_COLD);
+    }
+    page->advice = advice;
+}
+
+//links every frame to the next one the clock hand should visit
+void rebuild_clock() {
+    int n = frame_table.nframes;
+    int next = -1;
+    frame_table.nclock = 0;
+    //two passes so the last frames wrap around to the first ones
+    for(int i = 2 * n - 1; i >= 0; i--) {
+        if(i < n) {
+            frame_table.clock_next[i] = next;
+            if(!frame_table.frames[i].pinned) frame_table.nclock++;
+        }
+        if(!frame_table.frames[i % n].pinned) next = i % n;
+    }
+}
+
 int get_new_frame() {
     for(int i = 0; i < frame_table.nframes; i++) {
         if(frame_table.frames[i].pid == -1) return i;
@@ -267,18 +1489,29 @@ int get_new_block() {
 }
 
 PageTable* find_page_table(pid_t pid) {
-    for(int i = 0; i < page_tables->count; i++) {
-        PageTable *pt = dlist_get_index(page_tables, i);
-        if(pt->pid == pid) return pt;
-    }
+    PageTable *pt = lookup_page_table(pid);
+    if(pt != NULL) return pt;
     printf("error in find_page_table: Pid not found\n");
     exit(-1);
 }
 
+//like find_page_table, but returns NULL for unknown processes
+//these run on every fault, so they walk the list instead of calling
+//dlist_get_index for each position
+PageTable* lookup_page_table(pid_t pid) {
+    for(struct dnode *node = page_tables->head; node; node = node->next) {
+        PageTable *pt = node->data;
+        if(pt->pid == pid) return pt;
+    }
+    return NULL;
+}
+
 Page* get_page(PageTable *pt, intptr_t vaddr) {
-    for(int i=0; i < pt->pages->count; i++) {
-        Page *page = dlist_get_index(pt->pages, i);
-        if(vaddr >= page->vaddr && vaddr < (page->vaddr + frame_table.page_size)) return page;
+    for(struct dnode *node = pt->pages->head; node; node = node->next) {
+        Page *page = node->data;
+        if(vaddr >= page->vaddr && vaddr < (page->vaddr + frame_table.page_size)) {
+            return page->released ? NULL : page;
+        }
     }
     return NULL;
 }
@@ -340,6 +1573,21 @@ void *dlist_push_right(struct dlist *dl, void *data) {
     return data;
 }
 
+void dlist_remove(struct dlist *dl, void *data) {
+    struct dnode *node = dl->head;
+    while(node && node->data != data) node = node->next;
+    if(!node) return;
+
+    if(node->prev) node->prev->next = node->next;
+    else dl->head = node->next;
+    if(node->next) node->next->prev = node->prev;
+    else dl->tail = node->prev;
+    free(node);
+
+    dl->count--;
+    assert(dl->count >= 0);
+}
+
 int dlist_empty(struct dlist *dl) {
     int ret;
     if(dl->head == NULL) {
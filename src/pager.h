@@ -6,6 +6,9 @@
 #define __PAGER_CREATE__
 
 #include <sys/types.h>
+#include <sys/uio.h>
+
+#include "mmu.h"
 
 /* `pager_init` is called by the memory management infrastructure to
  * initialize the pager.  `nframes` and `nblocks` are the number of
@@ -23,7 +26,9 @@ void pager_create(pid_t pid);
  * in the infrastructure until the application actually accesses the
  * page (which will trigger a call to `pager_fault`).
  * `pager_extend` should return NULL is there are no disk blocks to
- * use as backing storage. */
+ * use as backing storage or the address space up to `UVM_MAXADDR` is
+ * full.  Holes left by `pager_release` are handed out before new
+ * addresses. */
 void *pager_extend(pid_t pid);
 
 /* `pager_fault` is called when process `pid` receives
@@ -40,6 +45,12 @@ void *pager_extend(pid_t pid);
  * to implement the second-chance algorithm. */
 void pager_fault(pid_t pid, void *addr);
 
+/* `pager_write_fault` is called instead of `pager_fault` when the MMU
+ * knows the fault was caused by a write (see `mmu -w`).  The pager
+ * may then map the page writable and dirty right away instead of
+ * waiting for the write to fault again on a read-only page. */
+void pager_write_fault(pid_t pid, void *addr);
+
 /* `pager_syslog prints a message made of `len` bytes following
  * `addr` in the address space of process `pid`.  `pager_syslog`
  * should behave as if making read accesses to the process's memory
@@ -49,10 +60,146 @@ void pager_fault(pid_t pid, void *addr);
  * the syslog succeeds, it should return 0. */
 int pager_syslog(pid_t pid, void *addr, size_t len);
 
+/* `pager_syslogv` prints the `iovcnt` buffers in `iov` like as many
+ * calls to `pager_syslog`, in order and without other processes'
+ * messages in between.  It stops at the first buffer `pager_syslog`
+ * would fail for and returns the number of buffers printed, which is
+ * `iovcnt` if all succeed. */
+int pager_syslogv(pid_t pid, const struct iovec *iov, int iovcnt);
+
+/* `pager_release` is called when process `pid` gives back the
+ * `npages` pages starting at `vaddr`, which is page-aligned.  The
+ * pager should unmap the pages (with `mmu_nonresident` for resident
+ * ones) and free their frames and blocks; their contents are lost.
+ * Released pages are no longer allocated: faults and syslogs on them
+ * are invalid.  If the released pages are at the top of the address
+ * space, the next `pager_extend` calls should hand those addresses
+ * out again; pages released in the middle leave a hole, which
+ * `pager_extend` fills (lowest address first) before growing the
+ * address space.  Returns 0 on success; if any of the pages is not
+ * allocated, releases nothing and returns -1. */
+int pager_release(pid_t pid, void *vaddr, int npages);
+
+/* `pager_advise` is called when process `pid` gives advice (one of
+ * the `UVM_ADV_*` constants in mmu.h) about how it will access the
+ * `npages` pages starting at `vaddr`, which is page-aligned.  The
+ * pager may use it to read pages ahead, bring them in or page them
+ * out early, or pick eviction victims, but must keep the contents of
+ * every page.  Returns 0 on success and -1 if any of the pages is not
+ * allocated or the advice is unknown. */
+int pager_advise(pid_t pid, void *vaddr, int npages, int advice);
+
+/* `pager_pin` is called when process `pid` pins (`pin` nonzero) or
+ * unpins the `npages` pages starting at `vaddr`, which is
+ * page-aligned.  Pinning brings the pages in and keeps them resident
+ * until they are unpinned or released: their frames are never chosen
+ * for eviction.  Pinning a pinned page or unpinning an unpinned one
+ * does nothing.  A process may pin at most a quarter of the frames
+ * (at least one), and at least one frame is always left unpinned.
+ * Returns 0 on success.  On failure nothing is pinned and it returns
+ * -1 with errno set: EINVAL if any page is not allocated or is a
+ * shared page, and ENOMEM if pinning would exceed the limits. */
+int pager_pin(pid_t pid, void *vaddr, int npages, int pin);
+
+/* `pager_share` creates a shared region called `name` with `npages`
+ * pages and attaches it to process `pid`; `pager_attach` attaches the
+ * existing region `name` to `pid` and stores its size in `npages`.
+ * Both return the address where the region starts, after the pages
+ * `pid` already has.  Every process attaching a region sees the same
+ * memory: the pager keeps one frame or block per shared page and maps
+ * it in each process that accesses it, and paging a shared page out
+ * unmaps it from all of them.  Attached pages are given back with
+ * `pager_release` like other pages; a region is freed, and its name
+ * forgotten, once a page of it is no longer attached anywhere.  On
+ * failure these return NULL and set errno: EINVAL for an empty or
+ * zero-sized region, EEXIST if `pager_share` finds the name in use,
+ * ENOENT if `pager_attach` does not find it, and ENOSPC if there are
+ * not enough disk blocks or the address space is full. */
+void *pager_share(pid_t pid, const char *name, int npages);
+void *pager_attach(pid_t pid, const char *name, int *npages);
+
+/* `pager_map_file` maps `npages` pages of the file open on `fd`,
+ * starting at byte `offset` (page-aligned), after the pages process
+ * `pid` already has, and returns the address of the first one.  Pages
+ * start out with the contents of the file instead of zeroes: the pager
+ * reads them with `mmu_file_read` when they are first accessed, and
+ * drops clean ones without writing them anywhere, as the file still
+ * has their contents.  With `flags` set to `UVM_MAP_WRITEBACK` (see
+ * mmu.h) dirty pages are written back to the file with
+ * `mmu_file_write` when paged out or released and use no disk blocks;
+ * with `UVM_MAP_PRIVATE` they go to disk blocks like other pages.
+ * Released file pages are given back like other pages.  The pager
+ * closes `fd` once no page uses it.  On failure it returns NULL, does
+ * not close `fd`, and sets errno: EINVAL for bad arguments, and ENOSPC
+ * if there are not enough disk blocks or the address space is full. */
+void *pager_map_file(pid_t pid, int fd, off_t offset, int npages, int flags);
+
+/* `pager_set_rss` limits the frames process `pid` may hold.  While
+ * it holds at most `min` frames, faults of other processes do not take
+ * them unless no other frame can be paged out.  Once it holds `max`
+ * frames (0 means no limit), its faults page out its own pages instead
+ * of using free frames or other processes' frames; a process over a
+ * new `max` shrinks as it faults.  When every frame is in use, faults
+ * take frames first from processes holding more than their fair share
+ * (the number of frames divided by the number of processes); a process
+ * holding its share then replaces its own pages, and others take frames
+ * from any process above its `min`.  Returns 0 on success; on failure
+ * returns -1 and sets errno: ESRCH if `pid` is unknown, EINVAL for
+ * negative limits or `min` above `max`, and ENOMEM if the minimums of
+ * all processes would leave no frame for faults. */
+int pager_set_rss(pid_t pid, int min, int max);
+
+/* `pager_get_rss` fills `rss` with the limits of process `pid`, the
+ * frames it holds, and how many frames its faults took from other
+ * processes (`steals`) and other processes took from it (`stolen`).
+ * Returns 0, or -1 with errno set to ESRCH if `pid` is unknown. */
+struct pager_rss {
+	int resident;
+	int min;
+	int max;
+	unsigned long steals;
+	unsigned long stolen;
+	int suspended;	/* by load control, see `pager_set_load_control` */
+};
+int pager_get_rss(pid_t pid, struct pager_rss *rss);
+
+/* `pager_set_load_control` turns load control on or off.  With load
+ * control, when page faults page out more than all frames within a
+ * short window (the processes' working sets do not fit in memory and
+ * they thrash), the pager suspends the process that faulted most: it
+ * pages out its pages and makes its faults wait.  Once paging calms
+ * down, suspended processes resume, oldest first.  At least one
+ * faulting process always keeps running.  Turning it off resumes every
+ * process.  Off by default. */
+void pager_set_load_control(int enable);
+
+/* `pager_get_mrc` stores in `curve` the miss-ratio curve of process
+ * `pid`: `misses[c]` is how many of its recent `refs` page faults it
+ * would have taken holding `c` frames, for `c` up to the number of
+ * frames.  The pager estimates curves from a sample of the faulting
+ * pages and ages them so they follow what processes do now.  Returns
+ * 0, or -1 with `errno` set to ESRCH if `pid` is unknown. */
+struct pager_mrc {
+	unsigned long refs;
+	int npoints;	/* frames 0 to `npoints - 1` */
+	unsigned long misses[MMU_MAX_FRAMES + 1];
+};
+int pager_get_mrc(pid_t pid, struct pager_mrc *curve);
+
+/* `pager_set_partition` turns automatic frame partitioning on or off.
+ * When on, the pager periodically sets every process's minimum (see
+ * `pager_set_rss`) to split memory the way the miss-ratio curves
+ * predict the fewest faults.  A process never gets less than the
+ * minimum set for it with `pager_set_rss`.  Off by default. */
+void pager_set_partition(int enable);
+
 /* `pager_destroy` is called when the process is already dead.  It
  * should free all resources process `pid` allocated (memory frames
  * and disk blocks).  `pager_destroy` should not call any of the MMU
- * functions. */
+ * functions that talk to the process; it may call `mmu_disk_discard`
+ * and `mmu_frame_release` for the blocks and frames it frees, and
+ * `mmu_file_write` to write back file pages.  Shared
+ * regions are detached as if the process released their pages. */
 void pager_destroy(pid_t pid);
 
 #endif
@@ -0,0 +1,450 @@
+/* Trace-driven pager simulator.  Replays the pager calls of a binary
+ * MMU trace (see trace.h) against the pager linked in, with in-memory
+ * stand-ins for the MMU primitives: no clients, sockets, signals, or
+ * disk, so a run is fast and always gives the same result.  Record a
+ * trace with an MMU built with -DMMUTRACE:
+ *
+ *   make TRACEFLAGS=-DMMUTRACE && make pagersim
+ *   ./bin/mmu 32 256 & ... run clients ...; kill -INT %1
+ *   ./bin/pagersim 32 256 mmu.trace
+ *
+ * usage: pagersim NFRAMES NBLOCKS [TRACEFILE]
+ *
+ * NFRAMES and NBLOCKS may differ from the recorded run.  Prints one
+ * line per policy with the pages brought in (zero fills and disk
+ * reads), disk reads, disk writes, and evictions.  `pager` is the
+ * pager itself.  The other policies replay the pages the pager
+ * touched, in order, as references to one global memory of NFRAMES
+ * frames: fifo, lru, clock, and Belady's opt, which evicts the page
+ * used again last and brings in the fewest pages possible.  A page is
+ * dirty once the pager maps it writable; clean pages are dropped.
+ * The references come from page faults, which depend on the policy of
+ * the recorded run, so the models are estimates.  Shared regions and
+ * mapped files cannot be replayed: their calls are skipped and
+ * counted. */
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "pager.h"
+#include "trace.h"
+
+#define NIDS 256	/* pid ids in traces, see pid2id in mmu.c */
+
+struct sim_stats {
+	unsigned long pageins;
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long evictions;
+};
+
+/* a page the pager touched, or pages that stopped existing */
+#define SIM_READ 0
+#define SIM_WRITE 1	/* the pager mapped it writable */
+#define SIM_DROP 2	/* released */
+#define SIM_EXIT 3	/* every page of `pid` */
+struct sim_ref {
+	int32_t pid;
+	uint32_t op;
+	uint64_t vpage;
+	size_t next;	/* index of the next reference to the page */
+};
+
+/* a page a reference model keeps track of */
+struct sim_page {
+	int32_t pid;
+	uint64_t vpage;
+	int frame;	/* -1 if not resident */
+	int dirty;
+	int swapped;	/* has a copy on disk */
+	int used;	/* hash slot taken */
+};
+
+static struct {
+	int nframes;
+	long pagesize;
+	struct sim_stats pager;
+	int replaying;	/* inside a fault or syslog */
+	struct sim_ref *refs;
+	size_t nrefs, refcap;
+	size_t naccesses;	/* refs that are not drops */
+	struct sim_page *table;
+	size_t tablesz;
+} sim;
+
+const char *pmem = NULL;
+
+/*****************************************************************************
+ * MMU stand-ins
+ ****************************************************************************/
+static void sim_ref(pid_t pid, void *vaddr, int op)
+{
+	if(sim.nrefs == sim.refcap) {
+		sim.refcap = sim.refcap ? 2 * sim.refcap : 4096;
+		sim.refs = realloc(sim.refs, sim.refcap * sizeof(*sim.refs));
+		if(!sim.refs) {
+			perror("pagersim");
+			exit(EXIT_FAILURE);
+		}
+	}
+	struct sim_ref *r = &sim.refs[sim.nrefs++];
+	r->pid = pid;
+	r->op = op;
+	r->vpage = (uintptr_t)vaddr / sim.pagesize;
+	if(op == SIM_READ || op == SIM_WRITE) sim.naccesses++;
+}
+
+void mmu_zero_fill(int frame) { sim.pager.pageins++; }
+void mmu_frame_release(int frame) { }
+
+void mmu_resident(pid_t pid, void *vaddr, int frame, int prot)
+{
+	if(sim.replaying) sim_ref(pid, vaddr, prot & PROT_WRITE ? SIM_WRITE : SIM_READ);
+}
+
+void mmu_nonresident(pid_t pid, void *vaddr)
+{
+	if(sim.replaying) sim.pager.evictions++;
+}
+
+void mmu_chprot(pid_t pid, void *vaddr, int prot)
+{
+	/* the pager upgrades the page it was asked about */
+	if(sim.replaying && (prot & PROT_WRITE)) sim_ref(pid, vaddr, SIM_WRITE);
+}
+
+int mmu_disk_read(int block_from, int frame_to)
+{
+	sim.pager.pageins++;
+	sim.pager.reads++;
+	return 0;
+}
+
+int mmu_disk_write(int frame_from, int block_to)
+{
+	sim.pager.writes++;
+	return 0;
+}
+
+void mmu_disk_read_async(int block_from, int frame_to, mmu_disk_cb cb,
+		void *arg)
+{
+	mmu_disk_read(block_from, frame_to);
+	cb(arg, 0);
+}
+
+void mmu_disk_write_async(int frame_from, int block_to, mmu_disk_cb cb,
+		void *arg)
+{
+	mmu_disk_write(frame_from, block_to);
+	cb(arg, 0);
+}
+
+void mmu_disk_discard(int block) { }
+void mmu_file_read(int fd, off_t offset, int frame) { sim.pager.pageins++; }
+void mmu_file_write(int frame, int fd, off_t offset) { }
+void mmu_syslog_print(const void *buf, size_t len) { }
+void mmu_kill(pid_t pid) { }
+
+/*****************************************************************************
+ * reference models
+ ****************************************************************************/
+static struct sim_page * sim_lookup(int32_t pid, uint64_t vpage)
+{
+	uint64_t h = (vpage * NIDS + pid) * 0x9e3779b97f4a7c15ULL;
+	size_t i = h & (sim.tablesz - 1);
+	while(sim.table[i].used &&
+			(sim.table[i].pid != pid || sim.table[i].vpage != vpage)) {
+		i = (i + 1) & (sim.tablesz - 1);
+	}
+	struct sim_page *p = &sim.table[i];
+	if(!p->used) {
+		p->used = 1;
+		p->pid = pid;
+		p->vpage = vpage;
+		p->frame = -1;
+	}
+	return p;
+}
+
+static void sim_table_reset(void)
+{
+	memset(sim.table, 0, sim.tablesz * sizeof(*sim.table));
+}
+
+/* forgets the pages of an exited process, whose id may be reused */
+static void sim_table_exit(int32_t pid)
+{
+	for(size_t i = 0; i < sim.tablesz; ++i) {
+		if(!sim.table[i].used || sim.table[i].pid != pid) continue;
+		sim.table[i].frame = -1;
+		sim.table[i].dirty = 0;
+		sim.table[i].swapped = 0;
+	}
+}
+
+/* links every reference to the next one to the same page, for opt */
+static void sim_link_refs(void)
+{
+	sim_table_reset();
+	for(size_t i = sim.nrefs; i-- > 0;) {
+		struct sim_ref *r = &sim.refs[i];
+		if(r->op == SIM_EXIT) {
+			sim_table_exit(r->pid);
+			continue;
+		}
+		struct sim_page *p = sim_lookup(r->pid, r->vpage);
+		/* `frame` holds the index of the later reference here */
+		r->next = p->frame == -1 ? SIZE_MAX : (size_t)p->frame;
+		p->frame = r->op == SIM_DROP ? -1 : (int)i;
+	}
+}
+
+enum sim_policy { SIM_FIFO, SIM_LRU, SIM_CLOCK, SIM_OPT };
+
+static struct sim_stats sim_model(enum sim_policy policy)
+{
+	struct sim_stats st;
+	memset(&st, 0, sizeof(st));
+	sim_table_reset();
+	struct sim_page **frames = calloc(sim.nframes, sizeof(*frames));
+	size_t *stamp = calloc(sim.nframes, sizeof(*stamp));
+	int *freelist = malloc(sim.nframes * sizeof(*freelist));
+	int hand = 0, nfree = 0;
+	for(int f = sim.nframes - 1; f >= 0; --f) freelist[nfree++] = f;
+	for(size_t i = 0; i < sim.nrefs; ++i) {
+		struct sim_ref *r = &sim.refs[i];
+		if(r->op == SIM_EXIT) {
+			for(int f = 0; f < sim.nframes; ++f) {
+				if(frames[f] && frames[f]->pid == r->pid) {
+					frames[f] = NULL;
+					freelist[nfree++] = f;
+				}
+			}
+			sim_table_exit(r->pid);
+			continue;
+		}
+		struct sim_page *p = sim_lookup(r->pid, r->vpage);
+		if(r->op == SIM_DROP) {
+			if(p->frame != -1) {
+				frames[p->frame] = NULL;
+				freelist[nfree++] = p->frame;
+			}
+			p->frame = -1;
+			p->dirty = 0;
+			p->swapped = 0;
+			continue;
+		}
+		if(p->frame != -1) {
+			if(policy == SIM_LRU || policy == SIM_CLOCK) stamp[p->frame] = 1 + i;
+			if(policy == SIM_OPT) stamp[p->frame] = r->next;
+			p->dirty |= r->op == SIM_WRITE;
+			continue;
+		}
+		int f;
+		if(nfree > 0) {
+			f = freelist[--nfree];
+		} else {
+			f = 0;
+			switch(policy) {
+			case SIM_FIFO:
+			case SIM_LRU:
+				for(int j = 1; j < sim.nframes; ++j)
+					if(stamp[j] < stamp[f]) f = j;
+				break;
+			case SIM_CLOCK:
+				while(stamp[hand]) {
+					stamp[hand] = 0;
+					hand = (hand + 1) % sim.nframes;
+				}
+				f = hand;
+				hand = (hand + 1) % sim.nframes;
+				break;
+			case SIM_OPT:
+				for(int j = 1; j < sim.nframes; ++j)
+					if(stamp[j] > stamp[f]) f = j;
+				break;
+			}
+			struct sim_page *victim = frames[f];
+			st.evictions++;
+			if(victim->dirty) {
+				st.writes++;
+				victim->swapped = 1;
+			}
+			victim->frame = -1;
+			victim->dirty = 0;
+		}
+		st.pageins++;
+		if(p->swapped) st.reads++;
+		p->frame = f;
+		p->dirty = r->op == SIM_WRITE;
+		frames[f] = p;
+		stamp[f] = policy == SIM_OPT ? r->next : 1 + i;
+	}
+	free(freelist);
+	free(stamp);
+	free(frames);
+	return st;
+}
+
+/*****************************************************************************
+ * replay
+ ****************************************************************************/
+static int cmp_seq(const void *va, const void *vb)
+{
+	const struct trace_rec *a = va;
+	const struct trace_rec *b = vb;
+	return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s NFRAMES NBLOCKS [TRACEFILE]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_stats(const char *name, const struct sim_stats *st)
+{
+	printf("%-8s %10lu %10lu %10lu %10lu\n", name, st->pageins, st->reads,
+			st->writes, st->evictions);
+}
+
+int main(int argc, char **argv)
+{
+	if(argc != 3 && argc != 4) usage(argv[0]);
+	sim.nframes = atoi(argv[1]);
+	int nblocks = atoi(argv[2]);
+	if(sim.nframes < 2 || nblocks < 2) usage(argv[0]);
+	const char *path = argc == 4 ? argv[3] : TRACE_DEFAULT_PATH;
+	FILE *file = fopen(path, "r");
+	if(!file) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	size_t n = 0, cap = 1024;
+	struct trace_rec *recs = malloc(cap * sizeof(*recs));
+	while(recs && fread(&recs[n], sizeof(*recs), 1, file) == 1) {
+		if(++n == cap) {
+			cap *= 2;
+			recs = realloc(recs, cap * sizeof(*recs));
+		}
+	}
+	if(!recs) {
+		perror("pagersim");
+		exit(EXIT_FAILURE);
+	}
+	fclose(file);
+	qsort(recs, n, sizeof(*recs), cmp_seq);
+
+	sim.pagesize = sysconf(_SC_PAGESIZE);
+	pmem = calloc(sim.nframes, sim.pagesize);
+	pager_init(sim.nframes, nblocks);
+	int live[NIDS] = { 0 };
+	unsigned long nevents = 0, nfaults = 0, skipped = 0;
+	double t0 = now();
+	for(size_t i = 0; i < n; ++i) {
+		const struct trace_rec *r = &recs[i];
+		if(r->pid < 0 || r->pid >= NIDS) continue;
+		pid_t pid = r->pid;
+		void *vaddr = (void *)(uintptr_t)r->ev.vaddr;
+		if(r->op != TRACE_PAGER_CREATE && r->op < TRACE_ZERO_FILL && !live[pid])
+			continue;	/* the trace started after the process */
+		switch(r->op) {
+		case TRACE_PAGER_CREATE:
+			pager_create(pid);
+			live[pid] = 1;
+			break;
+		case TRACE_PAGER_EXTEND:
+			pager_extend(pid);
+			break;
+		case TRACE_PAGER_FAULT:
+			sim.replaying = 1;
+			if(r->ev.prot) pager_write_fault(pid, vaddr);
+			else pager_fault(pid, vaddr);
+			sim.replaying = 0;
+			nfaults++;
+			break;
+		case TRACE_PAGER_SYSLOG:
+		case TRACE_PAGER_SYSLOG_SPAN:
+			sim.replaying = 1;
+			pager_syslog(pid, vaddr, r->ev.frame);
+			sim.replaying = 0;
+			break;
+		case TRACE_PAGER_RELEASE:
+			if(pager_release(pid, vaddr, r->ev.frame) == 0) {
+				for(int j = 0; j < r->ev.frame; ++j)
+					sim_ref(pid, (char *)vaddr + j * sim.pagesize, SIM_DROP);
+			}
+			break;
+		case TRACE_PAGER_ADVISE:
+			pager_advise(pid, vaddr, r->ev.frame, r->ev.prot);
+			break;
+		case TRACE_PAGER_PIN:
+			pager_pin(pid, vaddr, r->ev.frame, r->ev.prot);
+			break;
+		case TRACE_PAGER_SET_RSS:
+			pager_set_rss(pid, r->ev.frame, r->ev.block);
+			break;
+		case TRACE_PAGER_DESTROY:
+			pager_destroy(pid);
+			sim_ref(pid, NULL, SIM_EXIT);
+			live[pid] = 0;
+			break;
+		case TRACE_PAGER_SHARE:
+		case TRACE_PAGER_ATTACH:
+		case TRACE_PAGER_MAP_FILE:
+			skipped++;
+			break;
+		default:
+			continue;	/* MMU primitives and syslog bytes */
+		}
+		nevents++;
+	}
+	for(int pid = 0; pid < NIDS; ++pid) {
+		if(live[pid]) pager_destroy(pid);
+	}
+	double replay = now() - t0;
+
+	printf("%s: %lu pager calls, %lu faults, %zu references\n", path,
+			nevents, nfaults, sim.naccesses);
+	if(skipped) {
+		printf("skipped %lu shared region and mapped file calls\n", skipped);
+	}
+	printf("%-8s %10s %10s %10s %10s\n", "policy", "page-ins", "reads",
+			"writes", "evictions");
+	print_stats("pager", &sim.pager);
+
+	t0 = now();
+	sim.tablesz = 1024;
+	while(sim.tablesz < 2 * sim.nrefs) sim.tablesz *= 2;
+	sim.table = malloc(sim.tablesz * sizeof(*sim.table));
+	sim_link_refs();
+	const char *names[] = { "fifo", "lru", "clock", "opt" };
+	enum sim_policy policies[] = { SIM_FIFO, SIM_LRU, SIM_CLOCK, SIM_OPT };
+	for(int i = 0; i < 4; ++i) {
+		struct sim_stats st = sim_model(policies[i]);
+		print_stats(names[i], &st);
+	}
+	double models = now() - t0;
+	printf("replayed %zu records in %.3f s (%.2f M records/s), models in %.3f s\n",
+			n, replay, n / replay / 1e6, models);
+	free(sim.table);
+	free(sim.refs);
+	free(recs);
+	return 0;
+}
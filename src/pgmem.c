@@ -0,0 +1,427 @@
+/* Page kernels (see pgmem.h).  Each variant is a set of static
+ * functions compiled with `__attribute__((target))`, so the module
+ * builds without -mavx2 and friends and the CPU is only checked at run
+ * time.  The variants are listed in `pgmem_impls`; `pgmem_impl` picks
+ * the first one the CPU supports on the first call, and the public
+ * functions fall back to the portable variant for unaligned buffers. */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PGMEM_X86
+#endif
+
+#include "pgmem.h"
+
+#define PGMEM_ALIGN 64
+
+/****************************************************************************
+ * portable variant {{{
+ ***************************************************************************/
+static int scalar_supported(void)/*{{{*/
+{
+	return 1;
+}/*}}}*/
+
+static void scalar_fill(void *dst, int c, size_t len)/*{{{*/
+{
+	memset(dst, c, len);
+}/*}}}*/
+
+static void scalar_copy(void *dst, const void *src, size_t len)/*{{{*/
+{
+	memcpy(dst, src, len);
+}/*}}}*/
+
+static int scalar_is_filled(const void *src, int c, size_t len)/*{{{*/
+{
+	const unsigned char *s = src;
+	uint64_t pattern = 0x0101010101010101ULL * (unsigned char)c;
+	size_t i = 0;
+	for(; i + sizeof(pattern) <= len; i += sizeof(pattern)) {
+		uint64_t w;
+		memcpy(&w, s + i, sizeof(w));
+		if(w != pattern) return 0;
+	}
+	for(; i < len; ++i) {
+		if(s[i] != (unsigned char)c) return 0;
+	}
+	return 1;
+}/*}}}*/
+
+static int scalar_equal(const void *a, const void *b, size_t len)/*{{{*/
+{
+	return memcmp(a, b, len) == 0;
+}/*}}}*/
+
+static size_t scalar_hex(char *dst, const void *src, size_t len)/*{{{*/
+{
+	static const char digits[] = "0123456789abcdef";
+	const char *s = src;
+	char *d = dst;
+	for(size_t i = 0; i < len; ++i) {
+		unsigned c = (unsigned)s[i];
+		if(c > 0xff) {
+			memcpy(d, "ffffff", 6);
+			d += 6;
+		}
+		d[0] = digits[(c >> 4) & 0xf];
+		d[1] = digits[c & 0xf];
+		d += 2;
+	}
+	return d - dst;
+}/*}}}*/
+/*}}}*/
+
+#ifdef PGMEM_X86
+/****************************************************************************
+ * SSE2 variant {{{
+ ***************************************************************************/
+static int sse2_supported(void)/*{{{*/
+{
+	return __builtin_cpu_supports("sse2");
+}/*}}}*/
+
+__attribute__((target("sse2")))
+static void sse2_fill(void *dst, int c, size_t len)/*{{{*/
+{
+	__m128i v = _mm_set1_epi8((char)c);
+	char *d = dst;
+	for(size_t i = 0; i < len; i += 64) {
+		_mm_stream_si128((__m128i *)(d + i), v);
+		_mm_stream_si128((__m128i *)(d + i + 16), v);
+		_mm_stream_si128((__m128i *)(d + i + 32), v);
+		_mm_stream_si128((__m128i *)(d + i + 48), v);
+	}
+	_mm_sfence();
+}/*}}}*/
+
+__attribute__((target("sse2")))
+static void sse2_copy(void *dst, const void *src, size_t len)/*{{{*/
+{
+	char *d = dst;
+	const char *s = src;
+	for(size_t i = 0; i < len; i += 64) {
+		__m128i a = _mm_load_si128((const __m128i *)(s + i));
+		__m128i b = _mm_load_si128((const __m128i *)(s + i + 16));
+		__m128i c = _mm_load_si128((const __m128i *)(s + i + 32));
+		__m128i e = _mm_load_si128((const __m128i *)(s + i + 48));
+		_mm_stream_si128((__m128i *)(d + i), a);
+		_mm_stream_si128((__m128i *)(d + i + 16), b);
+		_mm_stream_si128((__m128i *)(d + i + 32), c);
+		_mm_stream_si128((__m128i *)(d + i + 48), e);
+	}
+	_mm_sfence();
+}/*}}}*/
+
+__attribute__((target("sse2")))
+static int sse2_is_filled(const void *src, int c, size_t len)/*{{{*/
+{
+	__m128i v = _mm_set1_epi8((char)c);
+	const char *s = src;
+	for(size_t i = 0; i < len; i += 64) {
+		__m128i a = _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(s + i)), v);
+		__m128i b = _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(s + i + 16)), v);
+		__m128i d = _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(s + i + 32)), v);
+		__m128i e = _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(s + i + 48)), v);
+		__m128i m = _mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(d, e));
+		if(_mm_movemask_epi8(m) != 0xFFFF) return 0;
+	}
+	return 1;
+}/*}}}*/
+
+__attribute__((target("sse2")))
+static int sse2_equal(const void *pa, const void *pb, size_t len)/*{{{*/
+{
+	const char *a = pa;
+	const char *b = pb;
+	for(size_t i = 0; i < len; i += 64) {
+		__m128i acc = _mm_setzero_si128();
+		for(size_t j = 0; j < 64; j += 16) {
+			__m128i x = _mm_load_si128((const __m128i *)(a + i + j));
+			__m128i y = _mm_load_si128((const __m128i *)(b + i + j));
+			acc = _mm_or_si128(acc, _mm_xor_si128(x, y));
+		}
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128()))
+				!= 0xFFFF) return 0;
+	}
+	return 1;
+}/*}}}*/
+
+/* Digits for the 16 nibbles in `x`, which must be in 0..15. */
+__attribute__((target("sse2")))
+static inline __m128i sse2_digits(__m128i x)/*{{{*/
+{
+	__m128i letter = _mm_cmpgt_epi8(x, _mm_set1_epi8(9));
+	x = _mm_add_epi8(x, _mm_set1_epi8('0'));
+	return _mm_add_epi8(x, _mm_and_si128(letter, _mm_set1_epi8('a' - '0' - 10)));
+}/*}}}*/
+
+/* Blocks with a byte from 0x80 up go through `scalar_hex`, which
+ * knows about sign extension; text never has any. */
+__attribute__((target("sse2")))
+static size_t sse2_hex(char *dst, const void *src, size_t len)/*{{{*/
+{
+	const char *s = src;
+	char *d = dst;
+	__m128i mask = _mm_set1_epi8(0x0f);
+	size_t i = 0;
+	for(; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		if(_mm_movemask_epi8(v)) {
+			d += scalar_hex(d, s + i, 16);
+			continue;
+		}
+		__m128i hi = sse2_digits(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+		__m128i lo = sse2_digits(_mm_and_si128(v, mask));
+		_mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi8(hi, lo));
+		d += 32;
+	}
+	d += scalar_hex(d, s + i, len - i);
+	return d - dst;
+}/*}}}*/
+/*}}}*/
+
+/****************************************************************************
+ * AVX2 variant {{{
+ ***************************************************************************/
+static int avx2_supported(void)/*{{{*/
+{
+	return __builtin_cpu_supports("avx2");
+}/*}}}*/
+
+__attribute__((target("avx2")))
+static void avx2_fill(void *dst, int c, size_t len)/*{{{*/
+{
+	__m256i v = _mm256_set1_epi8((char)c);
+	char *d = dst;
+	for(size_t i = 0; i < len; i += 64) {
+		_mm256_stream_si256((__m256i *)(d + i), v);
+		_mm256_stream_si256((__m256i *)(d + i + 32), v);
+	}
+	_mm_sfence();
+}/*}}}*/
+
+__attribute__((target("avx2")))
+static void avx2_copy(void *dst, const void *src, size_t len)/*{{{*/
+{
+	char *d = dst;
+	const char *s = src;
+	for(size_t i = 0; i < len; i += 64) {
+		__m256i a = _mm256_load_si256((const __m256i *)(s + i));
+		__m256i b = _mm256_load_si256((const __m256i *)(s + i + 32));
+		_mm256_stream_si256((__m256i *)(d + i), a);
+		_mm256_stream_si256((__m256i *)(d + i + 32), b);
+	}
+	_mm_sfence();
+}/*}}}*/
+
+__attribute__((target("avx2")))
+static int avx2_is_filled(const void *src, int c, size_t len)/*{{{*/
+{
+	__m256i v = _mm256_set1_epi8((char)c);
+	const char *s = src;
+	for(size_t i = 0; i < len; i += 64) {
+		__m256i a = _mm256_xor_si256(_mm256_load_si256((const __m256i *)(s + i)), v);
+		__m256i b = _mm256_xor_si256(_mm256_load_si256((const __m256i *)(s + i + 32)), v);
+		__m256i m = _mm256_or_si256(a, b);
+		if(!_mm256_testz_si256(m, m)) return 0;
+	}
+	return 1;
+}/*}}}*/
+
+__attribute__((target("avx2")))
+static int avx2_equal(const void *pa, const void *pb, size_t len)/*{{{*/
+{
+	const char *a = pa;
+	const char *b = pb;
+	for(size_t i = 0; i < len; i += 64) {
+		__m256i x = _mm256_xor_si256(
+				_mm256_load_si256((const __m256i *)(a + i)),
+				_mm256_load_si256((const __m256i *)(b + i)));
+		__m256i y = _mm256_xor_si256(
+				_mm256_load_si256((const __m256i *)(a + i + 32)),
+				_mm256_load_si256((const __m256i *)(b + i + 32)));
+		__m256i m = _mm256_or_si256(x, y);
+		if(!_mm256_testz_si256(m, m)) return 0;
+	}
+	return 1;
+}/*}}}*/
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_digits(__m256i x)/*{{{*/
+{
+	__m256i letter = _mm256_cmpgt_epi8(x, _mm256_set1_epi8(9));
+	x = _mm256_add_epi8(x, _mm256_set1_epi8('0'));
+	return _mm256_add_epi8(x,
+			_mm256_and_si256(letter, _mm256_set1_epi8('a' - '0' - 10)));
+}/*}}}*/
+
+/* Same as `sse2_hex`; the unpacks interleave within 128-bit lanes, so
+ * the halves are put back in order before storing. */
+__attribute__((target("avx2")))
+static size_t avx2_hex(char *dst, const void *src, size_t len)/*{{{*/
+{
+	const char *s = src;
+	char *d = dst;
+	__m256i mask = _mm256_set1_epi8(0x0f);
+	size_t i = 0;
+	for(; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+		if(_mm256_movemask_epi8(v)) {
+			d += scalar_hex(d, s + i, 32);
+			continue;
+		}
+		__m256i hi = avx2_digits(_mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+		__m256i lo = avx2_digits(_mm256_and_si256(v, mask));
+		__m256i a = _mm256_unpacklo_epi8(hi, lo);
+		__m256i b = _mm256_unpackhi_epi8(hi, lo);
+		_mm256_storeu_si256((__m256i *)d, _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *)(d + 32), _mm256_permute2x128_si256(a, b, 0x31));
+		d += 64;
+	}
+	d += sse2_hex(d, s + i, len - i);
+	return d - dst;
+}/*}}}*/
+/*}}}*/
+
+/****************************************************************************
+ * AVX-512 variant {{{
+ ***************************************************************************/
+static int avx512_supported(void)/*{{{*/
+{
+	return __builtin_cpu_supports("avx512f");
+}/*}}}*/
+
+__attribute__((target("avx512f")))
+static void avx512_fill(void *dst, int c, size_t len)/*{{{*/
+{
+	__m512i v = _mm512_set1_epi32(0x01010101 * (unsigned char)c);
+	char *d = dst;
+	for(size_t i = 0; i < len; i += 64) {
+		_mm512_stream_si512((__m512i *)(d + i), v);
+	}
+	_mm_sfence();
+}/*}}}*/
+
+__attribute__((target("avx512f")))
+static void avx512_copy(void *dst, const void *src, size_t len)/*{{{*/
+{
+	char *d = dst;
+	const char *s = src;
+	for(size_t i = 0; i < len; i += 64) {
+		__m512i a = _mm512_load_si512((const void *)(s + i));
+		_mm512_stream_si512((__m512i *)(d + i), a);
+	}
+	_mm_sfence();
+}/*}}}*/
+
+__attribute__((target("avx512f")))
+static int avx512_is_filled(const void *src, int c, size_t len)/*{{{*/
+{
+	__m512i v = _mm512_set1_epi32(0x01010101 * (unsigned char)c);
+	const char *s = src;
+	for(size_t i = 0; i < len; i += 64) {
+		__m512i a = _mm512_load_si512((const void *)(s + i));
+		if(_mm512_cmpneq_epi32_mask(a, v)) return 0;
+	}
+	return 1;
+}/*}}}*/
+
+__attribute__((target("avx512f")))
+static int avx512_equal(const void *pa, const void *pb, size_t len)/*{{{*/
+{
+	const char *a = pa;
+	const char *b = pb;
+	for(size_t i = 0; i < len; i += 64) {
+		__m512i x = _mm512_load_si512((const void *)(a + i));
+		__m512i y = _mm512_load_si512((const void *)(b + i));
+		if(_mm512_cmpneq_epi32_mask(x, y)) return 0;
+	}
+	return 1;
+}/*}}}*/
+/*}}}*/
+#endif
+
+/****************************************************************************
+ * dispatch {{{
+ ***************************************************************************/
+/* ordered from most to least preferred */
+const struct pgmem_impl pgmem_impls[] = {
+#ifdef PGMEM_X86
+	/* byte arithmetic needs AVX-512BW, so hex encoding stays at AVX2 */
+	{ "avx512", avx512_supported, avx512_fill, avx512_copy,
+			avx512_is_filled, avx512_equal, avx2_hex },
+	{ "avx2", avx2_supported, avx2_fill, avx2_copy,
+			avx2_is_filled, avx2_equal, avx2_hex },
+	{ "sse2", sse2_supported, sse2_fill, sse2_copy,
+			sse2_is_filled, sse2_equal, sse2_hex },
+#endif
+	{ "scalar", scalar_supported, scalar_fill, scalar_copy,
+			scalar_is_filled, scalar_equal, scalar_hex },
+};
+const int pgmem_nimpls = sizeof(pgmem_impls) / sizeof(pgmem_impls[0]);
+static const struct pgmem_impl *impl = NULL;
+
+static const struct pgmem_impl * pgmem_impl(void)/*{{{*/
+{
+	const struct pgmem_impl *i = __atomic_load_n(&impl, __ATOMIC_ACQUIRE);
+	if(i) return i;
+	for(i = pgmem_impls; !i->supported(); ++i);
+	__atomic_store_n(&impl, i, __ATOMIC_RELEASE);
+	return i;
+}/*}}}*/
+
+static int pgmem_aligned(const void *a, const void *b, size_t len)/*{{{*/
+{
+	return (((uintptr_t)a | (uintptr_t)b | len) & (PGMEM_ALIGN - 1)) == 0;
+}/*}}}*/
+
+int pgmem_use(const char *name)/*{{{*/
+{
+	for(int i = 0; i < pgmem_nimpls; ++i) {
+		if(strcmp(pgmem_impls[i].name, name)) continue;
+		if(!pgmem_impls[i].supported()) return -1;
+		__atomic_store_n(&impl, &pgmem_impls[i], __ATOMIC_RELEASE);
+		return 0;
+	}
+	return -1;
+}/*}}}*/
+
+const char * pgmem_current(void)/*{{{*/
+{
+	return pgmem_impl()->name;
+}/*}}}*/
+
+void pgmem_fill(void *dst, int c, size_t len)/*{{{*/
+{
+	if(!pgmem_aligned(dst, NULL, len)) scalar_fill(dst, c, len);
+	else pgmem_impl()->fill(dst, c, len);
+}/*}}}*/
+
+void pgmem_copy(void *dst, const void *src, size_t len)/*{{{*/
+{
+	if(!pgmem_aligned(dst, src, len)) scalar_copy(dst, src, len);
+	else pgmem_impl()->copy(dst, src, len);
+}/*}}}*/
+
+int pgmem_is_filled(const void *src, int c, size_t len)/*{{{*/
+{
+	if(!pgmem_aligned(src, NULL, len)) return scalar_is_filled(src, c, len);
+	return pgmem_impl()->is_filled(src, c, len);
+}/*}}}*/
+
+int pgmem_equal(const void *a, const void *b, size_t len)/*{{{*/
+{
+	if(!pgmem_aligned(a, b, len)) return scalar_equal(a, b, len);
+	return pgmem_impl()->equal(a, b, len);
+}/*}}}*/
+
+size_t pgmem_hex(char *dst, const void *src, size_t len)/*{{{*/
+{
+	return pgmem_impl()->hex(dst, src, len);
+}/*}}}*/
+/*}}}*/
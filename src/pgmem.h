@@ -0,0 +1,61 @@
+/* This module implements the kernels used to move whole pages around:
+ * filling, copying, and comparing, plus the hex encoder for syslog
+ * output.  Each kernel has a portable variant plus SSE2, AVX2, and
+ * AVX-512 variants on x86; the first call into the module picks the
+ * widest variant the CPU supports.  The SIMD variants use
+ * non-temporal stores so that pages moved on behalf of clients do not
+ * evict the MMU's own working set from the cache.
+ *
+ * Buffers and lengths should be multiples of 64 bytes (any page-sized
+ * buffer allocated with page alignment is); other buffers are handled
+ * by the portable variant. */
+
+#ifndef __PGMEM_HEADER__
+#define __PGMEM_HEADER__
+
+#include <stddef.h>
+
+/* `pgmem_fill` sets `len` bytes at `dst` to `c`; `pgmem_copy` copies
+ * `len` bytes from `src` to `dst`, which must not overlap. */
+void pgmem_fill(void *dst, int c, size_t len);
+void pgmem_copy(void *dst, const void *src, size_t len);
+
+/* `pgmem_is_filled` returns nonzero if all `len` bytes at `src` are
+ * equal to `c` (use 0 for all-zero pages and '0' for pages filled by
+ * `mmu_zero_fill`).  `pgmem_equal` returns nonzero if the `len` bytes
+ * at `a` and `b` are the same. */
+int pgmem_is_filled(const void *src, int c, size_t len);
+int pgmem_equal(const void *a, const void *b, size_t len);
+
+/* `pgmem_hex` writes the `len` bytes at `src` to `dst` as hexadecimal
+ * digits in the format of `mmu_syslog_print`: two lowercase digits
+ * per byte, except that bytes from 0x80 up are sign extended to eight
+ * digits where `char` is signed, as `printf("%02x")` prints them.
+ * `dst` must hold `8*len` characters; no terminator is written.
+ * Returns the number of characters written.  Unlike the page kernels,
+ * any buffer and length is handled by every variant. */
+size_t pgmem_hex(char *dst, const void *src, size_t len);
+
+/* Every variant compiled in is listed in `pgmem_impls`, including the
+ * ones the CPU cannot run; `supported` tells them apart.  These are
+ * meant for benchmarks and tests. */
+struct pgmem_impl {
+	const char *name;
+	int (*supported)(void);
+	void (*fill)(void *dst, int c, size_t len);
+	void (*copy)(void *dst, const void *src, size_t len);
+	int (*is_filled)(const void *src, int c, size_t len);
+	int (*equal)(const void *a, const void *b, size_t len);
+	size_t (*hex)(char *dst, const void *src, size_t len);
+};
+extern const struct pgmem_impl pgmem_impls[];
+extern const int pgmem_nimpls;
+
+/* `pgmem_use` makes the variant called `name` the one used by the
+ * functions above.  Returns 0 on success and -1 if the variant does
+ * not exist or is not supported.  `pgmem_current` returns the name of
+ * the variant in use. */
+int pgmem_use(const char *name);
+const char * pgmem_current(void);
+
+#endif
@@ -0,0 +1,277 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "trace.h"
+
+/*****************************************************************************
+ * ring definitions and static variables
+ ****************************************************************************/
+#define TRACE_RING_SIZE 4096	/* records, power of two */
+#define TRACE_DRAIN_USEC 10000
+
+struct trace_ring {
+	struct trace_rec recs[TRACE_RING_SIZE];
+	uint64_t head;	/* next slot the owner writes */
+	uint64_t tail;	/* next slot the drain thread reads */
+	int dead;	/* owner thread exited */
+	struct trace_ring *next;
+};
+
+static struct {
+	FILE *file;
+	int running;
+	uint64_t seq;
+	pthread_t thread;
+	pthread_mutex_t mutex;	/* protects the =rings= list */
+	struct trace_ring *rings;
+	pthread_key_t key;
+} trace;
+
+static __thread struct trace_ring *ring = NULL;
+
+static void trace_push(const struct trace_rec *rec);
+static uint64_t trace_now(void);
+static void * trace_drain_thread(void *unused);
+static void trace_drain(void);
+static void trace_ring_exit(void *vring);
+
+/*****************************************************************************
+ * public function implementations
+ ****************************************************************************/
+void trace_init(const char *path) /* {{{ */
+{
+	trace.file = fopen(path, "w");
+	if(!trace.file) logea(__FILE__, __LINE__, path);
+	trace.running = 1;
+	trace.seq = 0;
+	trace.rings = NULL;
+	pthread_mutex_init(&trace.mutex, NULL);
+	pthread_key_create(&trace.key, trace_ring_exit);
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	pthread_create(&trace.thread, NULL, trace_drain_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	logd(LOG_INFO, "%s: tracing to %s\n", __func__, path);
+} /* }}} */
+
+void trace_destroy(void) /* {{{ */
+{
+	__atomic_store_n(&trace.running, 0, __ATOMIC_RELEASE);
+	pthread_join(trace.thread, NULL);
+	trace_drain();
+	pthread_mutex_lock(&trace.mutex);
+	while(trace.rings) {
+		struct trace_ring *r = trace.rings;
+		trace.rings = r->next;
+		free(r);
+	}
+	pthread_mutex_unlock(&trace.mutex);
+	ring = NULL;
+	pthread_key_delete(trace.key);
+	pthread_mutex_destroy(&trace.mutex);
+	fclose(trace.file);
+} /* }}} */
+
+void trace_record(struct trace_rec *rec) /* {{{ */
+{
+	rec->ts = trace_now();
+	rec->seq = __atomic_fetch_add(&trace.seq, 1, __ATOMIC_RELAXED);
+	trace_push(rec);
+} /* }}} */
+
+void trace_record_data(const void *buf, size_t len) /* {{{ */
+{
+	const uint8_t *bytes = buf;
+	struct trace_rec rec;
+	memset(&rec, 0, sizeof(rec));
+	size_t nrecs = len ? (len + TRACE_DATA_MAX - 1) / TRACE_DATA_MAX : 1;
+	rec.ts = trace_now();
+	rec.seq = __atomic_fetch_add(&trace.seq, nrecs, __ATOMIC_RELAXED);
+	do {
+		size_t n = len < TRACE_DATA_MAX ? len : TRACE_DATA_MAX;
+		rec.op = (n == len) ? TRACE_SYSLOG_END : TRACE_SYSLOG_DATA;
+		rec.data.len = n;
+		memcpy(rec.data.bytes, bytes, n);
+		trace_push(&rec);
+		rec.seq++;
+		bytes += n;
+		len -= n;
+	} while(len > 0);
+} /* }}} */
+
+int trace_format(char *buf, size_t bufsz, const struct trace_rec *rec) /* {{{ */
+{
+	void *vaddr = (void *)(uintptr_t)rec->ev.vaddr;
+	switch(rec->op) {
+	case TRACE_PAGER_CREATE:
+		return snprintf(buf, bufsz, "pager_create pid %d\n", rec->pid);
+	case TRACE_PAGER_EXTEND:
+		return snprintf(buf, bufsz, "pager_extend pid %d vaddr %p\n",
+				rec->pid, vaddr);
+	case TRACE_PAGER_SYSLOG:
+		return snprintf(buf, bufsz, "pager_syslog pid %d %p\n", rec->pid,
+				vaddr);
+	case TRACE_PAGER_SYSLOGV:
+		return snprintf(buf, bufsz, "pager_syslogv pid %d %p count %d\n",
+				rec->pid, vaddr, rec->ev.frame);
+	case TRACE_PAGER_RELEASE:
+		return snprintf(buf, bufsz, "pager_release pid %d vaddr %p npages %d\n",
+				rec->pid, vaddr, rec->ev.frame);
+	case TRACE_PAGER_ADVISE:
+		return snprintf(buf, bufsz,
+				"pager_advise pid %d vaddr %p npages %d advice %d\n",
+				rec->pid, vaddr, rec->ev.frame, rec->ev.prot);
+	case TRACE_PAGER_PIN:
+		return snprintf(buf, bufsz,
+				"pager_pin pid %d vaddr %p npages %d pin %d\n",
+				rec->pid, vaddr, rec->ev.frame, rec->ev.prot);
+	case TRACE_PAGER_SHARE:
+		return snprintf(buf, bufsz, "pager_share pid %d vaddr %p npages %d\n",
+				rec->pid, vaddr, rec->ev.frame);
+	case TRACE_PAGER_ATTACH:
+		return snprintf(buf, bufsz, "pager_attach pid %d vaddr %p npages %d\n",
+				rec->pid, vaddr, rec->ev.frame);
+	case TRACE_PAGER_MAP_FILE:
+		return snprintf(buf, bufsz,
+				"pager_map_file pid %d vaddr %p npages %d flags %d\n",
+				rec->pid, vaddr, rec->ev.frame, rec->ev.prot);
+	case TRACE_PAGER_SET_RSS:
+		return snprintf(buf, bufsz, "pager_set_rss pid %d min %d max %d\n",
+				rec->pid, rec->ev.frame, rec->ev.block);
+	case TRACE_PAGER_SYSLOG_SPAN:
+		return snprintf(buf, bufsz, "%s", "");
+	case TRACE_PAGER_FAULT:
+		return snprintf(buf, bufsz, "pager_fault pid %d vaddr %p\n",
+				rec->pid, vaddr);
+	case TRACE_PAGER_DESTROY:
+		return snprintf(buf, bufsz, "pager_destroy pid %d\n", rec->pid);
+	case TRACE_ZERO_FILL:
+		return snprintf(buf, bufsz, "mmu_zero_fill frame %u\n",
+				rec->ev.frame);
+	case TRACE_RESIDENT:
+		return snprintf(buf, bufsz,
+				"mmu_resident pid %d vaddr %p prot %d frame %u\n",
+				rec->pid, vaddr, rec->ev.prot, rec->ev.frame);
+	case TRACE_NONRESIDENT:
+		return snprintf(buf, bufsz, "mmu_nonresident pid %d vaddr %p\n",
+				rec->pid, vaddr);
+	case TRACE_CHPROT:
+		return snprintf(buf, bufsz, "mmu_chprot pid %d vaddr %p prot %d\n",
+				rec->pid, vaddr, rec->ev.prot);
+	case TRACE_DISK_READ:
+		return snprintf(buf, bufsz, "mmu_disk_read from block %d to frame %d\n",
+				rec->ev.block, rec->ev.frame);
+	case TRACE_DISK_WRITE:
+		return snprintf(buf, bufsz, "mmu_disk_write from frame %d to block %d\n",
+				rec->ev.frame, rec->ev.block);
+	case TRACE_FILE_READ:
+		return snprintf(buf, bufsz, "mmu_file_read from offset %llu to frame %d\n",
+				(unsigned long long)rec->ev.vaddr, rec->ev.frame);
+	case TRACE_FILE_WRITE:
+		return snprintf(buf, bufsz, "mmu_file_write from frame %d to offset %llu\n",
+				rec->ev.frame, (unsigned long long)rec->ev.vaddr);
+	default:
+		return -1;
+	}
+} /* }}} */
+
+int trace_format_data(char *buf, size_t bufsz, const struct trace_rec *rec) /* {{{ */
+{
+	int cnt = 0;
+	assert(rec->op == TRACE_SYSLOG_DATA || rec->op == TRACE_SYSLOG_END);
+	for(uint32_t i = 0; i < rec->data.len && cnt < bufsz; ++i) {
+		/* same sign extension as printing a plain char with %02x */
+		cnt += snprintf(buf + cnt, bufsz - cnt, "%02x",
+				(unsigned)(char)rec->data.bytes[i]);
+	}
+	if(rec->op == TRACE_SYSLOG_END && cnt < bufsz) {
+		cnt += snprintf(buf + cnt, bufsz - cnt, "\n");
+	}
+	return cnt;
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+/* Appends =rec= to the calling thread's ring, creating the ring on
+ * the thread's first record. */
+static void trace_push(const struct trace_rec *rec) /* {{{ */
+{
+	if(!ring) {
+		ring = calloc(1, sizeof(*ring));
+		if(!ring) logea(__FILE__, __LINE__, NULL);
+		pthread_setspecific(trace.key, ring);
+		pthread_mutex_lock(&trace.mutex);
+		ring->next = trace.rings;
+		trace.rings = ring;
+		pthread_mutex_unlock(&trace.mutex);
+	}
+	uint64_t head = ring->head;
+	while(head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)
+			== TRACE_RING_SIZE) {
+		sched_yield();	/* full; never drop records */
+	}
+	ring->recs[head & (TRACE_RING_SIZE - 1)] = *rec;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+} /* }}} */
+
+static uint64_t trace_now(void) /* {{{ */
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+} /* }}} */
+
+static void * trace_drain_thread(void *unused) /* {{{ */
+{
+	while(__atomic_load_n(&trace.running, __ATOMIC_ACQUIRE)) {
+		trace_drain();
+		usleep(TRACE_DRAIN_USEC);
+	}
+	return NULL;
+} /* }}} */
+
+static void trace_drain(void) /* {{{ */
+{
+	pthread_mutex_lock(&trace.mutex);
+	struct trace_ring **prev = &trace.rings;
+	while(*prev) {
+		struct trace_ring *r = *prev;
+		int dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint64_t tail = r->tail;
+		while(tail != head) {
+			uint64_t end = head;
+			uint64_t wrap = (tail | (TRACE_RING_SIZE - 1)) + 1;
+			if(end > wrap) end = wrap;
+			size_t n = end - tail;
+			fwrite(&r->recs[tail & (TRACE_RING_SIZE - 1)],
+					sizeof(struct trace_rec), n, trace.file);
+			tail = end;
+		}
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+		if(dead) {
+			*prev = r->next;
+			free(r);
+		} else {
+			prev = &r->next;
+		}
+	}
+	pthread_mutex_unlock(&trace.mutex);
+	fflush(trace.file);
+} /* }}} */
+
+static void trace_ring_exit(void *vring) /* {{{ */
+{
+	struct trace_ring *r = vring;
+	__atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+} /* }}} */
@@ -0,0 +1,101 @@
+/* This module records the MMU operation log (the `.mmu.out` text the
+ * grading scripts compare) as fixed-size binary records instead of
+ * formatted text.  Each thread appends to its own lock-free ring;
+ * a drain thread copies rings to the trace file in the background.
+ * Records carry a global sequence number, so `mmutrace` can put them
+ * back in order and print the text log offline:
+ *
+ * (1) start the trace with =trace_init=
+ * (2) record events with =trace_record=
+ * (3) stop with =trace_destroy=, which flushes every ring.
+ *
+ * The MMU records into the trace when built with -DMMUTRACE and
+ * prints the same lines with =trace_format= otherwise. */
+
+#ifndef __TRACE_HEADER__
+#define __TRACE_HEADER__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_PAGER_CREATE 1
+#define TRACE_PAGER_EXTEND 2
+/* `frame` holds the length of the string */
+#define TRACE_PAGER_SYSLOG 3
+/* `prot` is 1 if the MMU called `pager_write_fault` */
+#define TRACE_PAGER_FAULT 4
+#define TRACE_PAGER_DESTROY 5
+#define TRACE_ZERO_FILL 6
+#define TRACE_RESIDENT 7
+#define TRACE_NONRESIDENT 8
+#define TRACE_CHPROT 9
+#define TRACE_DISK_READ 10
+#define TRACE_DISK_WRITE 11
+/* bytes printed by `pager_syslog`, split across as many records as
+ * needed; the last record of a message is SYSLOG_END. */
+#define TRACE_SYSLOG_DATA 12
+#define TRACE_SYSLOG_END 13
+/* a batch of syslog spans; `frame` holds the number of spans */
+#define TRACE_PAGER_SYSLOGV 14
+/* pages given back by a client; `frame` holds the number of pages */
+#define TRACE_PAGER_RELEASE 15
+/* `frame` holds the number of pages and `prot` the advice */
+#define TRACE_PAGER_ADVISE 16
+/* `frame` holds the number of pages and `prot` is 1 to pin, 0 to unpin */
+#define TRACE_PAGER_PIN 17
+/* `frame` holds the number of pages of the region */
+#define TRACE_PAGER_SHARE 18
+#define TRACE_PAGER_ATTACH 19
+/* `frame` holds the number of pages and `prot` the UVM_MAP_* flags */
+#define TRACE_PAGER_MAP_FILE 20
+/* `vaddr` holds the offset in the file */
+#define TRACE_FILE_READ 21
+#define TRACE_FILE_WRITE 22
+/* `frame` holds the minimum and `block` the maximum */
+#define TRACE_PAGER_SET_RSS 23
+/* a span of a syslog batch, `frame` holds its length; only recorded
+ * in binary traces, for `pagersim`, and never printed */
+#define TRACE_PAGER_SYSLOG_SPAN 24
+
+#define TRACE_DATA_MAX 20
+#define TRACE_DEFAULT_PATH "mmu.trace"
+
+struct trace_rec {
+	uint64_t seq;
+	uint64_t ts;	/* CLOCK_MONOTONIC, nanoseconds */
+	uint32_t op;
+	int32_t pid;
+	union {
+		struct {
+			uint64_t vaddr;
+			int32_t frame;
+			int32_t block;
+			int32_t prot;
+		} ev;
+		struct {
+			uint32_t len;
+			uint8_t bytes[TRACE_DATA_MAX];
+		} data;
+	};
+} __attribute__((packed));
+
+/* Opens =path= for writing and starts the drain thread. */
+void trace_init(const char *path);
+void trace_destroy(void);
+
+/* Appends an event to the calling thread's ring; =seq= and =ts= are
+ * filled in.  Blocks only if the ring is full. */
+void trace_record(struct trace_rec *rec);
+
+/* Records =len= bytes of syslog output as DATA/END records.  Their
+ * sequence numbers are taken at once, so records from other threads
+ * never sort between them. */
+void trace_record_data(const void *buf, size_t len);
+
+/* Renders =rec= as a line of the text log into =buf= and returns the
+ * line length (as snprintf).  Returns -1 for data records, which
+ * are printed with =trace_format_data=. */
+int trace_format(char *buf, size_t bufsz, const struct trace_rec *rec);
+int trace_format_data(char *buf, size_t bufsz, const struct trace_rec *rec);
+
+#endif
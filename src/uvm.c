@@ -2,12 +2,18 @@
  * DEPARTAMENTO DE CIENCIA DA COMPUTACAO    *
  * Copyright (c) Italo Fernando Scota Cunha */
 
+#define _GNU_SOURCE
+
 #include "uvm.h"
 
+#include <linux/userfaultfd.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/un.h>
 
 #include <assert.h>
@@ -19,8 +25,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <ucontext.h>
 #include <unistd.h>
 
+#include "lockprof.h"
 #include "log.h"
 
 #include "mmu.h"
@@ -32,13 +40,44 @@
 struct uvm_data {/*{{{*/
 	int running;
 	int npages;
+	unsigned char *released;	/* pages below `npages` given back */
 	int sock;
 	pthread_t thread;
 	pthread_mutex_t mutex;
-	pthread_cond_t cond;
-	char *pmem_fn;
+	pthread_cond_t idle;	/* signaled when `reqs` becomes empty */
 	int pmem_fd;
+	int handoff;	/* UVM_FAULT_HANDOFF: replies go through uvm_thread */
+	int uffd;	/* UVM_USERFAULTFD: faults go to the MMU, -1 if unused */
+	int reading;	/* a waiting thread is reading the socket */
+	uint32_t next_id;
+	struct uvm_req *reqs;	/* requests waiting for a reply */
+	unsigned long nfaults;	/* SIGSEGVs sent to the MMU */
+	unsigned long nmapcalls;	/* mmap/munmap/mprotect/madvise calls */
+};/*}}}*/
+/* One per request in flight; lives on the requesting thread's stack. */
+struct uvm_req {/*{{{*/
+	uint32_t id;
+	int done;
 	intptr_t result;
+	void *reply;	/* if set, receives a copy of the whole reply */
+	pthread_cond_t cond;
+	struct uvm_req *next;
+};/*}}}*/
+union uvm_msg {/*{{{*/
+	struct mmu_proto_hdr hdr;
+	struct mmu_proto_extend_rep extend;
+	struct mmu_proto_syslog_rep syslog;
+	struct mmu_proto_syslogv_rep syslogv;
+	struct mmu_proto_release_rep release;
+	struct mmu_proto_advise_rep advise;
+	struct mmu_proto_pin_rep pin;
+	struct mmu_proto_share_rep share;
+	struct mmu_proto_map_rep map;
+	struct mmu_proto_rss_rep rss;
+	struct mmu_proto_segv_rep segv;
+	struct mmu_proto_remap_rep remap;
+	struct mmu_proto_chprot_rep chprot;
+	struct mmu_proto_exit_rep exit;
 };/*}}}*/
 
 static struct uvm_data *uvm = NULL;
@@ -49,13 +88,25 @@ static struct uvm_data *uvm = NULL;
 static void * uvm_thread(void *data);
 static void uvm_exit(int status, void *arg);
 static void uvm_segv_action(int signum, siginfo_t *si, void *context);
-
-/* Protocol message handlers assume assume `uvm->mutex` is locked. */
-static void uvm_proto_extend_rep(void);
-static void uvm_proto_syslog_rep(void);
-static void uvm_proto_segv_rep(void);
-static void uvm_proto_remap_rep(void);
-static void uvm_proto_chprot_rep(void);
+static int uvm_segv_write(const siginfo_t *si, const void *context);
+static int uvm_recv_fd(int sock, void *buf, size_t len);
+static ssize_t uvm_send_fd(int sock, const void *buf, size_t len, int fd);
+static void uvm_uffd_init(void);
+static void uvm_uffd_register(void *vaddr);
+static void uvm_add_pages(void *vaddr, size_t npages);
+static void uvm_recv_msg(union uvm_msg *msg);
+static int uvm_pin_range(void *addr, size_t npages, int pin);
+static void * uvm_share_region(const char *name, size_t *npages, int create);
+
+/* In-flight requests and protocol message handlers assume
+ * `uvm->mutex` is locked. */
+static void uvm_req_start(struct uvm_req *r);
+static intptr_t uvm_req_wait(struct uvm_req *r);
+static struct uvm_req * uvm_req_find(uint32_t id);
+static void uvm_req_done(uint32_t id, intptr_t result);
+static void uvm_proto_dispatch(const union uvm_msg *msg);
+static void uvm_proto_remap_rep(const struct mmu_proto_remap_rep *rep);
+static void uvm_proto_chprot_rep(const struct mmu_proto_chprot_rep *rep);
 
 #define prexit() do { loge(LOG_FATAL, __FILE__, __LINE__); \
 			char buf[80]; sprintf(buf, "%s:%d: ", __FILE__, __LINE__); \
@@ -75,6 +126,16 @@ void uvm_create(void)/*{{{*/
 	if(!uvm) prexit();
 	uvm->running = 1;
 	uvm->npages = 0;
+	uvm->released = calloc((UVM_MAXADDR - UVM_BASEADDR + 1) /
+			sysconf(_SC_PAGESIZE), 1);
+	if(!uvm->released) prexit();
+	uvm->reading = 0;
+	uvm->next_id = 0;
+	uvm->reqs = NULL;
+	uvm->nfaults = 0;
+	uvm->nmapcalls = 0;
+	const char *handoff = getenv("UVM_FAULT_HANDOFF");
+	uvm->handoff = handoff && atoi(handoff);
 
 	logd(LOG_DEBUG, "  connecting unix socket [%s]\n", MMU_PROTO_UNIX_PATH);
 	uvm->sock = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -90,20 +151,22 @@ void uvm_create(void)/*{{{*/
 	logd(LOG_DEBUG, "  sending CREATE_REQ [%d]\n", (int)getpid());
 	struct mmu_proto_create_req req;
 	req.type = MMU_PROTO_CREATE_REQ;
+	req.id = 0;
 	req.pid = (uint32_t)getpid();
 	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
 		prexit();
 
 	logd(LOG_DEBUG, "  waiting CREATE_REP\n");
 	struct mmu_proto_create_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep)) prexit();
+	uvm->pmem_fd = uvm_recv_fd(uvm->sock, &rep, sizeof(rep));
+	if(uvm->pmem_fd == -1) prexit();
 	assert(rep.type == MMU_PROTO_CREATE_REP);
+	logd(LOG_DEBUG, "  received pmem fd %d [%llu bytes]\n", uvm->pmem_fd,
+			(unsigned long long)rep.pmemsz);
 
-	uvm->pmem_fn = strndup(rep.pmem_fn, MMU_PROTO_PATH_MAX);
-	logd(LOG_DEBUG, "  mapping pmem_fn [%s]\n", uvm->pmem_fn);
-	uvm->pmem_fd = open(uvm->pmem_fn, O_RDWR);
-	if(uvm->pmem_fd == -1)
-		prexit();
+	uvm->uffd = -1;
+	const char *uffd = getenv("UVM_USERFAULTFD");
+	if(uffd && atoi(uffd)) uvm_uffd_init();
 
 	logd(LOG_DEBUG, "  setting up SEGV handler\n");
 	struct sigaction new;
@@ -115,40 +178,236 @@ void uvm_create(void)/*{{{*/
 
 	logd(LOG_DEBUG, "  starting uvm_thread()\n");
 	pthread_mutex_init(&uvm->mutex, NULL);
-	pthread_cond_init(&uvm->cond, NULL);
+	pthread_cond_init(&uvm->idle, NULL);
 	pthread_create(&uvm->thread, NULL, uvm_thread, NULL);
 
 	logd(LOG_DEBUG, "  setting up uvm_exit() on_exit()\n");
 	if(on_exit(uvm_exit, NULL)) prexit();
 
+	const char *rssmin = getenv("UVM_RSS_MIN");
+	const char *rssmax = getenv("UVM_RSS_MAX");
+	if(rssmin || rssmax) {
+		size_t min = rssmin ? strtoul(rssmin, NULL, 10) : 0;
+		size_t max = rssmax ? strtoul(rssmax, NULL, 10) : 0;
+		if(uvm_rss_limit(min, max)) {
+			loge(LOG_WARN, __FILE__, __LINE__);
+			logd(LOG_WARN, "  resident-set limits %zu %zu rejected\n", min, max);
+		}
+	}
+
 	logd(LOG_DEBUG, "uvm_create succeeded\n");
 }/*}}}*/
 
 void * uvm_extend(void) {/*{{{*/
-	pthread_mutex_lock(&uvm->mutex);
+	lock_acquire(&uvm->mutex);
+	struct uvm_req r;
+	uvm_req_start(&r);
 	struct mmu_proto_extend_req req;
 	req.type = MMU_PROTO_EXTEND_REQ;
+	req.id = r.id;
 	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
 		prexit();
-	pthread_cond_wait(&uvm->cond, &uvm->mutex);
-	if(uvm->result) uvm->npages++;
-	pthread_mutex_unlock(&uvm->mutex);
-	return (void *)uvm->result;
+	void *vaddr = (void *)uvm_req_wait(&r);
+	if(vaddr && uvm->uffd != -1) uvm_uffd_register(vaddr);
+	if(vaddr) {
+		uvm_add_pages(vaddr, 1);
+	} else {
+		errno = ENOSPC;
+	}
+	lock_release(&uvm->mutex);
+	return vaddr;
 }/*}}}*/
 
 int uvm_syslog(void *addr, size_t len)/*{{{*/
 {
-	pthread_mutex_lock(&uvm->mutex);
+	lock_acquire(&uvm->mutex);
+	struct uvm_req r;
+	uvm_req_start(&r);
 	struct mmu_proto_syslog_req req;
 	req.type = MMU_PROTO_SYSLOG_REQ;
+	req.id = r.id;
 	req.addr = (intptr_t)addr;
 	req.len = len;
 	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
 		prexit();
-	pthread_cond_wait(&uvm->cond, &uvm->mutex);
-	if(uvm->result != 0) errno = EINVAL;
-	pthread_mutex_unlock(&uvm->mutex);
-	return (int)uvm->result;
+	int result = (int)uvm_req_wait(&r);
+	if(result != 0) errno = EINVAL;
+	lock_release(&uvm->mutex);
+	return result;
+}/*}}}*/
+
+int uvm_syslogv(const struct iovec *iov, int iovcnt)/*{{{*/
+{
+	int done = 0;
+	while(done < iovcnt) {
+		int count = iovcnt - done;
+		if(count > MMU_PROTO_SYSLOGV_MAX) count = MMU_PROTO_SYSLOGV_MAX;
+		struct mmu_proto_syslogv_req req;
+		req.type = MMU_PROTO_SYSLOGV_REQ;
+		req.count = count;
+		for(int i = 0; i < count; ++i) {
+			req.spans[i].addr = (intptr_t)iov[done + i].iov_base;
+			req.spans[i].len = iov[done + i].iov_len;
+		}
+		size_t len = MMU_PROTO_SYSLOGV_LEN(count);
+
+		lock_acquire(&uvm->mutex);
+		struct uvm_req r;
+		uvm_req_start(&r);
+		req.id = r.id;
+		if(send(uvm->sock, &req, len, 0) != len)
+			prexit();
+		int nlogged = (int)uvm_req_wait(&r);
+		lock_release(&uvm->mutex);
+
+		done += nlogged;
+		if(nlogged < count) {
+			errno = EINVAL;
+			break;
+		}
+	}
+	return done;
+}/*}}}*/
+
+int uvm_release(void *addr, size_t npages)/*{{{*/
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	intptr_t va = (intptr_t)addr;
+	size_t first = (va - UVM_BASEADDR) / pagesz;
+	lock_acquire(&uvm->mutex);
+	if(va < UVM_BASEADDR || first >= uvm->npages ||
+			npages == 0 || npages > uvm->npages - first) {
+		lock_release(&uvm->mutex);
+		errno = EINVAL;
+		return -1;
+	}
+	struct uvm_req r;
+	uvm_req_start(&r);
+	struct mmu_proto_release_req req;
+	req.type = MMU_PROTO_RELEASE_REQ;
+	req.id = r.id;
+	req.vaddr = va;
+	req.npages = npages;
+	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
+		prexit();
+	int result = (int)uvm_req_wait(&r);
+	if(result == 0) {
+		/* the MMU already unmapped the pages; drop the mappings so
+		 * later accesses are caught by `uvm_segv_action` */
+		if(munmap(addr, npages * pagesz) == -1)
+			prexit();
+		uvm->nmapcalls++;
+		memset(uvm->released + first, 1, npages);
+		while(uvm->npages > 0 && uvm->released[uvm->npages - 1])
+			uvm->released[--uvm->npages] = 0;
+	} else {
+		errno = EINVAL;
+	}
+	lock_release(&uvm->mutex);
+	return result;
+}/*}}}*/
+
+int uvm_advise(void *addr, size_t npages, int advice)/*{{{*/
+{
+	lock_acquire(&uvm->mutex);
+	struct uvm_req r;
+	uvm_req_start(&r);
+	struct mmu_proto_advise_req req;
+	req.type = MMU_PROTO_ADVISE_REQ;
+	req.id = r.id;
+	req.vaddr = (intptr_t)addr;
+	req.npages = npages;
+	req.advice = advice;
+	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
+		prexit();
+	int result = (int)uvm_req_wait(&r);
+	if(result != 0) errno = EINVAL;
+	lock_release(&uvm->mutex);
+	return result;
+}/*}}}*/
+
+int uvm_pin(void *addr, size_t npages)/*{{{*/
+{
+	return uvm_pin_range(addr, npages, 1);
+}/*}}}*/
+
+int uvm_unpin(void *addr, size_t npages)/*{{{*/
+{
+	return uvm_pin_range(addr, npages, 0);
+}/*}}}*/
+
+void * uvm_share(const char *name, size_t npages)/*{{{*/
+{
+	return uvm_share_region(name, &npages, 1);
+}/*}}}*/
+
+void * uvm_attach(const char *name, size_t *npages)/*{{{*/
+{
+	return uvm_share_region(name, npages, 0);
+}/*}}}*/
+
+int uvm_rss_limit(size_t min, size_t max)/*{{{*/
+{
+	if(min > INT32_MAX || max > INT32_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	lock_acquire(&uvm->mutex);
+	struct uvm_req r;
+	uvm_req_start(&r);
+	struct mmu_proto_rss_req req;
+	req.type = MMU_PROTO_RSS_REQ;
+	req.id = r.id;
+	req.pid = 0;
+	req.set = 1;
+	req.min = min;
+	req.max = max;
+	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
+		prexit();
+	int result = (int)uvm_req_wait(&r);
+	lock_release(&uvm->mutex);
+	if(result == 0) return 0;
+	errno = result;
+	return -1;
+}/*}}}*/
+
+void * uvm_map_file(const char *path, off_t offset, size_t npages, int flags)/*{{{*/
+{
+	size_t maxpages = (UVM_MAXADDR - UVM_BASEADDR + 1) / sysconf(_SC_PAGESIZE);
+	if(npages == 0 || npages > maxpages) {
+		errno = EINVAL;
+		return NULL;
+	}
+	int mode = flags == UVM_MAP_WRITEBACK ? O_RDWR : O_RDONLY;
+	int fd = open(path, mode | O_CLOEXEC);
+	if(fd == -1) return NULL;
+
+	lock_acquire(&uvm->mutex);
+	struct uvm_req r;
+	struct mmu_proto_map_rep rep;
+	uvm_req_start(&r);
+	r.reply = &rep;
+	struct mmu_proto_map_req req;
+	req.type = MMU_PROTO_MAP_REQ;
+	req.id = r.id;
+	req.npages = npages;
+	req.flags = flags;
+	req.offset = offset;
+	req.fd = -1;
+	if(uvm_send_fd(uvm->sock, &req, sizeof(req), fd) != sizeof(req))
+		prexit();
+	close(fd);	/* the MMU has its own copy */
+	void *vaddr = (void *)uvm_req_wait(&r);
+	if(vaddr) {
+		size_t pagesz = sysconf(_SC_PAGESIZE);
+		for(size_t i = 0; i < npages && uvm->uffd != -1; ++i)
+			uvm_uffd_register((char *)vaddr + i * pagesz);
+		uvm_add_pages(vaddr, npages);
+	} else {
+		errno = rep.retcode;
+	}
+	lock_release(&uvm->mutex);
+	return vaddr;
 }/*}}}*/
 
 /****************************************************************************
@@ -163,35 +422,25 @@ void * uvm_thread(void *data) {/*{{{*/
 
 	while(uvm->running) {
 		logd(LOG_DEBUG, "uvm_thread waiting message\n");
-		uint32_t type;
-		ssize_t c = recv(uvm->sock, &type, sizeof(type), MSG_PEEK);
+		struct mmu_proto_hdr hdr;
+		ssize_t c = recv(uvm->sock, &hdr, sizeof(hdr), MSG_PEEK);
 		if(!uvm->running) break;
-		if(c != sizeof(type)) prexit();
-		pthread_mutex_lock(&uvm->mutex);
-		switch(type) {
-			case MMU_PROTO_EXTEND_REP:
-				uvm_proto_extend_rep();
-				break;
-			case MMU_PROTO_SYSLOG_REP:
-				uvm_proto_syslog_rep();
-				break;
-			case MMU_PROTO_SEGV_REP:
-				uvm_proto_segv_rep();
-				break;
-			case MMU_PROTO_REMAP_REP:
-				uvm_proto_remap_rep();
-				break;
-			case MMU_PROTO_CHPROT_REP:
-				uvm_proto_chprot_rep();
-				break;
-			case MMU_PROTO_EXIT_REP:
-				uvm->running = 0;
-				break;
-			default:
-				prexit();
-				break;
+		if(c != sizeof(hdr)) prexit();
+		lock_acquire(&uvm->mutex);
+		/* threads waiting for replies read the socket themselves;
+		 * the message may be consumed by the time they are done, so
+		 * check again without blocking. */
+		while(!uvm->handoff && uvm->reqs)
+			lock_wait(&uvm->idle, &uvm->mutex);
+		c = recv(uvm->sock, &hdr, sizeof(hdr), MSG_PEEK | MSG_DONTWAIT);
+		if(c == sizeof(hdr)) {
+			union uvm_msg msg;
+			uvm_recv_msg(&msg);
+			uvm_proto_dispatch(&msg);
+		} else if(c != -1 || errno != EAGAIN) {
+			prexit();
 		}
-		pthread_mutex_unlock(&uvm->mutex);
+		lock_release(&uvm->mutex);
 	}
 	logd(LOG_DEBUG, "uvm_thread exiting\n");
 	pthread_exit(NULL);
@@ -202,16 +451,20 @@ void uvm_exit(int status, void *arg)/*{{{*/
 	logd(LOG_DEBUG, "uvm_exit running\n");
 	struct mmu_proto_exit_req req;
 	req.type = MMU_PROTO_EXIT_REQ;
+	req.id = 0;
 	/* socket may have been closed by the MMU, ignore return value: */
 	send(uvm->sock, &req, sizeof(req), 0);
-	pthread_mutex_unlock(&(uvm->mutex));
+	lock_release(&(uvm->mutex));
 	pthread_join(uvm->thread, NULL);
+	logd(LOG_INFO, "uvm_exit: %lu faults, %lu mapping syscalls\n",
+			uvm->nfaults, uvm->nmapcalls);
 	close(uvm->sock);
+	if(uvm->uffd != -1) close(uvm->uffd);
 
 	pthread_mutex_destroy(&uvm->mutex);
-	pthread_cond_destroy(&uvm->cond);
-	free(uvm->pmem_fn);
+	pthread_cond_destroy(&uvm->idle);
 	close(uvm->pmem_fd);
+	free(uvm->released);
 	free(uvm);
 	uvm = NULL;
 	#ifdef UVMLOG
@@ -219,9 +472,274 @@ void uvm_exit(int status, void *arg)/*{{{*/
 	#endif
 }/*}}}*/
 
+int uvm_recv_fd(int sock, void *buf, size_t len)/*{{{*/
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctl;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+	if(recvmsg(sock, &msg, MSG_WAITALL) != len) return -1;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if(cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+			cmsg->cmsg_type != SCM_RIGHTS) {
+		errno = EPROTO;
+		return -1;
+	}
+	int fd;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	return fd;
+}/*}}}*/
+
+ssize_t uvm_send_fd(int sock, const void *buf, size_t len, int fd)/*{{{*/
+{
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctl;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	return sendmsg(sock, &msg, 0);
+}/*}}}*/
+
+/* Hands a userfaultfd to the MMU, which then services faults on our
+ * pages without signals or remapping on our side.  Keeps using
+ * SIGSEGV if the kernel or the MMU cannot do it. */
+void uvm_uffd_init(void)/*{{{*/
+{
+	int fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+	if(fd == -1) {
+		/* unprivileged processes may only handle user-mode faults */
+		fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK |
+				UFFD_USER_MODE_ONLY);
+	}
+	if(fd == -1) goto out;
+	struct uffdio_api api;
+	api.api = UFFD_API;
+	api.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+	if(ioctl(fd, UFFDIO_API, &api) == -1) goto out_close;
+	/* the MMU reads pages back from us; ignored without Yama */
+	prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY, 0, 0, 0);
+
+	logd(LOG_DEBUG, "  sending UFFD_REQ\n");
+	struct mmu_proto_uffd_req req;
+	req.type = MMU_PROTO_UFFD_REQ;
+	req.id = 0;
+	req.probe = (uintptr_t)&uvm->npages;
+	if(uvm_send_fd(uvm->sock, &req, sizeof(req), fd) != sizeof(req))
+		prexit();
+	struct mmu_proto_uffd_rep rep;
+	if(recv(uvm->sock, &rep, sizeof(rep), MSG_WAITALL) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_UFFD_REP);
+	if(rep.retcode) {
+		errno = rep.retcode;
+		goto out_close;
+	}
+	uvm->uffd = fd;
+	logd(LOG_DEBUG, "  faults go through userfaultfd %d\n", fd);
+	return;
+
+	out_close:
+	close(fd);
+	out:
+	loge(LOG_INFO, __FILE__, __LINE__);
+	logd(LOG_INFO, "  userfaultfd unavailable, using SIGSEGV\n");
+}/*}}}*/
+
+/* Pages start out empty; the MMU copies frames in on faults. */
+void uvm_uffd_register(void *vaddr)/*{{{*/
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+	if(mmap(vaddr, pagesz, PROT_READ | PROT_WRITE, flags, -1, 0) != vaddr)
+		prexit();
+	struct uffdio_register reg;
+	reg.range.start = (uintptr_t)vaddr;
+	reg.range.len = pagesz;
+	reg.mode = UFFDIO_REGISTER_MODE_MISSING | UFFDIO_REGISTER_MODE_WP;
+	if(ioctl(uvm->uffd, UFFDIO_REGISTER, &reg) == -1)
+		prexit();
+}/*}}}*/
+
+/* Records the pages the MMU handed out at `vaddr`.  Replies to
+ * concurrent requests arrive in any order, so pages may land in a hole
+ * or past pages not handed out yet; those are marked released until
+ * their own reply comes in.  Called with `uvm->mutex` locked. */
+void uvm_add_pages(void *vaddr, size_t npages)/*{{{*/
+{
+	size_t first = ((intptr_t)vaddr - UVM_BASEADDR) / sysconf(_SC_PAGESIZE);
+	if(first > uvm->npages)
+		memset(uvm->released + uvm->npages, 1, first - uvm->npages);
+	if(first + npages > uvm->npages) uvm->npages = first + npages;
+	memset(uvm->released + first, 0, npages);
+}/*}}}*/
+
+int uvm_pin_range(void *addr, size_t npages, int pin)/*{{{*/
+{
+	lock_acquire(&uvm->mutex);
+	struct uvm_req r;
+	uvm_req_start(&r);
+	struct mmu_proto_pin_req req;
+	req.type = MMU_PROTO_PIN_REQ;
+	req.id = r.id;
+	req.vaddr = (intptr_t)addr;
+	req.npages = npages;
+	req.pin = pin;
+	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
+		prexit();
+	int result = (int)uvm_req_wait(&r);
+	lock_release(&uvm->mutex);
+	if(result == 0) return 0;
+	errno = result;
+	return -1;
+}/*}}}*/
+
+void * uvm_share_region(const char *name, size_t *npages, int create)/*{{{*/
+{
+	size_t maxpages = (UVM_MAXADDR - UVM_BASEADDR + 1) / sysconf(_SC_PAGESIZE);
+	if(strlen(name) >= UVM_SHARE_NAME_MAX ||
+			(create && (*npages == 0 || *npages > maxpages))) {
+		errno = EINVAL;
+		return NULL;
+	}
+	struct mmu_proto_share_req req;
+	memset(&req, 0, sizeof(req));
+	req.type = MMU_PROTO_SHARE_REQ;
+	req.npages = create ? *npages : 0;
+	req.create = create;
+	strcpy(req.name, name);
+
+	lock_acquire(&uvm->mutex);
+	struct uvm_req r;
+	struct mmu_proto_share_rep rep;
+	uvm_req_start(&r);
+	r.reply = &rep;
+	req.id = r.id;
+	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
+		prexit();
+	void *vaddr = (void *)uvm_req_wait(&r);
+	if(vaddr) {
+		uvm_add_pages(vaddr, rep.npages);
+		*npages = rep.npages;
+	} else {
+		errno = rep.retcode;
+	}
+	lock_release(&uvm->mutex);
+	return vaddr;
+}/*}}}*/
+
+void uvm_recv_msg(union uvm_msg *msg)/*{{{*/
+{
+	if(recv(uvm->sock, &msg->hdr, sizeof(msg->hdr), MSG_PEEK)
+			!= sizeof(msg->hdr))
+		prexit();
+	size_t len;
+	switch(msg->hdr.type) {
+		case MMU_PROTO_EXTEND_REP: len = sizeof(msg->extend); break;
+		case MMU_PROTO_SYSLOG_REP: len = sizeof(msg->syslog); break;
+		case MMU_PROTO_SYSLOGV_REP: len = sizeof(msg->syslogv); break;
+		case MMU_PROTO_RELEASE_REP: len = sizeof(msg->release); break;
+		case MMU_PROTO_ADVISE_REP: len = sizeof(msg->advise); break;
+		case MMU_PROTO_PIN_REP: len = sizeof(msg->pin); break;
+		case MMU_PROTO_SHARE_REP: len = sizeof(msg->share); break;
+		case MMU_PROTO_MAP_REP: len = sizeof(msg->map); break;
+		case MMU_PROTO_RSS_REP: len = sizeof(msg->rss); break;
+		case MMU_PROTO_SEGV_REP: len = sizeof(msg->segv); break;
+		case MMU_PROTO_REMAP_REP: len = sizeof(msg->remap); break;
+		case MMU_PROTO_CHPROT_REP: len = sizeof(msg->chprot); break;
+		case MMU_PROTO_EXIT_REP: len = sizeof(msg->exit); break;
+		default: errno = EPROTO; prexit(); break;
+	}
+	if(recv(uvm->sock, msg, len, MSG_WAITALL) != len)
+		prexit();
+}/*}}}*/
+
+void uvm_req_start(struct uvm_req *r)/*{{{*/
+{
+	if(++uvm->next_id == 0) ++uvm->next_id; /* 0 is for CREATE/EXIT */
+	r->id = uvm->next_id;
+	r->done = 0;
+	r->result = 0;
+	r->reply = NULL;
+	pthread_cond_init(&r->cond, NULL);
+	r->next = uvm->reqs;
+	uvm->reqs = r;
+}/*}}}*/
+
+/* Waits for the reply to `r`.  Unless UVM_FAULT_HANDOFF is set, the
+ * first waiter to find nobody reading the socket becomes the reader:
+ * it dispatches every message (waking the threads the replies are
+ * for) until its own reply arrives, then passes the role on to
+ * another waiter.  This saves the handoff through `uvm_thread` on
+ * every reply. */
+intptr_t uvm_req_wait(struct uvm_req *r)/*{{{*/
+{
+	while(!r->done) {
+		if(uvm->handoff || uvm->reading) {
+			lock_wait(&r->cond, &uvm->mutex);
+			continue;
+		}
+		union uvm_msg msg;
+		uvm->reading = 1;
+		lock_release(&uvm->mutex);
+		uvm_recv_msg(&msg);
+		lock_acquire(&uvm->mutex);
+		uvm->reading = 0;
+		uvm_proto_dispatch(&msg);
+	}
+
+	struct uvm_req **prev = &uvm->reqs;
+	while(*prev != r) prev = &(*prev)->next;
+	*prev = r->next;
+	pthread_cond_destroy(&r->cond);
+
+	struct uvm_req *next = uvm->reqs;
+	while(next && next->done) next = next->next;
+	if(next) pthread_cond_signal(&next->cond);
+	if(!uvm->reqs) pthread_cond_signal(&uvm->idle);
+	return r->result;
+}/*}}}*/
+
+struct uvm_req * uvm_req_find(uint32_t id)/*{{{*/
+{
+	struct uvm_req *r = uvm->reqs;
+	while(r && r->id != id) r = r->next;
+	if(!r) {
+		logd(LOG_FATAL, "reply to unknown request %u\n", id);
+		errno = EPROTO;
+		prexit();
+	}
+	return r;
+}/*}}}*/
+
+void uvm_req_done(uint32_t id, intptr_t result)/*{{{*/
+{
+	struct uvm_req *r = uvm_req_find(id);
+	r->result = result;
+	r->done = 1;
+	pthread_cond_signal(&r->cond);
+}/*}}}*/
+
 void uvm_segv_action(int signum, siginfo_t *si, void *context)/*{{{*/
 {
-	pthread_mutex_lock(&uvm->mutex);
+	lock_acquire(&uvm->mutex);
 	assert(si->si_signo == SIGSEGV);
 	logd(LOG_DEBUG, "segv addr %p code %d\n", si->si_addr, si->si_code);
 	intptr_t va = (intptr_t)si->si_addr;
@@ -231,111 +749,166 @@ void uvm_segv_action(int signum, siginfo_t *si, void *context)/*{{{*/
 		exit(EXIT_FAILURE);
 	}
 	size_t pagesz = sysconf(_SC_PAGESIZE);
-	if(va >= UVM_BASEADDR + (uvm->npages * pagesz)) {
+	if(va >= UVM_BASEADDR + (uvm->npages * pagesz) ||
+			uvm->released[(va - UVM_BASEADDR) / pagesz]) {
 		logd(LOG_DEBUG, "access to unnallocated MMU address.\n");
 		fprintf(stderr, "(internal) segmentation fault.\n");
 		fprintf(stderr, "address %p not allocated.\n", (void *)va);
 		exit(EXIT_FAILURE);
 	}
 
+	uvm->nfaults++;
+	struct uvm_req r;
+	uvm_req_start(&r);
 	struct mmu_proto_segv_req req;
 	req.type = MMU_PROTO_SEGV_REQ;
+	req.id = r.id;
 	req.addr = (intptr_t)si->si_addr;
 	req.code = si->si_code;
+	req.write = uvm_segv_write(si, context);
 	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req)) prexit();
 
-	logd(LOG_DEBUG, "%s waiting service at condition variable\n", __func__);
-	pthread_cond_wait(&uvm->cond, &uvm->mutex);
-	pthread_mutex_unlock(&uvm->mutex);
+	logd(LOG_DEBUG, "%s waiting service\n", __func__);
+	uvm_req_wait(&r);
+	lock_release(&uvm->mutex);
 	logd(LOG_DEBUG, "%s returning\n", __func__);
 }/*}}}*/
 
-/****************************************************************************
- * protocol message handlers
- ***************************************************************************/
-void uvm_proto_extend_rep(void)/*{{{*/
+/* Whether the faulting access was a write, from the page fault error
+ * code the kernel saves in the signal context.  Returns 0 where the
+ * access type is not available; the MMU then services the fault as
+ * a read and a write faults again. */
+int uvm_segv_write(const siginfo_t *si, const void *context)/*{{{*/
 {
-	logd(LOG_DEBUG, "processing EXTEND_REP\n");
-	struct mmu_proto_extend_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		prexit();
-	assert(rep.type == MMU_PROTO_EXTEND_REP);
-	uvm->result = (intptr_t)rep.vaddr;
-	pthread_cond_signal(&uvm->cond);
-}/*}}}*/
-
-void uvm_proto_syslog_rep(void)/*{{{*/
-{
-	logd(LOG_DEBUG, "processing SYSLOG_REP\n");
-	struct mmu_proto_syslog_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		prexit();
-	assert(rep.type == MMU_PROTO_SYSLOG_REP);
-	uvm->result = (intptr_t)rep.retcode;
-	pthread_cond_signal(&uvm->cond);
+	#if defined(__x86_64__) || defined(__i386__)
+	const ucontext_t *uc = context;
+	return (uc->uc_mcontext.gregs[REG_ERR] & 0x2) != 0; /* W/R bit */
+	#else
+	return 0;
+	#endif
 }/*}}}*/
 
-void uvm_proto_segv_rep(void)/*{{{*/
+/****************************************************************************
+ * protocol message handlers
+ ***************************************************************************/
+void uvm_proto_dispatch(const union uvm_msg *msg)/*{{{*/
 {
-	logd(LOG_DEBUG, "processing SEGV_REP\n");
-	struct mmu_proto_segv_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		prexit();
-	assert(rep.type == MMU_PROTO_SEGV_REP);
-	pthread_cond_signal(&uvm->cond);
+	switch(msg->hdr.type) {
+		case MMU_PROTO_EXTEND_REP:
+			logd(LOG_DEBUG, "processing EXTEND_REP %u\n", msg->hdr.id);
+			uvm_req_done(msg->hdr.id, (intptr_t)msg->extend.vaddr);
+			break;
+		case MMU_PROTO_SYSLOG_REP:
+			logd(LOG_DEBUG, "processing SYSLOG_REP %u\n", msg->hdr.id);
+			uvm_req_done(msg->hdr.id, (intptr_t)msg->syslog.retcode);
+			break;
+		case MMU_PROTO_SYSLOGV_REP:
+			logd(LOG_DEBUG, "processing SYSLOGV_REP %u\n", msg->hdr.id);
+			uvm_req_done(msg->hdr.id, (intptr_t)msg->syslogv.nlogged);
+			break;
+		case MMU_PROTO_RELEASE_REP:
+			logd(LOG_DEBUG, "processing RELEASE_REP %u\n", msg->hdr.id);
+			uvm_req_done(msg->hdr.id, (intptr_t)msg->release.retcode);
+			break;
+		case MMU_PROTO_ADVISE_REP:
+			logd(LOG_DEBUG, "processing ADVISE_REP %u\n", msg->hdr.id);
+			uvm_req_done(msg->hdr.id, (intptr_t)msg->advise.retcode);
+			break;
+		case MMU_PROTO_PIN_REP:
+			logd(LOG_DEBUG, "processing PIN_REP %u\n", msg->hdr.id);
+			uvm_req_done(msg->hdr.id, (intptr_t)msg->pin.retcode);
+			break;
+		case MMU_PROTO_SHARE_REP:
+			logd(LOG_DEBUG, "processing SHARE_REP %u\n", msg->hdr.id);
+			memcpy(uvm_req_find(msg->hdr.id)->reply, &msg->share,
+					sizeof(msg->share));
+			uvm_req_done(msg->hdr.id, (intptr_t)msg->share.vaddr);
+			break;
+		case MMU_PROTO_MAP_REP:
+			logd(LOG_DEBUG, "processing MAP_REP %u\n", msg->hdr.id);
+			memcpy(uvm_req_find(msg->hdr.id)->reply, &msg->map,
+					sizeof(msg->map));
+			uvm_req_done(msg->hdr.id, (intptr_t)msg->map.vaddr);
+			break;
+		case MMU_PROTO_RSS_REP:
+			logd(LOG_DEBUG, "processing RSS_REP %u\n", msg->hdr.id);
+			uvm_req_done(msg->hdr.id, msg->rss.retcode);
+			break;
+		case MMU_PROTO_SEGV_REP:
+			logd(LOG_DEBUG, "processing SEGV_REP %u\n", msg->hdr.id);
+			uvm_req_done(msg->hdr.id, 0);
+			break;
+		case MMU_PROTO_REMAP_REP:
+			uvm_proto_remap_rep(&msg->remap);
+			break;
+		case MMU_PROTO_CHPROT_REP:
+			uvm_proto_chprot_rep(&msg->chprot);
+			break;
+		case MMU_PROTO_EXIT_REP:
+			uvm->running = 0;
+			break;
+		default:
+			prexit();
+			break;
+	}
 }/*}}}*/
 
-void uvm_proto_remap_rep(void)/*{{{*/
+void uvm_proto_remap_rep(const struct mmu_proto_remap_rep *rep)/*{{{*/
 {
-	logd(LOG_DEBUG, "processing REMAP_REP\n");
-	struct mmu_proto_remap_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		prexit();
-	assert(rep.type == MMU_PROTO_REMAP_REP);
-	assert(rep.prot != PROT_NONE);
-
-	assert(rep.vaddr < UINTPTR_MAX);
-	void *addr = (void *)(intptr_t)rep.vaddr;
-	int prot = (int)rep.prot;
-	off_t off = (off_t)rep.offset;
+	logd(LOG_DEBUG, "processing REMAP_REP %u\n", rep->id);
+	assert(rep->type == MMU_PROTO_REMAP_REP);
+	assert(rep->prot != PROT_NONE);
+
+	assert(rep->vaddr < UINTPTR_MAX);
+	void *addr = (void *)(intptr_t)rep->vaddr;
+	int prot = (int)rep->prot;
+	off_t off = (off_t)rep->offset;
 	size_t pagesz = sysconf(_SC_PAGESIZE);
-	logd(LOG_DEBUG, "remapping %p at offset %llu prot %d\n", rep.vaddr,
-			(unsigned long long)rep.offset, prot);
-	munmap(addr, pagesz);
-	void *r = mmap(addr, pagesz, prot, MAP_SHARED, uvm->pmem_fd, off);
-	if(r != addr)
-		prexit();
-	logd(LOG_DEBUG, "mprotect %p prot %d\n", rep.vaddr, prot);
-	if(mprotect(addr, pagesz, prot) == -1)
+	logd(LOG_DEBUG, "remapping %p at offset %llu prot %d\n", addr,
+			(unsigned long long)rep->offset, prot);
+	/* MAP_FIXED replaces whatever is mapped at `addr` (the page's
+	 * old frame or nothing) and sets `prot` in the same call */
+	int flags = MAP_SHARED | MAP_FIXED;
+	if(mmap(addr, pagesz, prot, flags, uvm->pmem_fd, off) != addr)
 		prexit();
+	uvm->nmapcalls++;
 
 	struct mmu_proto_remap_req req;
 	req.type = MMU_PROTO_REMAP_REQ;
+	req.id = rep->id;
 	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req)) prexit();
 }/*}}}*/
 
-void uvm_proto_chprot_rep(void)/*{{{*/
+void uvm_proto_chprot_rep(const struct mmu_proto_chprot_rep *rep)/*{{{*/
 {
-	logd(LOG_DEBUG, "processing CHPROT_REP\n");
-	struct mmu_proto_chprot_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		prexit();
-	assert(rep.type == MMU_PROTO_CHPROT_REP);
+	logd(LOG_DEBUG, "processing CHPROT_REP %u\n", rep->id);
+	assert(rep->type == MMU_PROTO_CHPROT_REP);
 
-	assert(rep.vaddr < UINTPTR_MAX);
-	void *addr = (void *)(uintptr_t)rep.vaddr;
-	int prot = (int)rep.prot;
+	assert(rep->vaddr < UINTPTR_MAX);
+	void *addr = (void *)(uintptr_t)rep->vaddr;
+	int prot = (int)rep->prot;
 	size_t pagesz = sysconf(_SC_PAGESIZE);
-	logd(LOG_DEBUG, "mprotect %p prot %d\n", addr, prot);
-	if(mprotect(addr, pagesz, prot) == -1)
-		prexit();
+	if(uvm->uffd != -1) {
+		/* the MMU already has the contents; the next access faults */
+		assert(prot == PROT_NONE);
+		logd(LOG_DEBUG, "dropping %p\n", addr);
+		if(madvise(addr, pagesz, MADV_DONTNEED) == -1)
+			prexit();
+		uvm->nmapcalls++;
+	} else {
+		logd(LOG_DEBUG, "mprotect %p prot %d\n", addr, prot);
+		if(mprotect(addr, pagesz, prot) == -1)
+			prexit();
+		uvm->nmapcalls++;
+	}
 	/* if(prot == PROT_NONE) {
-		logd(LOG_DEBUG, "unmaping %p\n", rep.vaddr);
+		logd(LOG_DEBUG, "unmaping %p\n", rep->vaddr);
 		if(munmap(addr, pagesz) == -1)
 			prexit();
 	} */
 
 	struct mmu_proto_chprot_req req;
 	req.type = MMU_PROTO_CHPROT_REQ;
+	req.id = rep->id;
 	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req)) prexit();
 }/*}}}*/
@@ -6,20 +6,41 @@
 #define __UVM_HEADER__
 
 #include <stdlib.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 /* `uvm_create` should be called when a program starts to bind it to
  * the memory management infrastructure.  This function sets up
  * a UNIX socket to communicate with the memory management
- * infrastructure and installs a signal handler for SIGSEGV. */
+ * infrastructure and installs a signal handler for SIGSEGV.  Faults
+ * are serviced by the faulting thread itself; set the environment
+ * variable UVM_FAULT_HANDOFF=1 to have a helper thread service them
+ * instead.  With UVM_USERFAULTFD=1, faults are delivered to the MMU
+ * through userfaultfd(2) and resolved there, without signals; if
+ * userfaultfd is unavailable the SIGSEGV handler is used. */
 void uvm_create(void);
 
+/* `uvm_rss_limit` limits the number of frames (physical pages) the
+ * memory infrastructure keeps for the calling program.  Up to `min`
+ * frames are protected from other programs' page faults; at `max`
+ * frames (0 means no limit) the program's page faults evict its own
+ * pages.  When memory is short, programs holding more than their share
+ * of it lose pages first.  `uvm_create` calls it when the environment
+ * variables UVM_RSS_MIN or UVM_RSS_MAX are set, and the `mmuctl` tool
+ * shows or changes the limits of running programs.  Returns 0 on
+ * success; on failure, returns -1 and sets `errno` to EINVAL if `min`
+ * is above a nonzero `max`, or ENOMEM if the minimums of all programs
+ * would not leave a frame for others. */
+int uvm_rss_limit(size_t min, size_t max);
+
 /* `uvm_extend` allocates a new page for the calling process and
  * returns the address where the page was mapped.  This is analogous
  * to the `sbrk` system call.  Memory allocated with `uvm_extend` is
  * managed by the memory infrastructure, and must not be `free`d.
  * `uvm_extend` fails, returns NULL, and sets `errno` to ENOSPC if
- * the memory infrastructure swap (disk) is out of space.  The
- * system page size is given by `sysconf(_SC_PAGESIZE)`. */
+ * the memory infrastructure swap (disk) is out of space or the
+ * address space up to `UVM_MAXADDR` is full.  The system page size
+ * is given by `sysconf(_SC_PAGESIZE)`. */
 void * uvm_extend(void);
 
 /* `uvm_syslog` requests the memory infrastructure to write the
@@ -29,4 +50,94 @@ void * uvm_extend(void);
  * sets `errno` to EINVAL. */
 int uvm_syslog(void *addr, size_t len);
 
+/* `uvm_syslogv` writes the `iovcnt` buffers in `iov` as if calling
+ * `uvm_syslog` on each in order, but sends them to the memory
+ * infrastructure in as few requests as possible.  Returns the number
+ * of buffers written, which is `iovcnt` on success.  If a buffer is
+ * not managed memory, the ones before it are written, its index is
+ * returned, and `errno` is set to EINVAL. */
+int uvm_syslogv(const struct iovec *iov, int iovcnt);
+
+/* `uvm_release` gives the `npages` pages starting at `addr` back to
+ * the memory infrastructure, freeing the memory and disk space they
+ * use.  `addr` must be page-aligned and all pages must be allocated.
+ * Released pages are unmapped and their contents are lost; accessing
+ * them is a segmentation fault.  Pages released at the end of the
+ * allocated memory are handed out again by later `uvm_extend` calls,
+ * like shrinking with `sbrk`; pages released in the middle leave a
+ * hole that later `uvm_extend` calls fill, lowest address first,
+ * before growing the allocated memory.  Returns 0 on success; on
+ * failure, returns -1 and sets `errno` to EINVAL. */
+int uvm_release(void *addr, size_t npages);
+
+/* `uvm_advise` tells the memory infrastructure how the `npages` pages
+ * starting at `addr` will be accessed, so it can read pages ahead or
+ * page them out early.  `advice` is one of the `UVM_ADV_*` constants
+ * in mmu.h.  Advice never changes the contents of memory.  `addr`
+ * must be page-aligned and all pages must be allocated.  Returns 0 on
+ * success; on failure, returns -1 and sets `errno` to EINVAL. */
+int uvm_advise(void *addr, size_t npages, int advice);
+
+/* `uvm_pin` brings the `npages` pages starting at `addr` into memory
+ * and keeps them there, so accessing them never waits for the disk,
+ * until `uvm_unpin` is called on them or they are released.  `addr`
+ * must be page-aligned and all pages must be allocated.  The memory
+ * infrastructure limits how many pages each process may pin.  Returns
+ * 0 on success; on failure, returns -1 and sets `errno` to EINVAL for
+ * an invalid range or ENOMEM if the pages would exceed the limit. */
+int uvm_pin(void *addr, size_t npages);
+int uvm_unpin(void *addr, size_t npages);
+
+/* `uvm_share` creates a region of `npages` pages called `name` that
+ * other programs using the same memory infrastructure can attach with
+ * `uvm_attach`, and attaches it to the caller.  `uvm_attach` stores
+ * the number of pages of the region in `npages`.  Both return the
+ * address where the region starts, after the memory the caller has
+ * already allocated; each program may see the region at a different
+ * address.  Writes to the region are seen by every program attaching
+ * it, without copies.  Pages of a region are given back with
+ * `uvm_release`; the region is destroyed, and its name can be used
+ * again, once some page of it is released by every program that
+ * attached it (programs that exit release their pages).  Shared pages
+ * cannot be pinned.  On failure these return NULL and set `errno` to
+ * EINVAL for a name longer than `UVM_SHARE_NAME_MAX - 1` characters
+ * (see mmu.h) or an empty region, EEXIST if `uvm_share` finds the name
+ * in use, ENOENT if `uvm_attach` does not find it, ENOSPC if the
+ * memory infrastructure is out of space, or EOPNOTSUPP when faults
+ * are delivered through userfaultfd (see `uvm_create`). */
+void * uvm_share(const char *name, size_t npages);
+void * uvm_attach(const char *name, size_t *npages);
+
+/* `uvm_map_file` maps `npages` pages of the file at `path`, starting
+ * at byte `offset`, after the memory the caller has already allocated,
+ * and returns the address of the first page.  Pages are read from the
+ * file when first accessed, so a large file can be mapped quickly, and
+ * pages that are not written never use swap.  Bytes past the end of the
+ * file read as zeroes (the character '0').  `flags` is one of the
+ * `UVM_MAP_*` constants in mmu.h: with `UVM_MAP_PRIVATE` writes are
+ * never seen in the file, and whether the mapping sees later changes
+ * to the file is unspecified; with `UVM_MAP_WRITEBACK` written pages are
+ * copied back to the file when the memory infrastructure pages them
+ * out or they are released (exiting releases every page), without
+ * growing the file.  Mapped pages are given back with `uvm_release`.
+ * On failure it returns NULL and sets `errno` as `open(2)` would, to
+ * EINVAL if `offset` is not page-aligned, `npages` is zero, or `flags`
+ * is invalid, or to ENOSPC if the memory infrastructure is out of
+ * space. */
+void * uvm_map_file(const char *path, off_t offset, size_t npages, int flags);
+
+/* `uvm_malloc`, `uvm_calloc`, `uvm_realloc`, and `uvm_free` behave
+ * like their standard library counterparts, but serve memory managed
+ * by the memory infrastructure.  Pages are obtained with `uvm_extend`
+ * and, once no allocation uses them, given back with `uvm_release`,
+ * so a program should not mix these functions with its own
+ * `uvm_release` calls on the same pages.  Requests up to half a page
+ * come from per-thread pages of same-sized objects; larger ones get
+ * their own run of contiguous pages.  On failure, or when asked for
+ * zero bytes, these return NULL and set `errno` to ENOMEM. */
+void * uvm_malloc(size_t size);
+void * uvm_calloc(size_t nmemb, size_t size);
+void * uvm_realloc(void *ptr, size_t size);
+void uvm_free(void *ptr);
+
 #endif
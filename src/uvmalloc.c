@@ -0,0 +1,431 @@
+/* `uvm_malloc` and friends (see uvm.h).  Small requests are rounded up
+ * to a power-of-two size class and served from slab pages holding
+ * objects of a single class.  Each thread allocates from its own slab
+ * page per class without locking; a slab that fills up is dropped by
+ * its thread and goes back on its class's partial list when an object
+ * in it is freed.  Freed objects first go to a small per-thread cache
+ * that `uvm_malloc` reuses; when it fills up, half of it is returned
+ * to the slabs under the allocator lock.  Requests over half a page
+ * get a run of contiguous pages.
+ *
+ * Metadata lives in the ordinary heap, in a table indexed by page
+ * number, so allocating and freeing never touch managed memory and
+ * empty pages can be given back without faulting them in.  Empty pages
+ * are kept for reuse until there are more than UVMA_TRIM of them; then
+ * all but UVMA_KEEP are released to the memory infrastructure,
+ * highest addresses first so the allocated memory shrinks.  Holes
+ * left by releases are filled by `uvm_extend` before it grows the
+ * memory. */
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+/****************************************************************************
+ * structure definitions and static variables
+ ***************************************************************************/
+#define UVMA_SLOTS 256	/* objects in a slab of the smallest class */
+#define UVMA_WORDS (UVMA_SLOTS / 64)
+#define UVMA_CLASSES 8	/* UVMA_SLOTS objects down to two per page */
+#define UVMA_KEEP 4	/* empty pages kept after a trim */
+#define UVMA_TRIM 32	/* empty pages that trigger a trim */
+#define UVMA_TCACHE 32	/* freed objects cached per thread and class */
+
+enum uvma_state {
+	UVMA_NONE,	/* not allocated from the memory infrastructure */
+	UVMA_EMPTY,
+	UVMA_SLAB,
+	UVMA_RUN,	/* first page of a run */
+	UVMA_RUN_TAIL,
+};
+
+struct uvma_page {/*{{{*/
+	int state;
+	int cls;	/* UVMA_SLAB */
+	int npages;	/* UVMA_RUN */
+	void *owner;	/* thread cache allocating from this slab */
+	int listed;	/* on the partial list of its class */
+	int prev, next;
+	int nused;	/* objects in use, updated atomically */
+	uint64_t bits[UVMA_WORDS];	/* set for slots in use */
+};/*}}}*/
+
+struct uvma_tcache {/*{{{*/
+	int init;
+	int slab[UVMA_CLASSES];
+	int ncached[UVMA_CLASSES];
+	void *cached[UVMA_CLASSES][UVMA_TCACHE];
+};/*}}}*/
+
+static struct {/*{{{*/
+	pthread_mutex_t mutex;	/* protects everything but owned slabs */
+	size_t pagesz;
+	size_t minsize;
+	int maxpages;
+	int nempty;
+	int partial[UVMA_CLASSES];
+	struct uvma_page *pages;
+	pthread_key_t key;
+} uvma;/*}}}*/
+
+static pthread_once_t uvma_once = PTHREAD_ONCE_INIT;
+static __thread struct uvma_tcache tcache;
+
+/****************************************************************************
+ * static function declarations
+ ***************************************************************************/
+static void uvma_init(void);
+static struct uvma_tcache * uvma_tcache(void);
+static void uvma_thread_exit(void *vtc);
+static int uvma_class(size_t size);
+static int uvma_index(const void *ptr);
+static void * uvma_addr(int idx);
+static int uvma_take(struct uvma_page *p);
+static void uvma_flush(struct uvma_tcache *tc, int cls, int n);
+static void uvma_slot_free(void *ptr);
+static int uvma_slab_get(int cls, struct uvma_tcache *tc);
+static void uvma_slab_drop(int idx);
+static void uvma_list(int idx);
+static void uvma_unlist(int idx);
+static int uvma_page_get(void);
+static void uvma_page_put(int idx);
+static int uvma_run_find(int npages);
+static void * uvma_run_alloc(int npages);
+static void uvma_trim(void);
+
+/****************************************************************************
+ * public function implementations
+ ***************************************************************************/
+void * uvm_malloc(size_t size)/*{{{*/
+{
+	pthread_once(&uvma_once, uvma_init);
+	/* checked before rounding up, which wraps for huge sizes */
+	if(size == 0 || size > (size_t)uvma.maxpages * uvma.pagesz) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if(size > uvma.pagesz / 2) {
+		return uvma_run_alloc((size + uvma.pagesz - 1) / uvma.pagesz);
+	}
+	int cls = uvma_class(size);
+	struct uvma_tcache *tc = uvma_tcache();
+	if(tc->ncached[cls] > 0) return tc->cached[cls][--tc->ncached[cls]];
+	for(;;) {
+		int idx = tc->slab[cls];
+		if(idx != -1) {
+			int slot = uvma_take(&uvma.pages[idx]);
+			if(slot != -1) {
+				return (char *)uvma_addr(idx) + slot * (uvma.minsize << cls);
+			}
+		}
+		pthread_mutex_lock(&uvma.mutex);
+		if(idx != -1 && uvma.pages[idx].nused < uvma.pagesz /
+				(uvma.minsize << cls)) {
+			/* another thread freed an object after we looked */
+			pthread_mutex_unlock(&uvma.mutex);
+			continue;
+		}
+		if(idx != -1) uvma.pages[idx].owner = NULL;
+		tc->slab[cls] = uvma_slab_get(cls, tc);
+		pthread_mutex_unlock(&uvma.mutex);
+		if(tc->slab[cls] == -1) {
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+}/*}}}*/
+
+void * uvm_calloc(size_t nmemb, size_t size)/*{{{*/
+{
+	if(size && nmemb > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	/* fresh pages are not zeroed by the memory infrastructure */
+	void *ptr = uvm_malloc(nmemb * size);
+	if(ptr) memset(ptr, 0, nmemb * size);
+	return ptr;
+}/*}}}*/
+
+void * uvm_realloc(void *ptr, size_t size)/*{{{*/
+{
+	if(!ptr) return uvm_malloc(size);
+	if(size == 0) {
+		uvm_free(ptr);
+		return NULL;
+	}
+	struct uvma_page *p = &uvma.pages[uvma_index(ptr)];
+	size_t old;
+	if(p->state == UVMA_RUN) {
+		old = p->npages * uvma.pagesz;
+		if(size <= old && size > old - uvma.pagesz) return ptr;
+	} else {
+		assert(p->state == UVMA_SLAB);
+		old = uvma.minsize << p->cls;
+		if(size <= old && (p->cls == 0 || size > old / 2)) return ptr;
+	}
+	void *nptr = uvm_malloc(size);
+	if(!nptr) return NULL;
+	memcpy(nptr, ptr, size < old ? size : old);
+	uvm_free(ptr);
+	return nptr;
+}/*}}}*/
+
+void uvm_free(void *ptr)/*{{{*/
+{
+	if(!ptr) return;
+	int idx = uvma_index(ptr);
+	struct uvma_page *p = &uvma.pages[idx];
+	if(p->state == UVMA_RUN) {
+		pthread_mutex_lock(&uvma.mutex);
+		for(int i = idx; i < idx + p->npages; ++i) uvma_page_put(i);
+		uvma_trim();
+		pthread_mutex_unlock(&uvma.mutex);
+		return;
+	}
+	assert(p->state == UVMA_SLAB);
+	struct uvma_tcache *tc = uvma_tcache();
+	if(tc->ncached[p->cls] == UVMA_TCACHE)
+		uvma_flush(tc, p->cls, UVMA_TCACHE / 2);
+	tc->cached[p->cls][tc->ncached[p->cls]++] = ptr;
+}/*}}}*/
+
+/****************************************************************************
+ * static function implementations
+ ***************************************************************************/
+void uvma_init(void)/*{{{*/
+{
+	pthread_mutex_init(&uvma.mutex, NULL);
+	uvma.pagesz = sysconf(_SC_PAGESIZE);
+	uvma.minsize = uvma.pagesz / UVMA_SLOTS;
+	uvma.maxpages = (UVM_MAXADDR - UVM_BASEADDR + 1) / uvma.pagesz;
+	uvma.nempty = 0;
+	for(int i = 0; i < UVMA_CLASSES; ++i) uvma.partial[i] = -1;
+	uvma.pages = calloc(uvma.maxpages, sizeof(*uvma.pages));
+	assert(uvma.pages);
+	pthread_key_create(&uvma.key, uvma_thread_exit);
+}/*}}}*/
+
+struct uvma_tcache * uvma_tcache(void)/*{{{*/
+{
+	if(!tcache.init) {
+		for(int i = 0; i < UVMA_CLASSES; ++i) tcache.slab[i] = -1;
+		tcache.init = 1;
+		pthread_setspecific(uvma.key, &tcache);
+	}
+	return &tcache;
+}/*}}}*/
+
+void uvma_thread_exit(void *vtc)/*{{{*/
+{
+	struct uvma_tcache *tc = vtc;
+	for(int cls = 0; cls < UVMA_CLASSES; ++cls)
+		uvma_flush(tc, cls, tc->ncached[cls]);
+	pthread_mutex_lock(&uvma.mutex);
+	for(int cls = 0; cls < UVMA_CLASSES; ++cls) {
+		int idx = tc->slab[cls];
+		if(idx == -1) continue;
+		uvma.pages[idx].owner = NULL;
+		if(uvma.pages[idx].nused == 0) uvma_slab_drop(idx);
+		else if(uvma.pages[idx].nused < uvma.pagesz / (uvma.minsize << cls))
+			uvma_list(idx);
+		tc->slab[cls] = -1;
+	}
+	uvma_trim();
+	pthread_mutex_unlock(&uvma.mutex);
+}/*}}}*/
+
+int uvma_class(size_t size)/*{{{*/
+{
+	int cls = 0;
+	while((uvma.minsize << cls) < size) cls++;
+	return cls;
+}/*}}}*/
+
+int uvma_index(const void *ptr)/*{{{*/
+{
+	intptr_t va = (intptr_t)ptr;
+	assert(va >= UVM_BASEADDR && va <= UVM_MAXADDR);
+	return (va - UVM_BASEADDR) / uvma.pagesz;
+}/*}}}*/
+
+void * uvma_addr(int idx)/*{{{*/
+{
+	return (void *)(UVM_BASEADDR + idx * uvma.pagesz);
+}/*}}}*/
+
+int uvma_take(struct uvma_page *p)/*{{{*/
+{
+	/* only the owner sets bits, so a free slot stays free until taken */
+	for(int w = 0; w < UVMA_WORDS; ++w) {
+		uint64_t bits = __atomic_load_n(&p->bits[w], __ATOMIC_ACQUIRE);
+		if(bits == ~(uint64_t)0) continue;
+		int b = __builtin_ctzll(~bits);
+		__atomic_fetch_or(&p->bits[w], (uint64_t)1 << b, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&p->nused, 1, __ATOMIC_RELAXED);
+		return w * 64 + b;
+	}
+	return -1;
+}/*}}}*/
+
+void uvma_flush(struct uvma_tcache *tc, int cls, int n)/*{{{*/
+{
+	/* the oldest objects go back; recently freed ones stay cached */
+	pthread_mutex_lock(&uvma.mutex);
+	for(int i = 0; i < n; ++i) uvma_slot_free(tc->cached[cls][i]);
+	uvma_trim();
+	pthread_mutex_unlock(&uvma.mutex);
+	tc->ncached[cls] -= n;
+	memmove(tc->cached[cls], tc->cached[cls] + n,
+			tc->ncached[cls] * sizeof(tc->cached[cls][0]));
+}/*}}}*/
+
+void uvma_slot_free(void *ptr)/*{{{*/
+{
+	int idx = uvma_index(ptr);
+	struct uvma_page *p = &uvma.pages[idx];
+	int slot = ((char *)ptr - (char *)uvma_addr(idx)) /
+			(uvma.minsize << p->cls);
+	uint64_t bit = (uint64_t)1 << (slot % 64);
+	/* the owner may be taking slots from the same word without the lock */
+	__atomic_fetch_and(&p->bits[slot / 64], ~bit, __ATOMIC_RELEASE);
+	__atomic_fetch_sub(&p->nused, 1, __ATOMIC_RELAXED);
+	if(p->owner == NULL) {
+		if(p->nused == 0) uvma_slab_drop(idx);
+		else if(!p->listed) uvma_list(idx);
+	}
+}/*}}}*/
+
+int uvma_slab_get(int cls, struct uvma_tcache *tc)/*{{{*/
+{
+	int idx = uvma.partial[cls];
+	if(idx != -1) {
+		uvma_unlist(idx);
+	} else {
+		idx = uvma_page_get();
+		if(idx == -1) return -1;
+		struct uvma_page *p = &uvma.pages[idx];
+		p->state = UVMA_SLAB;
+		p->cls = cls;
+		p->nused = 0;
+		p->listed = 0;
+		/* slots past the end of the page are always in use */
+		int nslots = uvma.pagesz / (uvma.minsize << cls);
+		for(int w = 0; w < UVMA_WORDS; ++w) {
+			int lo = w * 64;
+			if(nslots <= lo) p->bits[w] = ~(uint64_t)0;
+			else if(nslots >= lo + 64) p->bits[w] = 0;
+			else p->bits[w] = ~(uint64_t)0 << (nslots - lo);
+		}
+	}
+	uvma.pages[idx].owner = tc;
+	return idx;
+}/*}}}*/
+
+void uvma_slab_drop(int idx)/*{{{*/
+{
+	if(uvma.pages[idx].listed) uvma_unlist(idx);
+	uvma_page_put(idx);
+}/*}}}*/
+
+void uvma_list(int idx)/*{{{*/
+{
+	struct uvma_page *p = &uvma.pages[idx];
+	p->listed = 1;
+	p->prev = -1;
+	p->next = uvma.partial[p->cls];
+	if(p->next != -1) uvma.pages[p->next].prev = idx;
+	uvma.partial[p->cls] = idx;
+}/*}}}*/
+
+void uvma_unlist(int idx)/*{{{*/
+{
+	struct uvma_page *p = &uvma.pages[idx];
+	if(p->prev != -1) uvma.pages[p->prev].next = p->next;
+	else uvma.partial[p->cls] = p->next;
+	if(p->next != -1) uvma.pages[p->next].prev = p->prev;
+	p->listed = 0;
+}/*}}}*/
+
+int uvma_page_get(void)/*{{{*/
+{
+	for(int i = 0; uvma.nempty > 0 && i < uvma.maxpages; ++i) {
+		if(uvma.pages[i].state == UVMA_EMPTY) {
+			uvma.nempty--;
+			return i;
+		}
+	}
+	void *vaddr = uvm_extend();
+	if(!vaddr) return -1;
+	return uvma_index(vaddr);
+}/*}}}*/
+
+void uvma_page_put(int idx)/*{{{*/
+{
+	uvma.pages[idx].state = UVMA_EMPTY;
+	uvma.pages[idx].owner = NULL;
+	uvma.nempty++;
+}/*}}}*/
+
+int uvma_run_find(int npages)/*{{{*/
+{
+	int len = 0;
+	for(int i = 0; i < uvma.maxpages; ++i) {
+		len = uvma.pages[i].state == UVMA_EMPTY ? len + 1 : 0;
+		if(len == npages) return i - npages + 1;
+	}
+	return -1;
+}/*}}}*/
+
+void * uvma_run_alloc(int npages)/*{{{*/
+{
+	pthread_mutex_lock(&uvma.mutex);
+	int first;
+	/* `uvm_extend` fills holes first, so pages it hands out are only
+	 * contiguous once the holes are gone */
+	while((first = uvma_run_find(npages)) == -1) {
+		void *vaddr = uvm_extend();
+		if(!vaddr) break;
+		uvma_page_put(uvma_index(vaddr));
+	}
+	if(first != -1) {
+		uvma.pages[first].state = UVMA_RUN;
+		uvma.pages[first].npages = npages;
+		for(int i = first + 1; i < first + npages; ++i)
+			uvma.pages[i].state = UVMA_RUN_TAIL;
+		uvma.nempty -= npages;
+	}
+	uvma_trim();
+	pthread_mutex_unlock(&uvma.mutex);
+	if(first == -1) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return uvma_addr(first);
+}/*}}}*/
+
+void uvma_trim(void)/*{{{*/
+{
+	if(uvma.nempty <= UVMA_TRIM) return;
+	int top = uvma.maxpages - 1;
+	while(uvma.nempty > UVMA_KEEP) {
+		while(uvma.pages[top].state != UVMA_EMPTY) top--;
+		int first = top;
+		while(first > 0 && top - first + 1 < uvma.nempty - UVMA_KEEP &&
+				uvma.pages[first - 1].state == UVMA_EMPTY) {
+			first--;
+		}
+		int n = top - first + 1;
+		if(uvm_release(uvma_addr(first), n) == -1) return;
+		for(int i = first; i <= top; ++i) uvma.pages[i].state = UVMA_NONE;
+		uvma.nempty -= n;
+		top = first - 1;
+	}
+}/*}}}*/